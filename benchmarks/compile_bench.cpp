@@ -0,0 +1,304 @@
+/**
+ * @file compile_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// compiler throughput benchmark
+// every input is run through increasingly long prefixes of the compiler:
+// the lexer alone, lexer and parser, then code generation and finally
+// object emission, each stage reports lines/sec and tokens/sec
+// with inputs of different sizes the time of every stage is fitted to
+// lines^k, a k clearly above 1 means something in that stage is superlinear
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+#include "llvm/Support/Path.h"
+
+
+enum Stage {
+    STAGE_LEX,
+    STAGE_PARSE,
+    STAGE_CODEGEN,
+    STAGE_EMIT,
+    STAGE_COUNT
+};
+
+
+static const char *stageNames[STAGE_COUNT] = {
+    "lex", "parse", "codegen", "emit"
+};
+
+
+// measurements of one input file
+struct FileResult {
+    std::string file;
+    size_t lines;
+    size_t tokens;
+    double seconds[STAGE_COUNT];    // fastest repetition, stages are cumulative
+};
+
+
+static unsigned reps = 3;
+static Stage lastStage = STAGE_EMIT;
+static double superlinear = 1.2;
+static std::string jsonFile;
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static size_t countLines(const std::string &file) {
+    std::ifstream in(file);
+    return std::count(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>(), '\n');
+}
+
+
+static size_t lexOnly(const std::string &file) {
+    Lexer lex(file);
+    size_t tokens = 0;
+    while (lex.getTok().tp != TOK_EOF)
+        tokens++;
+    return tokens;
+}
+
+
+// same dispatch as the driver's main loop
+static void parseAll(Lexer *lex, CodeGenVisitor *codegen) {
+    while (true) {
+        Token t = lex->peekTok();
+        if (t.tp == TOK_EOF)
+            return;
+        std::unique_ptr<FunctionAST> fnAST;
+        std::unique_ptr<PrototypeAST> protoAST;
+        if (t.tp == TOK_FN || (t.tp == TOK_SYM && t.lx == "@"))
+            fnAST = Definition(lex);
+        else if (t.tp == TOK_EXTERN)
+            protoAST = Extern(lex);
+        else
+            fnAST = TopLevelExpr(lex);
+        if (!fnAST && !protoAST)
+            lex->getTok();
+        else if (codegen && fnAST)
+            fnAST->accept(*codegen);
+        else if (codegen)
+            protoAST->accept(*codegen);
+    }
+}
+
+
+static std::unique_ptr<TargetMachine> createTargetMachine() {
+    std::string error;
+    auto triple = sys::getDefaultTargetTriple();
+    auto target = TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        fprintf(stderr, "%s\n", error.c_str());
+        exit(1);
+    }
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+        triple, "generic", "", TargetOptions(), Optional<Reloc::Model>(Reloc::PIC_)));
+}
+
+
+// run the compiler up to and including stage once
+static void runStage(const std::string &file, Stage stage) {
+    if (stage == STAGE_LEX) {
+        lexOnly(file);
+        return;
+    }
+    Lexer lex(file);
+    if (stage == STAGE_PARSE) {
+        parseAll(&lex, nullptr);
+        return;
+    }
+    CodeGenVisitor codegen;
+    parseAll(&lex, &codegen);
+    if (stage == STAGE_CODEGEN)
+        return;
+    auto targetMachine = createTargetMachine();
+    Module *module = codegen.borrowModule();
+    module->setDataLayout(targetMachine->createDataLayout());
+    module->setTargetTriple(targetMachine->getTargetTriple().str());
+    SmallVector<char, 0> buffer;
+    raw_svector_ostream os(buffer);
+    legacy::PassManager pass;
+    targetMachine->addPassesToEmitFile(pass, os, nullptr, CGFT_ObjectFile);
+    pass.run(*module);
+}
+
+
+static FileResult measure(const std::string &file) {
+    FileResult r;
+    r.file = file;
+    r.lines = countLines(file);
+    r.tokens = lexOnly(file);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        r.seconds[s] = 0;
+        if (s > lastStage)
+            continue;
+        double best = INFINITY;
+        for (unsigned i = 0; i < reps; i++) {
+            auto start = Clock::now();
+            runStage(file, (Stage)s);
+            best = std::min(best,
+                std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        r.seconds[s] = best;
+    }
+    return r;
+}
+
+
+// least squares slope of log(seconds) over log(lines)
+static double scalingExponent(const std::vector<FileResult> &results, int stage) {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (auto &r : results) {
+        if (r.lines == 0 || r.seconds[stage] <= 0)
+            continue;
+        double x = std::log((double)r.lines), y = std::log(r.seconds[stage]);
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denom = n * sxx - sx * sx;
+    if (n < 2 || denom == 0)
+        return NAN;
+    return (n * sxy - sx * sy) / denom;
+}
+
+
+static void writeJSON(FILE *out, const std::vector<FileResult> &results) {
+    fprintf(out, "{\n  \"suite\": \"compile-throughput\",\n  \"timestamp\": %lld,\n",
+            (long long)time(nullptr));
+    fprintf(out, "  \"reps\": %u,\n  \"results\": [\n", reps);
+    for (size_t i = 0; i < results.size(); i++) {
+        const FileResult &r = results[i];
+        fprintf(out, "    {\"file\": \"%s\", \"lines\": %zu, \"tokens\": %zu",
+                r.file.c_str(), r.lines, r.tokens);
+        for (int s = 0; s <= lastStage; s++)
+            fprintf(out, ",\n     \"%s\": {\"seconds\": %.6f, \"lines_per_sec\": %.1f, "
+                    "\"tokens_per_sec\": %.1f}", stageNames[s], r.seconds[s],
+                    r.lines / r.seconds[s], r.tokens / r.seconds[s]);
+        fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"scaling\": {");
+    for (int s = 0; s <= lastStage; s++) {
+        double k = scalingExponent(results, s);
+        if (std::isnan(k))
+            fprintf(out, "%s\"%s\": null", s ? ", " : "", stageNames[s]);
+        else
+            fprintf(out, "%s\"%s\": %.3f", s ? ", " : "", stageNames[s], k);
+    }
+    fprintf(out, "}\n}\n");
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] <input_files>\n"
+            "Inputs of different sizes but the same shape give the scaling\n"
+            "-r <n>:  Repetitions per stage, the fastest one is kept (default 3)\n"
+            "-s <stage>:  Stop after lex, parse, codegen or emit (default emit)\n"
+            "-t <k>:  Warn when a stage scales worse than lines^k (default 1.2)\n"
+            "-json <file>:  Write the JSON results to file instead of stdout\n",
+            argv0);
+}
+
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"json", required_argument, nullptr, 'J'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "hr:s:t:",
+                                   longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'r':
+                reps = std::max(1, atoi(optarg));
+                break;
+            case 's': {
+                auto it = std::find_if(stageNames, stageNames + STAGE_COUNT,
+                    [](const char *name) { return std::string(name) == optarg; });
+                if (it == stageNames + STAGE_COUNT) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                lastStage = (Stage)(it - stageNames);
+                break;
+            }
+            case 't':
+                superlinear = atof(optarg);
+                break;
+            case 'J':
+                jsonFile = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    std::vector<FileResult> results;
+    fprintf(stderr, "%-28s %8s %9s %-8s %10s %14s %14s\n", "file", "lines",
+            "tokens", "stage", "time (s)", "lines/s", "tokens/s");
+    for (int i = optind; i < argc; i++) {
+        if (!sys::fs::exists(argv[i])) {
+            fprintf(stderr, "could not open %s\n", argv[i]);
+            return 1;
+        }
+        FileResult r = measure(argv[i]);
+        for (int s = 0; s <= lastStage; s++)
+            fprintf(stderr, "%-28s %8zu %9zu %-8s %10.4f %14.0f %14.0f\n",
+                    sys::path::filename(r.file).str().c_str(), r.lines, r.tokens,
+                    stageNames[s], r.seconds[s], r.lines / r.seconds[s],
+                    r.tokens / r.seconds[s]);
+        results.push_back(r);
+    }
+
+    if (results.size() > 1) {
+        fprintf(stderr, "\nscaling exponent, time ~ lines^k:\n");
+        for (int s = 0; s <= lastStage; s++) {
+            double k = scalingExponent(results, s);
+            fprintf(stderr, "  %-8s k = %.3f%s\n", stageNames[s], k,
+                    k > superlinear ? "  superlinear" : "");
+        }
+    }
+
+    FILE *out = stdout;
+    if (!jsonFile.empty() && !(out = fopen(jsonFile.c_str(), "w"))) {
+        perror(jsonFile.c_str());
+        return 1;
+    }
+    writeJSON(out, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file csv_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// throughput of the CSV reader of the runtime against fgets and strtod,
+// in megabytes of file per second
+// a file of n rows of 8 columns (integers, fixed point, exponents and
+// full 17 digit doubles) is written to the temporary directory and read by
+//   strtod    fgets per line and strtod per field, the usual hand loop
+//   serial    lisa_tensor_load_csv on one thread
+//   parallel  lisa_tensor_load_csv on LISA_NUM_THREADS threads (default
+//             every CPU)
+//   batches   lisa_tensor_read_csv in batches of 65536 rows
+// the file is in the page cache, so this is the parser and not the disk
+// each run is repeated until minSeconds have passed and the best is
+// reported, fields that differ from strtod are counted as a check
+// results are printed as a table on stderr and as JSON on stdout or --json
+
+#include <getopt.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "lisa_runtime.h"
+
+
+typedef std::chrono::steady_clock Clock;
+
+static const int64_t columns = 8;
+static const int64_t batchRows = 65536;
+
+
+struct Result {
+    std::string impl;
+    unsigned runs;
+    double seconds;     // best run
+    double mbytes;
+    int64_t wrong;      // fields that differ from strtod
+};
+
+
+static int64_t n = 1 << 18;
+static double minSeconds = 0.5;
+static std::string jsonFile;
+static size_t fileBytes;
+
+
+// a row of fields in the shapes numeric CSV files usually have
+static void writeFile(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(f, "id,count,price,ratio,x,y,z,w\n");
+    for (int64_t r = 0; r < n; r++) {
+        double u = (double)rand() / RAND_MAX;
+        fprintf(f, "%lld,%d,%.2f,%.6f,%.17g,%.6e,%.17g,%g\n", (long long)r, rand() % 1000,
+                u * 1000, u, u * 2 - 1, u * std::pow(10, rand() % 40 - 20),
+                (double)rand() / RAND_MAX * 1e6, u * 100);
+    }
+    fileBytes = ftell(f);
+    fclose(f);
+}
+
+
+// [columns, rows] like the runtime
+static std::vector<double> readStrtod(const char *path) {
+    std::vector<double> rows;
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    if (!fgets(line, sizeof(line), f))
+        return rows;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        for (int64_t c = 0; c < columns; c++) {
+            rows.push_back(strtod(p, &p));
+            if (*p == ',')
+                p++;
+        }
+    }
+    fclose(f);
+    std::vector<double> out(rows.size());
+    int64_t count = rows.size() / columns;
+    for (int64_t r = 0; r < count; r++)
+        for (int64_t c = 0; c < columns; c++)
+            out[c * count + r] = rows[r * columns + c];
+    return out;
+}
+
+
+template <typename Run>
+static Result time(const char *impl, Run run) {
+    Result r = {impl, 0, INFINITY, 0, 0};
+    double total = 0;
+    while (total < minSeconds || r.runs < 3) {
+        auto start = Clock::now();
+        r.wrong = run();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        r.seconds = std::min(r.seconds, seconds);
+        total += seconds;
+        r.runs++;
+    }
+    r.mbytes = fileBytes / r.seconds * 1e-6;
+    return r;
+}
+
+
+static int64_t compare(const double *data, const std::vector<double> &expected,
+                       int64_t offset, int64_t rows) {
+    int64_t wrong = 0;
+    for (int64_t c = 0; c < columns; c++)
+        for (int64_t r = 0; r < rows; r++)
+            wrong += memcmp(&data[c * rows + r], &expected[c * n + offset + r],
+                            sizeof(double)) != 0;
+    return wrong;
+}
+
+
+static void writeJSON(FILE *out, const std::vector<Result> &results) {
+    fprintf(out, "{\n  \"suite\": \"csv\",\n  \"rows\": %lld,\n  \"bytes\": %zu,\n",
+            (long long)n, fileBytes);
+    fprintf(out, "  \"unit\": \"MB/s\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        fprintf(out, "    {\"impl\": \"%s\", \"runs\": %u, \"seconds\": %.6g, "
+                "\"mbytes\": %.2f, \"wrong\": %lld}%s\n",
+                r.impl.c_str(), r.runs, r.seconds, r.mbytes, (long long)r.wrong,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "-t <s>:  Minimum time per implementation (default 0.5)\n"
+            "-n <n>:  Rows in the file (default 262144)\n"
+            "-json <file>:  Write the JSON results to file instead of stdout\n",
+            argv0);
+}
+
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"json", required_argument, nullptr, 'J'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "ht:n:", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 't':
+                minSeconds = std::max(0.0, atof(optarg));
+                break;
+            case 'n':
+                n = std::max(1ll, atoll(optarg));
+                break;
+            case 'J':
+                jsonFile = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp ? tmp : "/tmp") + "/lisa_csv_bench." +
+        std::to_string(getpid()) + ".csv";
+    writeFile(path.c_str());
+    std::vector<double> expected = readStrtod(path.c_str());
+    const char *threads = getenv("LISA_NUM_THREADS");
+    std::string parallel = threads ? threads : "";
+
+    std::vector<Result> results;
+    results.push_back(time("strtod", [&] {
+        return (int64_t)(readStrtod(path.c_str()) != expected);
+    }));
+    setenv("LISA_NUM_THREADS", "1", 1);
+    results.push_back(time("serial", [&] {
+        lisa_tensor *t = lisa_tensor_load_csv(path.c_str());
+        int64_t wrong = compare(t->data, expected, 0, n);
+        lisa_tensor_free(t);
+        return wrong;
+    }));
+    if (threads)
+        setenv("LISA_NUM_THREADS", parallel.c_str(), 1);
+    else
+        unsetenv("LISA_NUM_THREADS");
+    results.push_back(time("parallel", [&] {
+        lisa_tensor *t = lisa_tensor_load_csv(path.c_str());
+        int64_t wrong = compare(t->data, expected, 0, n);
+        lisa_tensor_free(t);
+        return wrong;
+    }));
+    results.push_back(time("batches", [&] {
+        int64_t wrong = 0, offset = 0;
+        for (;;) {
+            lisa_tensor *t = lisa_tensor_read_csv(path.c_str(), batchRows);
+            int64_t rows = t->shape[1];
+            wrong += compare(t->data, expected, offset, rows);
+            offset += rows;
+            lisa_tensor_free(t);
+            if (rows == 0)
+                break;
+        }
+        return wrong + (offset != n);
+    }));
+    unlink(path.c_str());
+
+    fprintf(stderr, "%lld rows, %.1f MB\n", (long long)n, fileBytes * 1e-6);
+    fprintf(stderr, "%-10s %10s %10s %8s\n", "impl", "MB/s", "speedup", "wrong");
+    for (const Result &r : results)
+        fprintf(stderr, "%-10s %10.1f %9.2fx %8lld\n", r.impl.c_str(), r.mbytes,
+                r.mbytes / results[0].mbytes, (long long)r.wrong);
+
+    FILE *out = stdout;
+    if (!jsonFile.empty() && !(out = fopen(jsonFile.c_str(), "w"))) {
+        perror(jsonFile.c_str());
+        return 1;
+    }
+    writeJSON(out, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,85 @@
+"""
+Generate a valid, synthetic Lisa program of configurable size and shape.
+
+Every function takes (x, y), runs a chain of if/for/while statements over
+nested arithmetic and calls the function before it, so code generation
+sees real control flow and call graphs. Block comments can be put in
+front of every function to stress the comment paths of the lexer.
+
+usage: python3 gen_program.py -o out.lisa [--functions n] [--depth n]
+           [--chain n] [--comment-lines n] [--seed n]
+"""
+
+import argparse
+import random
+
+OPS = ["+", "-", "*", "/"]
+LEAVES = ["x", "y", "a"]
+
+
+def expr(rng, depth, leaves=LEAVES):
+    # right nested, so the nesting depth grows without the size exploding
+    if depth == 0:
+        return rng.choice(leaves + [str(rng.randint(1, 99))])
+    leaf = rng.choice(leaves + [f"{rng.randint(1, 99)}.{rng.randint(0, 9)}"])
+    return f"({leaf} {rng.choice(OPS)} {expr(rng, depth - 1, leaves)})"
+
+
+def statement(rng, depth, indent):
+    pad = " " * indent
+    kind = rng.choice(["if", "for", "while"])
+    if kind == "if":
+        return (f"{pad}if a > {rng.randint(1, 50)} {{\n"
+                f"{pad}    a: a - {expr(rng, depth)}\n"
+                f"{pad}}} else {{\n"
+                f"{pad}    a: a + {expr(rng, depth)}\n"
+                f"{pad}}}\n")
+    if kind == "for":
+        return (f"{pad}for j in 0 ~ {rng.randint(2, 16)} {{\n"
+                f"{pad}    a: a + j * {expr(rng, depth)}\n"
+                f"{pad}}}\n")
+    return (f"{pad}while a > {rng.randint(100, 1000)} {{\n"
+            f"{pad}    a: a / 2\n"
+            f"{pad}}}\n")
+
+
+def comment(rng, lines):
+    words = ["lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+             "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"]
+    body = "".join("    " + " ".join(rng.choice(words) for _ in range(10)) + "\n"
+                   for _ in range(lines))
+    return f"%%\n{body}%%\n"
+
+
+def generate(out, functions, depth, chain, comment_lines, seed):
+    rng = random.Random(seed)
+    for i in range(functions):
+        if comment_lines:
+            out.write(comment(rng, comment_lines))
+        out.write(f"fn f{i}(x, y) {{\n")
+        out.write(f"    a: {expr(rng, depth, ['x', 'y'])}\n")
+        for _ in range(chain):
+            out.write(statement(rng, depth, 4))
+        call = f" + f{i - 1}(y, x)" if i else ""
+        out.write(f"    return a{call}\n}}\n\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--functions", type=int, default=1000)
+    parser.add_argument("--depth", type=int, default=4,
+                        help="nesting depth of every expression")
+    parser.add_argument("--chain", type=int, default=4,
+                        help="if/for/while statements per function")
+    parser.add_argument("--comment-lines", type=int, default=0,
+                        help="lines of block comment before every function")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    with open(args.output, "w") as out:
+        generate(out, args.functions, args.depth, args.chain,
+                 args.comment_lines, args.seed)
+
+
+if __name__ == "__main__":
+    main()
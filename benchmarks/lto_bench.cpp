@@ -0,0 +1,47 @@
+/**
+ * @file lto_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// cross-language LTO demo, the same host is linked against the kernels
+// once as an ordinary object and once as ThinLTO bitcode (lisa -flto=thin)
+// in the second build the linker can inline the small Lisa functions into
+// these loops, which removes the call and lets the loop be vectorized
+// prints the time per call of every loop
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+
+extern "C" {
+    double abs_lisa(double);
+    double area_of_circle(double);
+}
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// time n calls, the sum is printed so the loop is not optimized away
+template <typename F>
+static void run(const char *name, long n, F f) {
+    auto start = Clock::now();
+    double sum = 0;
+    for (long i = 0; i < n; i++)
+        sum += f((double)(i - n / 2) * 1e-3);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("%-16s %8.3f ns/call  (sum %g)\n", name, seconds * 1e9 / n, sum);
+}
+
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 100000000;
+    run("abs_lisa", n, abs_lisa);
+    run("area_of_circle", n, area_of_circle);
+    return 0;
+}
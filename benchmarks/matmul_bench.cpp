@@ -0,0 +1,178 @@
+/**
+ * @file matmul_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// GFLOP/s of math.matmul against a triple loop written in Lisa, on square
+// matrices of growing size (kernels/matmul.lisa)
+// every size runs until minSeconds have passed, the best run is reported
+// so the numbers show the peak of each implementation
+// set LISA_NUM_THREADS and LISA_MATMUL_KERNEL to compare thread counts and
+// SIMD paths, results are printed as a table on stderr and as JSON on
+// stdout or --json
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "lisa_runtime.h"
+
+
+extern "C" {
+    lisa_tensor *matmul_lisa(lisa_tensor *a, lisa_tensor *b);
+    lisa_tensor *matmul_naive(lisa_tensor *a, lisa_tensor *b);
+}
+
+
+typedef std::chrono::steady_clock Clock;
+typedef lisa_tensor *(*Matmul)(lisa_tensor *, lisa_tensor *);
+
+
+struct Result {
+    std::string impl;
+    int64_t n;
+    unsigned runs;
+    double seconds;     // best run
+    double gflops;
+};
+
+
+static std::vector<int64_t> sizes = {64, 128, 256, 512, 1024};
+static int64_t naiveLimit = 256;    // the triple loop is only run up to here
+static double minSeconds = 0.5;
+static std::string jsonFile;
+
+
+static lisa_tensor *randomMatrix(int64_t n, unsigned seed) {
+    int64_t shape[2] = {n, n};
+    lisa_tensor *t = lisa_tensor_new(2, shape);
+    srand(seed);
+    for (int64_t i = 0; i < t->size; i++)
+        t->data[i] = (double)rand() / RAND_MAX - 0.5;
+    return t;
+}
+
+
+static Result run(const char *impl, Matmul fn, lisa_tensor *a, lisa_tensor *b,
+                  lisa_tensor *&c) {
+    Result r = {impl, a->shape[0], 0, INFINITY, 0};
+    double total = 0;
+    while (total < minSeconds || r.runs < 3) {
+        lisa_tensor_free(c);
+        auto start = Clock::now();
+        c = fn(a, b);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        r.seconds = std::min(r.seconds, seconds);
+        total += seconds;
+        r.runs++;
+    }
+    r.gflops = 2.0 * r.n * r.n * r.n / r.seconds * 1e-9;
+    return r;
+}
+
+
+static void writeJSON(FILE *out, const std::vector<Result> &results) {
+    fprintf(out, "{\n  \"suite\": \"matmul\",\n  \"kernel\": \"%s\",\n",
+            lisa_matmul_kernel());
+    fprintf(out, "  \"unit\": \"GFLOP/s\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        fprintf(out, "    {\"impl\": \"%s\", \"n\": %lld, \"runs\": %u, "
+                "\"seconds\": %.6g, \"gflops\": %.4f}%s\n",
+                r.impl.c_str(), (long long)r.n, r.runs, r.seconds, r.gflops,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] [sizes...]\n"
+            "-t <s>:  Minimum time per size and implementation (default 0.5)\n"
+            "-n <n>:  Largest size the triple loop is run at (default 256)\n"
+            "-json <file>:  Write the JSON results to file instead of stdout\n",
+            argv0);
+}
+
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"json", required_argument, nullptr, 'J'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "ht:n:", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 't':
+                minSeconds = std::max(0.0, atof(optarg));
+                break;
+            case 'n':
+                naiveLimit = atoll(optarg);
+                break;
+            case 'J':
+                jsonFile = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        sizes.clear();
+        for (int i = optind; i < argc; i++)
+            sizes.push_back(std::max(1ll, atoll(argv[i])));
+    }
+
+    std::vector<Result> results;
+    fprintf(stderr, "kernel: %s\n", lisa_matmul_kernel());
+    fprintf(stderr, "%-8s %6s %12s %10s %10s\n", "impl", "n", "best (ms)", "GFLOP/s", "speedup");
+    for (int64_t n : sizes) {
+        lisa_tensor *a = randomMatrix(n, 1), *b = randomMatrix(n, 2);
+        lisa_tensor *fast = nullptr, *naive = nullptr;
+        Result r = run("matmul", matmul_lisa, a, b, fast);
+        results.push_back(r);
+        double naiveSeconds = 0;
+        if (n <= naiveLimit) {
+            Result slow = run("naive", matmul_naive, a, b, naive);
+            results.push_back(slow);
+            naiveSeconds = slow.seconds;
+            double err = 0;
+            for (int64_t i = 0; i < fast->size; i++)
+                err = std::max(err, std::fabs(fast->data[i] - naive->data[i]));
+            if (err > 1e-9 * n)
+                fprintf(stderr, "warning: results differ by %g at n = %lld\n",
+                        err, (long long)n);
+            fprintf(stderr, "%-8s %6lld %12.3f %10.2f\n", "naive", (long long)n,
+                    slow.seconds * 1e3, slow.gflops);
+        }
+        fprintf(stderr, "%-8s %6lld %12.3f %10.2f", "matmul", (long long)n,
+                r.seconds * 1e3, r.gflops);
+        if (naiveSeconds > 0)
+            fprintf(stderr, " %9.1fx", naiveSeconds / r.seconds);
+        fprintf(stderr, "\n");
+        for (lisa_tensor *t : {a, b, fast, naive})
+            lisa_tensor_free(t);
+    }
+
+    FILE *out = stdout;
+    if (!jsonFile.empty() && !(out = fopen(jsonFile.c_str(), "w"))) {
+        perror(jsonFile.c_str());
+        return 1;
+    }
+    writeJSON(out, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file reference.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// C++ versions of the kernels in kernels/, kept in their own translation
+// unit so the harness cannot inline them while the Lisa ones stay calls
+
+
+double fib_cpp(double x) {
+    if (x < 3)
+        return 1;
+    return fib_cpp(x - 1) + fib_cpp(x - 2);
+}
+
+
+static double abs_cpp(double x) {
+    return x < 0 ? 0 - x : x;
+}
+
+
+double sqrt_cpp(double x) {
+    double guess = x / 2;
+    while (true) {
+        if (abs_cpp(guess * guess - x) < 0.00001)
+            return guess;
+        guess = (guess + x / guess) / 2;
+    }
+}
+
+
+double loop_test_cpp() {
+    double a = 0;
+    double b = 0;
+    for (int i = 0; i < 50; i++) {
+        a += i;
+        for (int j = 0; j < 10; j++)
+            b = a + j;
+    }
+    return b;
+}
+
+
+double area_of_circle_cpp(double radius) {
+    double area = 0;
+    if (radius > 0)
+        area = 3.14159265358979 * radius * radius;
+    return area;
+}
@@ -0,0 +1,32 @@
+"""Python versions of the kernels in kernels/."""
+
+
+def fib(x):
+    if x < 3:
+        return 1
+    return fib(x - 1) + fib(x - 2)
+
+
+def sqrt(x):
+    guess = x / 2
+    while True:
+        if abs(guess * guess - x) < 0.00001:
+            return guess
+        guess = (guess + x / guess) / 2
+
+
+def loop_test():
+    a = 0.0
+    b = 0.0
+    for i in range(50):
+        a += i
+        for j in range(10):
+            b = a + j
+    return b
+
+
+def area_of_circle(radius):
+    area = 0.0
+    if radius > 0:
+        area = 3.14159265358979 * radius * radius
+    return area
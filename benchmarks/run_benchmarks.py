@@ -0,0 +1,158 @@
+"""
+Runtime benchmark suite: Lisa kernels against C++ and Python.
+
+Runs the runtime_bench harness (Lisa and C++), then times the Python
+versions in reference.py the same way: calibrated batches, warmup,
+repetitions and CPU pinning. Everything is merged into one JSON file
+together with the compiler version, so runs can be compared over time.
+With --baseline the medians are compared against an earlier JSON file.
+
+usage: python3 run_benchmarks.py --bench <runtime_bench> [--lisa <lisa>]
+           [--output results.json] [--baseline old.json] [--reps n] ...
+"""
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.dont_write_bytecode = True  # keep the source tree clean
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import reference  # noqa: E402
+
+# same calls as the kernel table in runtime_bench.cpp
+KERNELS = {
+    "fib": lambda: reference.fib(20),
+    "sqrt": lambda: reference.sqrt(12345),
+    "loop_test": lambda: reference.loop_test(),
+    "area_of_circle": lambda: reference.area_of_circle(3),
+}
+
+
+def time_batch(fn, iterations):
+    start = time.perf_counter()
+    for _ in range(iterations):
+        fn()
+    return time.perf_counter() - start
+
+
+def run_python(name, fn, args):
+    iterations = 1
+    while time_batch(fn, iterations) < args.batch_ms / 1000:
+        iterations *= 2
+    for _ in range(args.warmup):
+        time_batch(fn, iterations)
+    samples = sorted(time_batch(fn, iterations) * 1e9 / iterations
+                     for _ in range(args.reps))
+    n = len(samples)
+    return {
+        "kernel": name, "impl": "python", "value": float(fn()),
+        "iterations": iterations,
+        "min": samples[0], "median": statistics.median(samples),
+        "mean": statistics.fmean(samples),
+        "stddev": statistics.stdev(samples) if n > 1 else 0.0,
+        "p95": samples[min(n - 1, -(-95 * n // 100) - 1)],
+        "max": samples[-1],
+    }
+
+
+def pin(cpu):
+    if cpu == -1 or not hasattr(os, "sched_setaffinity"):
+        return -1
+    if cpu < 0:
+        cpu = min(os.sched_getaffinity(0))
+    os.sched_setaffinity(0, {cpu})
+    return cpu
+
+
+def compiler_version(lisa):
+    if not lisa:
+        return None
+    out = subprocess.run([lisa, "-v"], capture_output=True, text=True)
+    return out.stdout.splitlines()[0] if out.stdout else None
+
+
+def git_revision():
+    out = subprocess.run(["git", "rev-parse", "--short", "HEAD"],
+                         capture_output=True, text=True,
+                         cwd=os.path.dirname(os.path.abspath(__file__)))
+    return out.stdout.strip() or None
+
+
+def compare(results, baseline_file, threshold):
+    with open(baseline_file) as f:
+        baseline = {(r["kernel"], r["impl"]): r for r in json.load(f)["results"]}
+    print(f"\n{'kernel':<16} {'impl':<7} {'baseline':>12} {'now':>12} {'change':>9}")
+    regressions = 0
+    for r in results:
+        old = baseline.get((r["kernel"], r["impl"]))
+        if not old:
+            continue
+        change = r["median"] / old["median"] - 1
+        flag = ""
+        if change > threshold:
+            flag = "  regression"
+            regressions += 1
+        print(f"{r['kernel']:<16} {r['impl']:<7} {old['median']:>12.2f} "
+              f"{r['median']:>12.2f} {100 * change:>8.1f}%{flag}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--bench", required=True, help="runtime_bench executable")
+    parser.add_argument("--lisa", help="lisa compiler, for the version string")
+    parser.add_argument("--output", default="benchmark.json")
+    parser.add_argument("--baseline", help="earlier results to compare with")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown reported as a regression")
+    parser.add_argument("--reps", type=int, default=30)
+    parser.add_argument("--warmup", type=int, default=5)
+    parser.add_argument("--cpu", type=int, default=-2,
+                        help="CPU to pin to, -1 to not pin")
+    parser.add_argument("--batch-ms", type=float, default=5)
+    parser.add_argument("--no-python", action="store_true")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        native = os.path.join(tmp, "native.json")
+        subprocess.run([args.bench, "-r", str(args.reps), "-w", str(args.warmup),
+                        "-c", str(args.cpu), "-b", str(args.batch_ms),
+                        "-json", native], check=True)
+        with open(native) as f:
+            report = json.load(f)
+
+    results = report["results"]
+    if not args.no_python:
+        pinned = pin(args.cpu)
+        print(f"\n{'kernel':<16} {'impl':<7} {'median (ns)':>13} {'vs C++':>10}")
+        cpp = {r["kernel"]: r for r in results if r["impl"] == "cpp"}
+        for name, fn in KERNELS.items():
+            r = run_python(name, fn, args)
+            results.append(r)
+            ratio = r["median"] / cpp[name]["median"] if name in cpp else 0
+            print(f"{name:<16} {'python':<7} {r['median']:>13.2f} {ratio:>9.1f}x")
+        report["python_cpu"] = pinned
+
+    report.update({
+        "compiler": compiler_version(args.lisa),
+        "revision": git_revision(),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "python": platform.python_version(),
+    })
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"\nresults written to {args.output}")
+
+    if args.baseline and compare(results, args.baseline, args.threshold):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,268 @@
+/**
+ * @file runtime_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// runtime benchmark of the kernels in kernels/ against their C++ versions
+// each kernel is called in batches large enough to time reliably, after a
+// few warmup batches every repetition records the time per call
+// results are printed as a table on stderr and as JSON on stdout or --json
+
+#include <getopt.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+extern "C" {
+    double fib_lisa(double);
+    double sqrt_lisa(double);
+    double loop_test();
+    double area_of_circle(double);
+}
+
+double fib_cpp(double);
+double sqrt_cpp(double);
+double loop_test_cpp();
+double area_of_circle_cpp(double);
+
+
+// one kernel, the Lisa and C++ calls take the same arguments
+// the arguments must match run_benchmarks.py
+struct Kernel {
+    const char *name;
+    double (*lisa)();
+    double (*cpp)();
+};
+
+
+static const Kernel kernels[] = {
+    {"fib", [] { return fib_lisa(20); }, [] { return fib_cpp(20); }},
+    {"sqrt", [] { return sqrt_lisa(12345); }, [] { return sqrt_cpp(12345); }},
+    {"loop_test", [] { return loop_test(); }, [] { return loop_test_cpp(); }},
+    {"area_of_circle", [] { return area_of_circle(3); },
+                       [] { return area_of_circle_cpp(3); }},
+};
+
+
+// summary of the per-call times of one kernel, in nanoseconds
+struct Stats {
+    double min, max, mean, median, stddev, p95;
+};
+
+
+struct Result {
+    std::string kernel;
+    std::string impl;
+    double value;
+    unsigned long long iterations;
+    Stats stats;
+};
+
+
+static unsigned reps = 30;
+static unsigned warmup = 5;
+static int cpu = -2;                 // -2 picks the first allowed CPU, -1 disables
+static double minBatchSeconds = 0.005;
+static std::string filter;
+static std::string jsonFile;
+
+
+typedef std::chrono::steady_clock Clock;
+
+// keeps the results alive so the calls cannot be dropped
+static volatile double sink;
+
+
+static double timeBatch(double (*fn)(), unsigned long long iterations) {
+    double sum = 0;
+    auto start = Clock::now();
+    for (unsigned long long i = 0; i < iterations; i++)
+        sum += fn();
+    auto end = Clock::now();
+    sink = sum;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+
+// smallest power of two number of calls that takes at least minBatchSeconds
+static unsigned long long calibrate(double (*fn)()) {
+    unsigned long long iterations = 1;
+    while (timeBatch(fn, iterations) < minBatchSeconds && iterations < (1ull << 40))
+        iterations *= 2;
+    return iterations;
+}
+
+
+static Stats summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    Stats s;
+    size_t n = samples.size();
+    s.min = samples.front();
+    s.max = samples.back();
+    s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    s.p95 = samples[std::min(n - 1, (size_t)std::ceil(0.95 * n) - 1)];
+    double sum = 0;
+    for (double x : samples)
+        sum += x;
+    s.mean = sum / n;
+    double var = 0;
+    for (double x : samples)
+        var += (x - s.mean) * (x - s.mean);
+    s.stddev = n > 1 ? std::sqrt(var / (n - 1)) : 0;
+    return s;
+}
+
+
+static Result run(const char *name, const char *impl, double (*fn)()) {
+    Result r;
+    r.kernel = name;
+    r.impl = impl;
+    r.value = fn();
+    r.iterations = calibrate(fn);
+    for (unsigned i = 0; i < warmup; i++)
+        timeBatch(fn, r.iterations);
+    std::vector<double> samples;
+    for (unsigned i = 0; i < reps; i++)
+        samples.push_back(timeBatch(fn, r.iterations) * 1e9 / r.iterations);
+    r.stats = summarize(samples);
+    return r;
+}
+
+
+// pin to one CPU so migrations do not show up in the samples
+static int pinCPU(int requested) {
+    if (requested == -1)
+        return -1;
+    cpu_set_t set;
+    if (requested < 0) {
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return -1;
+        requested = -1;
+        for (int i = 0; i < CPU_SETSIZE && requested < 0; i++)
+            if (CPU_ISSET(i, &set))
+                requested = i;
+        if (requested < 0)
+            return -1;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(requested, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    return requested;
+}
+
+
+static void writeJSON(FILE *out, const std::vector<Result> &results, int pinned) {
+    fprintf(out, "{\n  \"suite\": \"runtime\",\n  \"timestamp\": %lld,\n",
+            (long long)time(nullptr));
+    fprintf(out, "  \"cpu\": %d,\n  \"reps\": %u,\n  \"warmup\": %u,\n",
+            pinned, reps, warmup);
+    fprintf(out, "  \"unit\": \"ns/call\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        const Stats &s = r.stats;
+        fprintf(out, "    {\"kernel\": \"%s\", \"impl\": \"%s\", \"value\": %.17g, "
+                "\"iterations\": %llu,\n     \"min\": %.4f, \"median\": %.4f, "
+                "\"mean\": %.4f, \"stddev\": %.4f, \"p95\": %.4f, \"max\": %.4f}%s\n",
+                r.kernel.c_str(), r.impl.c_str(), r.value, r.iterations,
+                s.min, s.median, s.mean, s.stddev, s.p95, s.max,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "-r <n>:  Timed repetitions per kernel (default 30)\n"
+            "-w <n>:  Warmup batches per kernel (default 5)\n"
+            "-c <n>:  Pin to CPU n, -1 to not pin (default first allowed CPU)\n"
+            "-b <ms>:  Minimum duration of one timed batch (default 5)\n"
+            "-k <name>:  Only run kernels whose name contains name\n"
+            "-json <file>:  Write the JSON results to file instead of stdout\n",
+            argv0);
+}
+
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"json", required_argument, nullptr, 'J'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "hr:w:c:b:k:",
+                                   longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'r':
+                reps = std::max(1, atoi(optarg));
+                break;
+            case 'w':
+                warmup = std::max(0, atoi(optarg));
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'b':
+                minBatchSeconds = std::max(0.0, atof(optarg)) / 1000;
+                break;
+            case 'k':
+                filter = optarg;
+                break;
+            case 'J':
+                jsonFile = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    int pinned = pinCPU(cpu);
+
+    std::vector<Result> results;
+    fprintf(stderr, "%-16s %-6s %14s %14s %10s %10s\n",
+            "kernel", "impl", "median (ns)", "min (ns)", "stddev %", "vs C++");
+    for (auto &k : kernels) {
+        if (!filter.empty() && !strstr(k.name, filter.c_str()))
+            continue;
+        Result cpp = run(k.name, "cpp", k.cpp);
+        Result lisa = run(k.name, "lisa", k.lisa);
+        if (std::fabs(lisa.value - cpp.value) > 1e-9 * std::max(1.0, std::fabs(cpp.value)))
+            fprintf(stderr, "warning: %s returned %g, C++ returned %g\n",
+                    k.name, lisa.value, cpp.value);
+        for (auto *r : {&lisa, &cpp})
+            fprintf(stderr, "%-16s %-6s %14.2f %14.2f %9.1f%% %9.2fx\n",
+                    r->kernel.c_str(), r->impl.c_str(), r->stats.median,
+                    r->stats.min, 100 * r->stats.stddev / r->stats.mean,
+                    r->stats.median / cpp.stats.median);
+        results.push_back(lisa);
+        results.push_back(cpp);
+    }
+
+    FILE *out = stdout;
+    if (!jsonFile.empty() && !(out = fopen(jsonFile.c_str(), "w"))) {
+        perror(jsonFile.c_str());
+        return 1;
+    }
+    writeJSON(out, results, pinned);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
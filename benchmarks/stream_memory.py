@@ -0,0 +1,59 @@
+"""
+Peak memory of the lisa compiler with and without -fstream.
+
+Generates programs of increasing size, compiles each one with both modes
+and reports the peak resident set size of the compiler process. With
+streaming the peak should stay roughly flat as the input grows, what
+growth remains comes from the declarations kept for later calls.
+
+usage: python3 stream_memory.py <path/to/lisa> [sizes...]
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def generate(path, functions):
+    with open(path, "w") as f:
+        for i in range(functions):
+            prev = max(i - 1, 0)
+            f.write(f"fn f{i}(x, y) {{\n"
+                    f"    a: x * {i} + y\n"
+                    f"    if a > 10 {{\n"
+                    f"        a: a - f{prev}(y, x)\n"
+                    f"    }}\n"
+                    f"    for j in 0 ~ 4 {{\n"
+                    f"        a: a + j * y\n"
+                    f"    }}\n"
+                    f"    return a\n"
+                    f"}}\n")
+
+
+def peak_rss(cmd):
+    # wait4 gives the resource usage of this child only
+    proc = subprocess.Popen(cmd)
+    _, status, usage = os.wait4(proc.pid, 0)
+    if status != 0:
+        sys.exit(f"{' '.join(cmd)} failed")
+    return usage.ru_maxrss / 1024.0
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    lisa = sys.argv[1]
+    sizes = [int(s) for s in sys.argv[2:]] or [1000, 4000, 16000]
+    print(f"{'functions':>10} {'whole module (MB)':>18} {'-fstream (MB)':>14}")
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "gen.lisa")
+        for n in sizes:
+            generate(src, n)
+            whole = peak_rss([lisa, src])
+            stream = peak_rss([lisa, "-fstream", src])
+            print(f"{n:>10} {whole:>18.1f} {stream:>14.1f}")
+
+
+if __name__ == "__main__":
+    main()
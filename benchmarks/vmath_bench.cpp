@@ -0,0 +1,214 @@
+/**
+ * @file vmath_bench.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// throughput of the vector math of the runtime against scalar libm, in
+// millions of elements per second
+// every function runs on an array of n doubles in its usual range with
+//   libm      a plain loop calling libm, the -fno-vector-math baseline
+//   runtime   lisa_vmath_<name>, the widest kernel the CPU supports
+//   lisa      math.<name> of a compiled Lisa function
+//             (kernels/vmath.lisa), which the loop vectorizer maps onto
+//             the vector kernels of its target
+// each run is repeated until minSeconds have passed and the best is
+// reported, the largest error against libm in ulp is printed as a check
+// set LISA_VMATH_KERNEL to compare SIMD paths, results are printed as a
+// table on stderr and as JSON on stdout or --json
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "lisa_runtime.h"
+
+
+extern "C" {
+    lisa_tensor *vexp(lisa_tensor *x);
+    lisa_tensor *vlog(lisa_tensor *x);
+    lisa_tensor *vsin(lisa_tensor *x);
+    lisa_tensor *vcos(lisa_tensor *x);
+    lisa_tensor *vtanh(lisa_tensor *x);
+    lisa_tensor *vsigmoid(lisa_tensor *x);
+    lisa_tensor *verf(lisa_tensor *x);
+}
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double sigmoid(double x) {
+    return 1 / (1 + std::exp(-x));
+}
+
+
+struct Function {
+    const char *name;
+    double lo, hi;      // inputs are spread over [lo, hi]
+    double (*libm)(double);
+    void (*runtime)(const double *, double *, int64_t);
+    lisa_tensor *(*lisa)(lisa_tensor *);
+};
+
+
+static const Function functions[] = {
+    {"exp", -20, 20, std::exp, lisa_vmath_exp, vexp},
+    {"log", 1e-3, 1e3, std::log, lisa_vmath_log, vlog},
+    {"sin", -10, 10, std::sin, lisa_vmath_sin, vsin},
+    {"cos", -10, 10, std::cos, lisa_vmath_cos, vcos},
+    {"tanh", -5, 5, std::tanh, lisa_vmath_tanh, vtanh},
+    {"sigmoid", -10, 10, sigmoid, lisa_vmath_sigmoid, vsigmoid},
+    {"erf", -4, 4, std::erf, lisa_vmath_erf, verf},
+};
+
+
+struct Result {
+    std::string function, impl;
+    unsigned runs;
+    double seconds;     // best run
+    double melems;
+    double ulp;         // largest error against libm
+};
+
+
+static int64_t n = 1 << 16;
+static double minSeconds = 0.25;
+static std::string jsonFile;
+
+
+// |a - b| in units of the last place of b
+static double ulps(double a, double b) {
+    if (a == b)
+        return 0;
+    double ulp = std::nextafter(std::fabs(b), INFINITY) - std::fabs(b);
+    return std::fabs(a - b) / ulp;
+}
+
+
+template <typename Run>
+static Result time(const Function &fn, const char *impl, const std::vector<double> &expected,
+                   const double *y, Run run) {
+    Result r = {fn.name, impl, 0, INFINITY, 0, 0};
+    double total = 0;
+    while (total < minSeconds || r.runs < 3) {
+        auto start = Clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        r.seconds = std::min(r.seconds, seconds);
+        total += seconds;
+        r.runs++;
+    }
+    r.melems = n / r.seconds * 1e-6;
+    for (int64_t i = 0; i < n; i++)
+        r.ulp = std::max(r.ulp, ulps(y[i], expected[i]));
+    return r;
+}
+
+
+static void bench(const Function &fn, std::vector<Result> &results) {
+    std::vector<double> x(n), y(n), expected(n);
+    for (int64_t i = 0; i < n; i++)
+        x[i] = fn.lo + (fn.hi - fn.lo) * (double)rand() / RAND_MAX;
+    lisa_tensor view = lisa_tensor_view(x.data(), 1, &n);
+    lisa_tensor *out = nullptr;
+
+    Result libm = time(fn, "libm", expected, expected.data(), [&] {
+        for (int64_t i = 0; i < n; i++)
+            expected[i] = fn.libm(x[i]);
+    });
+    Result runtime = time(fn, "runtime", expected, y.data(), [&] {
+        fn.runtime(x.data(), y.data(), n);
+    });
+    Result lisa = time(fn, "lisa", expected, y.data(), [&] {
+        lisa_tensor_free(out);
+        out = fn.lisa(&view);
+        std::copy(out->data, out->data + n, y.data());
+    });
+    lisa_tensor_free(out);
+
+    for (const Result &r : {libm, runtime, lisa}) {
+        fprintf(stderr, "%-8s %-8s %12.1f %9.2fx %9.2f\n", r.function.c_str(),
+                r.impl.c_str(), r.melems, r.melems / libm.melems, r.ulp);
+        results.push_back(r);
+    }
+}
+
+
+static void writeJSON(FILE *out, const std::vector<Result> &results) {
+    fprintf(out, "{\n  \"suite\": \"vmath\",\n  \"kernel\": \"%s\",\n  \"n\": %lld,\n",
+            lisa_vmath_kernel(), (long long)n);
+    fprintf(out, "  \"unit\": \"Melem/s\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        fprintf(out, "    {\"function\": \"%s\", \"impl\": \"%s\", \"runs\": %u, "
+                "\"seconds\": %.6g, \"melems\": %.2f, \"ulp\": %.3f}%s\n",
+                r.function.c_str(), r.impl.c_str(), r.runs, r.seconds, r.melems, r.ulp,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] [functions...]\n"
+            "-t <s>:  Minimum time per function and implementation (default 0.25)\n"
+            "-n <n>:  Elements per array (default 65536)\n"
+            "-json <file>:  Write the JSON results to file instead of stdout\n",
+            argv0);
+}
+
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"json", required_argument, nullptr, 'J'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "ht:n:", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 't':
+                minSeconds = std::max(0.0, atof(optarg));
+                break;
+            case 'n':
+                n = std::max(1ll, atoll(optarg));
+                break;
+            case 'J':
+                jsonFile = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    std::vector<std::string> selected(argv + optind, argv + argc);
+
+    std::vector<Result> results;
+    fprintf(stderr, "kernel: %s\n", lisa_vmath_kernel());
+    fprintf(stderr, "%-8s %-8s %12s %10s %9s\n", "function", "impl", "Melem/s", "speedup", "max ulp");
+    for (const Function &fn : functions)
+        if (selected.empty() ||
+            std::find(selected.begin(), selected.end(), fn.name) != selected.end())
+            bench(fn, results);
+
+    FILE *out = stdout;
+    if (!jsonFile.empty() && !(out = fopen(jsonFile.c_str(), "w"))) {
+        perror(jsonFile.c_str());
+        return 1;
+    }
+    writeJSON(out, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file alloc.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// tensor memory comes in power of two size classes from 128 bytes to
+// 1 MB, freed blocks are kept per class in a cache of the freeing thread,
+// which spills half of a full cache to a shared pool and refills an empty
+// one from it, larger tensors go straight to the C allocator
+#define MIN_CLASS_SHIFT 7
+#define CLASSES 14
+#define CACHE_BLOCKS 32     // per class and thread
+#define POOL_BLOCKS 256     // per class in the shared pool
+
+
+// a free block, linked through its first bytes
+struct block {
+    struct block *next;
+};
+
+struct freelist {
+    struct block *head;
+    int count;
+};
+
+static _Thread_local struct freelist cache[CLASSES];
+static struct freelist pool[CLASSES];
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+static _Thread_local int threadRegistered;
+
+
+static struct {
+    atomic_uint_fast64_t allocations, frees, poolHits, systemAllocations;
+    atomic_uint_fast64_t arenaReleases, liveBytes, peakBytes;
+} counters;
+
+
+static size_t class_size(int cls) {
+    return (size_t)1 << (cls + MIN_CLASS_SHIFT);
+}
+
+
+static void push(struct freelist *list, struct block *b) {
+    b->next = list->head;
+    list->head = b;
+    list->count++;
+}
+
+
+static struct block *pop(struct freelist *list) {
+    struct block *b = list->head;
+    if (b) {
+        list->head = b->next;
+        list->count--;
+    }
+    return b;
+}
+
+
+// move up to n blocks from one list to another
+static void transfer(struct freelist *from, struct freelist *to, int n) {
+    struct block *b;
+    while (n-- > 0 && (b = pop(from)))
+        push(to, b);
+}
+
+
+// references held by the scopes of the running Lisa functions, the scope
+// of every active call starts at its mark, the innermost last in marks
+static _Thread_local lisa_tensor **arena;
+static _Thread_local int64_t arenaTop, arenaCapacity;
+static _Thread_local int64_t *marks;
+static _Thread_local int64_t depth, marksCapacity;
+
+
+// a thread's cached blocks go to the pool when it exits, and its scope
+// arrays are freed
+static void thread_exit(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&poolLock);
+    for (int cls = 0; cls < CLASSES; cls++) {
+        transfer(&cache[cls], &pool[cls], POOL_BLOCKS - pool[cls].count);
+        struct block *b;
+        while ((b = pop(&cache[cls])))
+            free(b);
+    }
+    pthread_mutex_unlock(&poolLock);
+    free(arena);
+    free(marks);
+    arena = NULL;
+    marks = NULL;
+    arenaTop = arenaCapacity = depth = marksCapacity = 0;
+    threadRegistered = 0;
+}
+
+
+static void print_at_exit(void) {
+    lisa_alloc_stats_print();
+}
+
+
+static void init_once(void) {
+    pthread_key_create(&cacheKey, thread_exit);
+    const char *env = getenv("LISA_ALLOC_STATS");
+    if (env && *env && *env != '0')
+        atexit(print_at_exit);
+}
+
+
+// the first call of a thread registers the clean-up at thread exit
+static void register_thread(void) {
+    if (threadRegistered)
+        return;
+    pthread_once(&cacheKeyOnce, init_once);
+    pthread_setspecific(cacheKey, cache);
+    threadRegistered = 1;
+}
+
+
+static void count_bytes(int64_t bytes) {
+    uint_fast64_t live = atomic_fetch_add_explicit(&counters.liveBytes, bytes,
+                                                   memory_order_relaxed) + bytes;
+    uint_fast64_t peak = atomic_load_explicit(&counters.peakBytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(
+               &counters.peakBytes, &peak, live,
+               memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+
+void *lisa_pool_alloc(size_t bytes, int *cls) {
+    register_thread();
+    atomic_fetch_add_explicit(&counters.allocations, 1, memory_order_relaxed);
+    *cls = 0;
+    while (*cls < CLASSES && class_size(*cls) < bytes)
+        (*cls)++;
+    if (*cls == CLASSES) {
+        *cls = -1;
+        atomic_fetch_add_explicit(&counters.systemAllocations, 1, memory_order_relaxed);
+        count_bytes(bytes);
+        return aligned_alloc(LISA_ALIGNMENT, bytes);
+    }
+    count_bytes(class_size(*cls));
+    struct freelist *list = &cache[*cls];
+    if (!list->head) {
+        pthread_mutex_lock(&poolLock);
+        transfer(&pool[*cls], list, CACHE_BLOCKS / 2);
+        pthread_mutex_unlock(&poolLock);
+    }
+    struct block *b = pop(list);
+    if (b) {
+        atomic_fetch_add_explicit(&counters.poolHits, 1, memory_order_relaxed);
+        return b;
+    }
+    atomic_fetch_add_explicit(&counters.systemAllocations, 1, memory_order_relaxed);
+    return aligned_alloc(LISA_ALIGNMENT, class_size(*cls));
+}
+
+
+void lisa_pool_free(void *ptr, size_t bytes, int cls) {
+    register_thread();
+    atomic_fetch_add_explicit(&counters.frees, 1, memory_order_relaxed);
+    if (cls < 0) {
+        atomic_fetch_sub_explicit(&counters.liveBytes, bytes, memory_order_relaxed);
+        free(ptr);
+        return;
+    }
+    atomic_fetch_sub_explicit(&counters.liveBytes, class_size(cls), memory_order_relaxed);
+    struct freelist *list = &cache[cls];
+    if (list->count == CACHE_BLOCKS) {
+        pthread_mutex_lock(&poolLock);
+        transfer(list, &pool[cls], CACHE_BLOCKS / 2);
+        pthread_mutex_unlock(&poolLock);
+        // the pool is full as well
+        struct block *b;
+        while (list->count == CACHE_BLOCKS && (b = pop(list)))
+            free(b);
+    }
+    push(list, ptr);
+}
+
+
+static void *grow(void *array, int64_t *capacity, size_t size) {
+    *capacity = *capacity ? 2 * *capacity : 64;
+    array = realloc(array, *capacity * size);
+    if (!array)
+        lisa_runtime_error("out of memory");
+    return array;
+}
+
+
+void lisa_arena_track(lisa_tensor *t) {
+    if (depth == 0 || !(t->flags & LISA_TENSOR_OWNED))
+        return;
+    if (arenaTop == arenaCapacity)
+        arena = grow(arena, &arenaCapacity, sizeof(*arena));
+    arena[arenaTop++] = t;
+    t->flags |= LISA_TENSOR_TRACKED;
+}
+
+
+// only the innermost scope, the others belong to callers which still
+// use their tensors
+int lisa_arena_forget(lisa_tensor *t) {
+    if (depth == 0)
+        return 0;
+    int64_t floor = marks[depth - 1];
+    for (int64_t i = arenaTop; i-- > floor;) {
+        if (arena[i] != t)
+            continue;
+        arena[i] = NULL;
+        t->flags &= ~LISA_TENSOR_TRACKED;
+        // a variable updated in a loop takes the newest tensor every time,
+        // so the scope does not grow
+        while (arenaTop > floor && !arena[arenaTop - 1])
+            arenaTop--;
+        return 1;
+    }
+    return 0;
+}
+
+
+int64_t lisa_arena_enter(void) {
+    register_thread();
+    if (depth == marksCapacity)
+        marks = grow(marks, &marksCapacity, sizeof(*marks));
+    marks[depth++] = arenaTop;
+    return arenaTop;
+}
+
+
+void lisa_arena_exit(int64_t mark, lisa_tensor *keep) {
+    int kept = 0;
+    for (int64_t i = mark; i < arenaTop; i++) {
+        lisa_tensor *t = arena[i];
+        if (!t)
+            continue;
+        if (t == keep && !kept) {
+            kept = 1;
+            continue;
+        }
+        if (lisa_tensor_unref(t))
+            atomic_fetch_add_explicit(&counters.arenaReleases, 1, memory_order_relaxed);
+    }
+    arenaTop = mark;
+    depth--;
+    // the result belongs to the caller's scope, or to C, if a variable
+    // holds it it needs a reference of its own
+    if (!keep || !(keep->flags & LISA_TENSOR_OWNED))
+        return;
+    if (!kept)
+        lisa_tensor_retain(keep);
+    keep->flags &= ~LISA_TENSOR_TRACKED;
+    lisa_arena_track(keep);
+}
+
+
+void lisa_alloc_stats_get(lisa_alloc_stats *stats) {
+    stats->allocations = atomic_load(&counters.allocations);
+    stats->frees = atomic_load(&counters.frees);
+    stats->pool_hits = atomic_load(&counters.poolHits);
+    stats->system_allocations = atomic_load(&counters.systemAllocations);
+    stats->arena_releases = atomic_load(&counters.arenaReleases);
+    stats->live_bytes = atomic_load(&counters.liveBytes);
+    stats->peak_bytes = atomic_load(&counters.peakBytes);
+}
+
+
+void lisa_alloc_stats_print(void) {
+    lisa_alloc_stats s;
+    lisa_alloc_stats_get(&s);
+    fprintf(stderr,
+            "tensor allocations: %llu (%llu from the pool, %llu from malloc)\n"
+            "tensor frees: %llu (%llu at function exit)\n"
+            "tensor bytes: %llu live, %llu peak\n",
+            (unsigned long long)s.allocations, (unsigned long long)s.pool_hits,
+            (unsigned long long)s.system_allocations, (unsigned long long)s.frees,
+            (unsigned long long)s.arena_releases, (unsigned long long)s.live_bytes,
+            (unsigned long long)s.peak_bytes);
+}
@@ -0,0 +1,625 @@
+/**
+ * @file csv.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+// CSV files of numbers as columnar tensors
+// the file is memory-mapped and cut into chunks at line ends, one thread
+// per chunk counts its rows and then, once every chunk knows its first
+// row, parses its fields, the tensor has a row per column of the file
+// (structure of arrays), so each column is contiguous
+// numbers are read eight digits at a time in a 64-bit register and
+// converted exactly by the Clinger and Eisel-Lemire fast paths, strtod
+// takes the rest (long mantissas, large exponents, nan, inf)
+// a reader streams a file larger than memory in batches of rows and
+// drops the pages it is done with
+// quoted fields may hold a number, not a line break
+
+// smallest chunk worth a thread
+#define CHUNK_BYTES (1 << 20)
+#define MAX_CHUNKS 64
+// longest field strtod is given
+#define FIELD_MAX 128
+// count_rows adds up 16 lanes of bytes, flushed before they overflow
+#define COUNT_FLUSH 255
+
+typedef unsigned char vb16 __attribute__((vector_size(16)));
+
+
+// a chunk of lines, counted and then parsed by a thread
+struct chunk {
+    const char *begin;
+    const char *end;
+    int64_t columns;
+    int64_t rows;       // counted, then the first row of the chunk
+    double *out;        // column c of row r at out[c * stride + r]
+    int64_t stride;
+};
+
+
+// a file read in batches
+struct reader {
+    struct reader *next;
+    char *path;
+    char *base;
+    size_t length;
+    size_t pos;         // start of the next batch
+    size_t released;    // pages before this have been dropped
+    int64_t columns;
+};
+
+static struct reader *readers;
+static pthread_mutex_t readersLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// 10^0 to 10^22, exact in a double
+static const double exactPowers[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define POWER_MIN (-48)
+#define POWER_MAX 48
+
+// 10^e for e in POWER_MIN..POWER_MAX as {low, high} halves of a 128-bit
+// mantissa with the top bit set, rounded down
+static const uint64_t powers128[POWER_MAX - POWER_MIN + 1][2] = {
+    {0x5560C018580D5D52, 0xBB127C53B17EC159},
+    {0xAAB8F01E6E10B4A6, 0xE9D71B689DDE71AF},
+    {0xCAB3961304CA70E8, 0x9226712162AB070D},
+    {0x3D607B97C5FD0D22, 0xB6B00D69BB55C8D1},
+    {0x8CB89A7DB77C506A, 0xE45C10C42A2B3B05},
+    {0x77F3608E92ADB242, 0x8EB98A7A9A5B04E3},
+    {0x55F038B237591ED3, 0xB267ED1940F1C61C},
+    {0x6B6C46DEC52F6688, 0xDF01E85F912E37A3},
+    {0x2323AC4B3B3DA015, 0x8B61313BBABCE2C6},
+    {0xABEC975E0A0D081A, 0xAE397D8AA96C1B77},
+    {0x96E7BD358C904A21, 0xD9C7DCED53C72255},
+    {0x7E50D64177DA2E54, 0x881CEA14545C7575},
+    {0xDDE50BD1D5D0B9E9, 0xAA242499697392D2},
+    {0x955E4EC64B44E864, 0xD4AD2DBFC3D07787},
+    {0xBD5AF13BEF0B113E, 0x84EC3C97DA624AB4},
+    {0xECB1AD8AEACDD58E, 0xA6274BBDD0FADD61},
+    {0x67DE18EDA5814AF2, 0xCFB11EAD453994BA},
+    {0x80EACF948770CED7, 0x81CEB32C4B43FCF4},
+    {0xA1258379A94D028D, 0xA2425FF75E14FC31},
+    {0x096EE45813A04330, 0xCAD2F7F5359A3B3E},
+    {0x8BCA9D6E188853FC, 0xFD87B5F28300CA0D},
+    {0x775EA264CF55347D, 0x9E74D1B791E07E48},
+    {0x95364AFE032A819D, 0xC612062576589DDA},
+    {0x3A83DDBD83F52204, 0xF79687AED3EEC551},
+    {0xC4926A9672793542, 0x9ABE14CD44753B52},
+    {0x75B7053C0F178293, 0xC16D9A0095928A27},
+    {0x5324C68B12DD6338, 0xF1C90080BAF72CB1},
+    {0xD3F6FC16EBCA5E03, 0x971DA05074DA7BEE},
+    {0x88F4BB1CA6BCF584, 0xBCE5086492111AEA},
+    {0x2B31E9E3D06C32E5, 0xEC1E4A7DB69561A5},
+    {0x3AFF322E62439FCF, 0x9392EE8E921D5D07},
+    {0x09BEFEB9FAD487C2, 0xB877AA3236A4B449},
+    {0x4C2EBE687989A9B3, 0xE69594BEC44DE15B},
+    {0x0F9D37014BF60A10, 0x901D7CF73AB0ACD9},
+    {0x538484C19EF38C94, 0xB424DC35095CD80F},
+    {0x2865A5F206B06FB9, 0xE12E13424BB40E13},
+    {0xF93F87B7442E45D3, 0x8CBCCC096F5088CB},
+    {0xF78F69A51539D748, 0xAFEBFF0BCB24AAFE},
+    {0xB573440E5A884D1B, 0xDBE6FECEBDEDD5BE},
+    {0x31680A88F8953030, 0x89705F4136B4A597},
+    {0xFDC20D2B36BA7C3D, 0xABCC77118461CEFC},
+    {0x3D32907604691B4C, 0xD6BF94D5E57A42BC},
+    {0xA63F9A49C2C1B10F, 0x8637BD05AF6C69B5},
+    {0x0FCF80DC33721D53, 0xA7C5AC471B478423},
+    {0xD3C36113404EA4A8, 0xD1B71758E219652B},
+    {0x645A1CAC083126E9, 0x83126E978D4FDF3B},
+    {0x3D70A3D70A3D70A3, 0xA3D70A3D70A3D70A},
+    {0xCCCCCCCCCCCCCCCC, 0xCCCCCCCCCCCCCCCC},
+    {0x0000000000000000, 0x8000000000000000},
+    {0x0000000000000000, 0xA000000000000000},
+    {0x0000000000000000, 0xC800000000000000},
+    {0x0000000000000000, 0xFA00000000000000},
+    {0x0000000000000000, 0x9C40000000000000},
+    {0x0000000000000000, 0xC350000000000000},
+    {0x0000000000000000, 0xF424000000000000},
+    {0x0000000000000000, 0x9896800000000000},
+    {0x0000000000000000, 0xBEBC200000000000},
+    {0x0000000000000000, 0xEE6B280000000000},
+    {0x0000000000000000, 0x9502F90000000000},
+    {0x0000000000000000, 0xBA43B74000000000},
+    {0x0000000000000000, 0xE8D4A51000000000},
+    {0x0000000000000000, 0x9184E72A00000000},
+    {0x0000000000000000, 0xB5E620F480000000},
+    {0x0000000000000000, 0xE35FA931A0000000},
+    {0x0000000000000000, 0x8E1BC9BF04000000},
+    {0x0000000000000000, 0xB1A2BC2EC5000000},
+    {0x0000000000000000, 0xDE0B6B3A76400000},
+    {0x0000000000000000, 0x8AC7230489E80000},
+    {0x0000000000000000, 0xAD78EBC5AC620000},
+    {0x0000000000000000, 0xD8D726B7177A8000},
+    {0x0000000000000000, 0x878678326EAC9000},
+    {0x0000000000000000, 0xA968163F0A57B400},
+    {0x0000000000000000, 0xD3C21BCECCEDA100},
+    {0x0000000000000000, 0x84595161401484A0},
+    {0x0000000000000000, 0xA56FA5B99019A5C8},
+    {0x0000000000000000, 0xCECB8F27F4200F3A},
+    {0x4000000000000000, 0x813F3978F8940984},
+    {0x5000000000000000, 0xA18F07D736B90BE5},
+    {0xA400000000000000, 0xC9F2C9CD04674EDE},
+    {0x4D00000000000000, 0xFC6F7C4045812296},
+    {0xF020000000000000, 0x9DC5ADA82B70B59D},
+    {0x6C28000000000000, 0xC5371912364CE305},
+    {0xC732000000000000, 0xF684DF56C3E01BC6},
+    {0x3C7F400000000000, 0x9A130B963A6C115C},
+    {0x4B9F100000000000, 0xC097CE7BC90715B3},
+    {0x1E86D40000000000, 0xF0BDC21ABB48DB20},
+    {0x1314448000000000, 0x96769950B50D88F4},
+    {0x17D955A000000000, 0xBC143FA4E250EB31},
+    {0x5DCFAB0800000000, 0xEB194F8E1AE525FD},
+    {0x5AA1CAE500000000, 0x92EFD1B8D0CF37BE},
+    {0xF14A3D9E40000000, 0xB7ABC627050305AD},
+    {0x6D9CCD05D0000000, 0xE596B7B0C643C719},
+    {0xE4820023A2000000, 0x8F7E32CE7BEA5C6F},
+    {0xDDA2802C8A800000, 0xB35DBF821AE4F38B},
+    {0xD50B2037AD200000, 0xE0352F62A19E306E},
+    {0x4526F422CC340000, 0x8C213D9DA502DE45},
+    {0x9670B12B7F410000, 0xAF298D050E4395D6},
+};
+
+
+// whether the line ending at q (its '\n' or the end of the chunk) holds
+// anything but a '\r', chunks start at the start of a line
+static inline int ends_row(const char *begin, const char *q) {
+    if (q > begin && q[-1] == '\r')
+        q--;
+    return q > begin && q[-1] != '\n';
+}
+
+
+static inline vb16 load16(const char *p) {
+    vb16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+// lines in [begin, end) that are not blank, 16 bytes at a time
+static int64_t count_rows(const char *begin, const char *end) {
+    int64_t rows = 0;
+    const char *p = begin;
+    // the vector loop looks two bytes back
+    for (; p < end && p < begin + 2; p++)
+        rows += *p == '\n' && ends_row(begin, p);
+    const vb16 nl = (vb16){0} + '\n', cr = (vb16){0} + '\r';
+    while (end - p >= 16) {
+        vb16 acc = {0};
+        for (int n = 0; n < COUNT_FLUSH && end - p >= 16; n++, p += 16) {
+            vb16 v = load16(p), a = load16(p - 1), b = load16(p - 2);
+            vb16 blank = (vb16)(a == nl) | ((vb16)(a == cr) & (vb16)(b == nl));
+            acc -= (vb16)(v == nl) & ~blank;
+        }
+        for (int k = 0; k < 16; k++)
+            rows += acc[k];
+    }
+    for (; p < end; p++)
+        rows += *p == '\n' && ends_row(begin, p);
+    return rows + (end > begin && end[-1] != '\n' && ends_row(begin, end));
+}
+
+
+// the end of the line after rows lines that are not blank, or end
+static const char *skip_rows(const char *p, const char *end, int64_t rows) {
+    while (rows > 0 && p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *stop = nl ? nl : end;
+        rows -= ends_row(p, stop);
+        p = nl ? nl + 1 : end;
+    }
+    return p;
+}
+
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline uint64_t load8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+// eight ASCII digits in v, and their value (simdjson)
+static inline int eight_digits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0) |
+             (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+            0x3333333333333333);
+}
+
+
+static inline uint64_t parse_eight(uint64_t v) {
+    const uint64_t mask = 0x000000FF000000FF;
+    v -= 0x3030303030303030;
+    v = v * 10 + (v >> 8);
+    return ((v & mask) * 0x000F424000000064 + ((v >> 16) & mask) * 0x0000271000000001) >> 32;
+}
+#endif
+
+
+// the digits at p appended to m, count is the digits in m so far, past
+// 19 m is no longer exact
+static inline const char *parse_digits(const char *p, const char *end, uint64_t *m,
+                                       int *count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - p >= 8 && *count <= 11 && eight_digits(load8(p))) {
+        *m = *m * 100000000 + parse_eight(load8(p));
+        *count += 8;
+        p += 8;
+    }
+#endif
+    for (; p < end && (unsigned)(*p - '0') < 10; p++, (*count)++)
+        *m = *m * 10 + (*p - '0');
+    return p;
+}
+
+
+// m * 10^e rounded to nearest, false if that needs more precision than
+// the table has (Eisel-Lemire, after the Go standard library)
+static int eisel_lemire(uint64_t m, int64_t e, int neg, double *value) {
+    if (e < POWER_MIN || e > POWER_MAX)
+        return 0;
+    const uint64_t *power = powers128[e - POWER_MIN];
+    int clz = __builtin_clzll(m);
+    m <<= clz;
+    uint64_t exp2 = (uint64_t)(((217706 * e) >> 16) + 64 + 1023) - clz;
+    unsigned __int128 x = (unsigned __int128)m * power[1];
+    uint64_t hi = x >> 64, lo = (uint64_t)x;
+    // the low half of the power matters when the product is close to a
+    // rounding boundary
+    if ((hi & 0x1FF) == 0x1FF && lo + m < m) {
+        unsigned __int128 y = (unsigned __int128)m * power[0];
+        uint64_t yhi = y >> 64, ylo = (uint64_t)y;
+        uint64_t mergedHi = hi, mergedLo = lo + yhi;
+        if (mergedLo < lo)
+            mergedHi++;
+        if ((mergedHi & 0x1FF) == 0x1FF && mergedLo + 1 == 0 && ylo + m < m)
+            return 0;
+        hi = mergedHi;
+        lo = mergedLo;
+    }
+    uint64_t msb = hi >> 63;
+    uint64_t mantissa = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+    // halfway between two doubles
+    if (lo == 0 && (hi & 0x1FF) == 0 && (mantissa & 3) == 1)
+        return 0;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >> 53) {
+        mantissa >>= 1;
+        exp2++;
+    }
+    // subnormal, infinite or out of range
+    if (exp2 - 1 >= 0x7FF - 1)
+        return 0;
+    uint64_t bits = exp2 << 52 | (mantissa & 0x000FFFFFFFFFFFFF);
+    if (neg)
+        bits |= 0x8000000000000000;
+    memcpy(value, &bits, sizeof(bits));
+    return 1;
+}
+
+
+// the decimal number [p, end) without spaces or quotes, false if it is
+// anything else or needs strtod
+static int parse_number(const char *p, const char *end, double *value) {
+    int neg = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+        p++;
+    uint64_t m = 0;
+    int count = 0;
+    int64_t e = 0;
+    const char *start = p;
+    while (p < end && *p == '0')
+        p++;
+    p = parse_digits(p, end, &m, &count);
+    int any = p > start;
+    if (p < end && *p == '.') {
+        const char *frac = ++p;
+        // zeros before the first significant digit are not counted
+        if (count == 0)
+            while (p < end && *p == '0')
+                p++;
+        p = parse_digits(p, end, &m, &count);
+        e = -(p - frac);
+        any |= p > frac;
+    }
+    if (!any)
+        return 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int negExp = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        if (p == end || (unsigned)(*p - '0') >= 10)
+            return 0;
+        int64_t exp = 0;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++)
+            if (exp < 100000)
+                exp = exp * 10 + (*p - '0');
+        e += negExp ? -exp : exp;
+    }
+    if (p != end || count > 19)
+        return 0;
+    if (m == 0) {
+        *value = neg ? -0.0 : 0.0;
+        return 1;
+    }
+    // both m and 10^e are exact doubles, so one rounding (Clinger)
+    if (m <= (uint64_t)1 << 53 && e >= -22 && e <= 22) {
+        double d = (double)m;
+        d = e < 0 ? d / exactPowers[-e] : d * exactPowers[e];
+        *value = neg ? -d : d;
+        return 1;
+    }
+    return eisel_lemire(m, e, neg, value);
+}
+
+
+static inline int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '"';
+}
+
+
+// the end of the field at p, a quoted field may hold commas
+static const char *field_end(const char *p, const char *end) {
+    int quoted = 0;
+    for (; p < end; p++) {
+        if (*p == '"')
+            quoted = !quoted;
+        else if (*p == ',' && !quoted)
+            break;
+    }
+    return p;
+}
+
+
+// the number in the field [p, end), false for an empty field or text
+static int parse_field(const char *p, const char *end, double *value) {
+    if (parse_number(p, end, value))
+        return 1;
+    while (p < end && is_space(*p))
+        p++;
+    while (end > p && is_space(end[-1]))
+        end--;
+    if (p == end || end - p >= FIELD_MAX)
+        return 0;
+    char buf[FIELD_MAX];
+    memcpy(buf, p, end - p);
+    buf[end - p] = '\0';
+    char *stop;
+    *value = strtod(buf, &stop);
+    return stop == buf + (end - p);
+}
+
+
+// the rows of [begin, end) into out, fields past the columns of the file
+// are ignored and missing or unreadable ones are NaN
+static void parse_rows(const char *begin, const char *end, int64_t columns, double *out,
+                       int64_t stride) {
+    int64_t row = 0;
+    for (const char *line = begin; line < end;) {
+        const char *nl = memchr(line, '\n', end - line);
+        const char *stop = nl ? nl : end;
+        if (ends_row(line, stop)) {
+            if (stop[-1] == '\r')
+                stop--;
+            const char *p = line;
+            for (int64_t c = 0; c < columns; c++) {
+                double value = NAN;
+                if (p <= stop) {
+                    const char *fe = field_end(p, stop);
+                    if (!parse_field(p, fe, &value))
+                        value = NAN;
+                    p = fe + 1;
+                }
+                out[c * stride + row] = value;
+            }
+            row++;
+        }
+        line = nl ? nl + 1 : end;
+    }
+}
+
+
+static void *count_chunk(void *arg) {
+    struct chunk *c = arg;
+    c->rows = count_rows(c->begin, c->end);
+    return NULL;
+}
+
+
+static void *parse_chunk(void *arg) {
+    struct chunk *c = arg;
+    parse_rows(c->begin, c->end, c->columns, c->out, c->stride);
+    return NULL;
+}
+
+
+// fn on every chunk, the first one on this thread
+static void run_chunks(void *(*fn)(void *), struct chunk *chunks, int64_t count) {
+    pthread_t ids[MAX_CHUNKS];
+    int started[MAX_CHUNKS];
+    for (int64_t t = 0; t < count; t++)
+        started[t] = t > 0 && pthread_create(&ids[t], NULL, fn, &chunks[t]) == 0;
+    for (int64_t t = 0; t < count; t++)
+        if (!started[t])
+            fn(&chunks[t]);
+    for (int64_t t = 0; t < count; t++)
+        if (started[t])
+            pthread_join(ids[t], NULL);
+}
+
+
+// the lines of [begin, end) as a tensor of shape [columns, rows]
+static lisa_tensor *parse_range(const char *begin, const char *end, int64_t columns) {
+    struct chunk chunks[MAX_CHUNKS];
+    int64_t threads = (end - begin) / CHUNK_BYTES;
+    if (threads > lisa_max_threads())
+        threads = lisa_max_threads();
+    int64_t count = 0;
+    for (const char *p = begin; p < end; count++) {
+        const char *q = end;
+        // cut after the line the even share ends in
+        if (count < threads - 1) {
+            q = memchr(p + (end - p) / (threads - count), '\n',
+                       end - p - (end - p) / (threads - count));
+            q = q ? q + 1 : end;
+        }
+        chunks[count] = (struct chunk){p, q, columns, 0, NULL, 0};
+        p = q;
+    }
+    run_chunks(count_chunk, chunks, count);
+    int64_t rows = 0;
+    for (int64_t t = 0; t < count; t++) {
+        int64_t n = chunks[t].rows;
+        chunks[t].rows = rows;
+        rows += n;
+    }
+    int64_t shape[2] = {columns, rows};
+    lisa_tensor *t = lisa_tensor_new(2, shape);
+    if (rows == 0)
+        return t;
+    for (int64_t k = 0; k < count; k++) {
+        chunks[k].out = t->data + chunks[k].rows;
+        chunks[k].stride = rows;
+    }
+    run_chunks(parse_chunk, chunks, count);
+    return t;
+}
+
+
+// the columns of the file are the fields of its first line, which is
+// skipped when one of them is text, returns where the rows start
+static const char *read_header(const char *begin, const char *end, int64_t *columns) {
+    *columns = 0;
+    const char *line = begin;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        const char *stop = nl ? nl : end;
+        const char *next = nl ? nl + 1 : end;
+        if (!ends_row(line, stop)) {
+            line = next;
+            continue;
+        }
+        if (stop[-1] == '\r')
+            stop--;
+        int header = 0;
+        for (const char *p = line; p <= stop; (*columns)++) {
+            const char *fe = field_end(p, stop);
+            double value;
+            const char *q = p;
+            while (q < fe && is_space(*q))
+                q++;
+            header |= q < fe && !parse_field(p, fe, &value);
+            p = fe + 1;
+        }
+        return header ? next : line;
+    }
+    return end;
+}
+
+
+lisa_tensor *lisa_tensor_load_csv(const char *path) {
+    size_t length;
+    char *base = lisa_map_file(path, &length, 0);
+    if (!base)
+        return lisa_tensor_new(2, (int64_t[]){0, 0});
+    madvise(base, length, MADV_SEQUENTIAL);
+    int64_t columns;
+    const char *rows = read_header(base, base + length, &columns);
+    lisa_tensor *t = parse_range(rows, base + length, columns);
+    munmap(base, length);
+    return t;
+}
+
+
+static struct reader *find_reader(const char *path) {
+    for (struct reader *r = readers; r; r = r->next)
+        if (strcmp(r->path, path) == 0)
+            return r;
+    return NULL;
+}
+
+
+static struct reader *open_reader(const char *path) {
+    struct reader *r = calloc(1, sizeof(*r));
+    if (!r || !(r->path = strdup(path)))
+        lisa_runtime_error("out of memory");
+    r->base = lisa_map_file(path, &r->length, 0);
+    if (r->base) {
+        madvise(r->base, r->length, MADV_SEQUENTIAL);
+        r->pos = read_header(r->base, r->base + r->length, &r->columns) - r->base;
+    }
+    r->next = readers;
+    readers = r;
+    return r;
+}
+
+
+static void close_reader(struct reader *r) {
+    for (struct reader **p = &readers; *p; p = &(*p)->next) {
+        if (*p != r)
+            continue;
+        *p = r->next;
+        if (r->base)
+            munmap(r->base, r->length);
+        free(r->path);
+        free(r);
+        return;
+    }
+}
+
+
+lisa_tensor *lisa_tensor_read_csv(const char *path, int64_t rows) {
+    if (rows < 1)
+        lisa_file_error(path, "a batch needs at least one row");
+    pthread_mutex_lock(&readersLock);
+    struct reader *r = find_reader(path);
+    if (!r)
+        r = open_reader(path);
+    const char *begin = r->base + r->pos, *end = r->base + r->length;
+    const char *stop = skip_rows(begin, end, rows);
+    lisa_tensor *t = parse_range(begin, stop, r->columns);
+    r->pos = stop - r->base;
+    // the pages of the batch are not needed again, dropping them keeps a
+    // file larger than memory from pushing out everything else
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t done = r->pos / page * page;
+    if (done > r->released) {
+        madvise(r->base + r->released, done - r->released, MADV_DONTNEED);
+        r->released = done;
+    }
+    // the batch after the last one is empty and the next call starts over
+    if (t->shape[1] == 0)
+        close_reader(r);
+    pthread_mutex_unlock(&readersLock);
+    return t;
+}
+
+
+void lisa_tensor_close_csv(const char *path) {
+    pthread_mutex_lock(&readersLock);
+    struct reader *r = find_reader(path);
+    if (r)
+        close_reader(r);
+    pthread_mutex_unlock(&readersLock);
+}
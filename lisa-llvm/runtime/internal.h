@@ -0,0 +1,52 @@
+/**
+ * @file internal.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef LISA_RUNTIME_INTERNAL_H
+#define LISA_RUNTIME_INTERNAL_H
+
+#pragma once
+
+#include "lisa_runtime.h"
+
+// shared by the runtime sources, not part of the installed interface
+
+// print a runtime error and abort
+__attribute__((noreturn, cold)) void lisa_runtime_error(const char *msg);
+// print "path: what" as a runtime error and abort
+__attribute__((noreturn, cold)) void lisa_file_error(const char *path, const char *what);
+// map the whole file privately, NULL for an empty one, stores into a
+// writable mapping stay in memory
+char *lisa_map_file(const char *path, size_t *length, int writable);
+// LISA_NUM_THREADS, or every online CPU, at most 64
+int64_t lisa_max_threads(void);
+// write the shape of t as "[2, 3]", returns the length like snprintf
+int lisa_format_shape(char *buf, size_t size, const lisa_tensor *t);
+
+// flag bits besides LISA_TENSOR_OWNED
+#define LISA_TENSOR_TRACKED 2       // may be in the scope of a Lisa function
+#define LISA_TENSOR_MAPPED 4        // the buffer is a mapped file, see io.c
+#define LISA_TENSOR_CLASS_SHIFT 8   // pool size class + 1, 0 for malloc
+
+// a block of at least bytes, aligned to LISA_ALIGNMENT, cls is its size
+// class, pass both back to lisa_pool_free
+void *lisa_pool_alloc(size_t bytes, int *cls);
+void lisa_pool_free(void *ptr, size_t bytes, int cls);
+// release a LISA_TENSOR_MAPPED tensor and its mapping
+void lisa_tensor_unmap(lisa_tensor *t);
+// drop a reference held by a scope, the tensor is returned to the pool
+// with the last one, true then
+int lisa_tensor_unref(lisa_tensor *t);
+// add t to the scope of the running Lisa function, if any, the scope
+// then holds the reference of the caller
+void lisa_arena_track(lisa_tensor *t);
+// take t out of its scope, the reference stays with the caller,
+// false if it is in no scope
+int lisa_arena_forget(lisa_tensor *t);
+
+#endif
@@ -0,0 +1,485 @@
+/**
+ * @file io.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// tensors in files, NumPy's .npy format and raw little-endian doubles
+// files are memory-mapped rather than read, so loading copies nothing and
+// a page is read from disk when it is first touched, the mapping is
+// private so stores into the tensor never reach the file
+// .npy files of other element types are converted into a new tensor
+// writers stream the buffer straight to the file with pwrite
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_SIZE 6
+// header of a file being appended to, room for any shape of rank 4, so it
+// can be rewritten in place as the file grows
+#define NPY_APPEND_HEADER 192
+// elements of a strided tensor gathered per write
+#define WRITE_CHUNK 4096
+
+
+// a tensor whose buffer is in a mapped file, unmapped with the last
+// reference
+struct mapping {
+    lisa_tensor t;      // first, so lisa_tensor_unmap finds the rest
+    void *base;
+    size_t length;
+};
+
+
+// the header of a .npy file
+struct npy_header {
+    char kind;          // 'f', 'i', 'u' or 'b'
+    int itemsize;
+    int fortran;        // column major
+    int64_t rank;
+    int64_t shape[LISA_MAX_RANK];
+};
+
+
+// a file tensors are appended to, shape[0] counts the rows so far
+struct writer {
+    struct writer *next;
+    char *path;
+    int fd;
+    int64_t rank;
+    int64_t shape[LISA_MAX_RANK];
+    off_t end;
+};
+
+static struct writer *writers;
+static pthread_mutex_t writersLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void lisa_file_error(const char *path, const char *what) {
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s: %s", path, what);
+    lisa_runtime_error(msg);
+}
+
+
+// no swap is reserved for the private copies of stored-to pages, otherwise
+// the kernel refuses to map a file larger than memory
+char *lisa_map_file(const char *path, size_t *length, int writable) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        lisa_file_error(path, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        lisa_file_error(path, strerror(errno));
+    *length = st.st_size;
+    if (*length == 0) {
+        close(fd);
+        return NULL;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *base = mmap(NULL, *length, prot, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        lisa_file_error(path, strerror(errno));
+    return base;
+}
+
+
+static lisa_tensor *mapped_tensor(void *base, size_t length, double *data,
+                                  int64_t rank, const int64_t *shape) {
+    struct mapping *m = malloc(sizeof(*m));
+    if (!m)
+        lisa_runtime_error("out of memory");
+    m->t = lisa_tensor_view(data, rank, shape);
+    m->t.flags = LISA_TENSOR_OWNED | LISA_TENSOR_MAPPED;
+    m->t.refs = 1;
+    m->base = base;
+    m->length = length;
+    lisa_arena_track(&m->t);
+    return &m->t;
+}
+
+
+void lisa_tensor_unmap(lisa_tensor *t) {
+    struct mapping *m = (struct mapping *)t;
+    munmap(m->base, m->length);
+    free(m);
+}
+
+
+// the elements of a .npy file in column-major order
+static void fortran_strides(lisa_tensor *t) {
+    int64_t stride = 1;
+    for (int64_t k = 0; k < t->rank; k++) {
+        t->strides[k] = stride;
+        stride *= t->shape[k];
+    }
+}
+
+
+// the value of key in the header dict, NumPy quotes keys with ', other
+// writers may use "
+static const char *npy_field(const char *header, const char *key) {
+    char quoted[32];
+    const char *p = NULL;
+    for (const char *q = "'\""; *q && !p; q++) {
+        snprintf(quoted, sizeof(quoted), "%c%s%c", *q, key, *q);
+        p = strstr(header, quoted);
+    }
+    if (!p)
+        return NULL;
+    p += strlen(key) + 2;
+    while (*p == ' ')
+        p++;
+    if (*p++ != ':')
+        return NULL;
+    while (*p == ' ')
+        p++;
+    return p;
+}
+
+
+// an error message, NULL if the header is fine
+static const char *parse_npy_header(const char *header, struct npy_header *h) {
+    const char *p = npy_field(header, "descr");
+    if (!p || (*p != '\'' && *p != '"'))
+        return "unsupported .npy element type";
+    char quote = *p;
+    char order = p[1];
+    h->kind = p[2];
+    char *end;
+    h->itemsize = (int)strtol(p + 3, &end, 10);
+    if (*end != quote || !(order == '<' || order == '|' || order == '='))
+        return "unsupported .npy element type";
+    int ok = (h->kind == 'f' && (h->itemsize == 4 || h->itemsize == 8)) ||
+        ((h->kind == 'i' || h->kind == 'u') &&
+         (h->itemsize == 1 || h->itemsize == 2 || h->itemsize == 4 || h->itemsize == 8)) ||
+        (h->kind == 'b' && h->itemsize == 1);
+    if (!ok)
+        return "unsupported .npy element type";
+
+    p = npy_field(header, "fortran_order");
+    if (p && strncmp(p, "True", 4) == 0)
+        h->fortran = 1;
+    else if (p && strncmp(p, "False", 5) == 0)
+        h->fortran = 0;
+    else
+        return "malformed .npy header";
+
+    p = npy_field(header, "shape");
+    if (!p || *p++ != '(')
+        return "malformed .npy header";
+    h->rank = 0;
+    while (1) {
+        while (*p == ' ')
+            p++;
+        if (*p == ')')
+            break;
+        if (h->rank == LISA_MAX_RANK)
+            return "tensors have at most 4 dimensions";
+        long long dim = strtoll(p, &end, 10);
+        if (end == p || dim < 0)
+            return "malformed .npy header";
+        h->shape[h->rank++] = dim;
+        p = end;
+        while (*p == ' ')
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p != ')')
+            return "malformed .npy header";
+    }
+    return NULL;
+}
+
+
+// n elements of a .npy file of another element type
+static void convert(const char *src, double *dst, int64_t n, char kind, int itemsize) {
+#define CONVERT(type) \
+    for (int64_t i = 0; i < n; i++) { \
+        type v; \
+        memcpy(&v, src + i * sizeof(type), sizeof(type)); \
+        dst[i] = (double)v; \
+    } \
+    return
+
+    if (kind == 'f' && itemsize == 8) { CONVERT(double); }
+    if (kind == 'f') { CONVERT(float); }
+    if (kind == 'i' && itemsize == 1) { CONVERT(int8_t); }
+    if (kind == 'i' && itemsize == 2) { CONVERT(int16_t); }
+    if (kind == 'i' && itemsize == 4) { CONVERT(int32_t); }
+    if (kind == 'i') { CONVERT(int64_t); }
+    if (itemsize == 1) { CONVERT(uint8_t); }
+    if (itemsize == 2) { CONVERT(uint16_t); }
+    if (itemsize == 4) { CONVERT(uint32_t); }
+    CONVERT(uint64_t);
+#undef CONVERT
+}
+
+
+// the number of elements of shape, -1 if it overflows
+static int64_t count_elements(int64_t rank, const int64_t *shape) {
+    int64_t size = 1;
+    for (int64_t k = 0; k < rank; k++)
+        if (__builtin_mul_overflow(size, shape[k], &size))
+            return -1;
+    return size;
+}
+
+
+lisa_tensor *lisa_tensor_load_npy(const char *path) {
+    size_t length;
+    char *base = lisa_map_file(path, &length, 1);
+    const unsigned char *bytes = (const unsigned char *)base;
+    if (length < NPY_MAGIC_SIZE + 4 || memcmp(base, NPY_MAGIC, NPY_MAGIC_SIZE) != 0)
+        lisa_file_error(path, "not a .npy file");
+    // version 1 has a 2 byte header length, 2 and 3 have 4 bytes
+    size_t start, headerLength;
+    if (bytes[6] == 1) {
+        start = 10;
+        headerLength = bytes[8] | (size_t)bytes[9] << 8;
+    }
+    else if ((bytes[6] == 2 || bytes[6] == 3) && length >= 12) {
+        start = 12;
+        headerLength = bytes[8] | (size_t)bytes[9] << 8 | (size_t)bytes[10] << 16 |
+            (size_t)bytes[11] << 24;
+    }
+    else
+        lisa_file_error(path, "unsupported .npy version");
+    if (headerLength > length - start)
+        lisa_file_error(path, "truncated .npy file");
+
+    char *header = malloc(headerLength + 1);
+    if (!header)
+        lisa_runtime_error("out of memory");
+    memcpy(header, base + start, headerLength);
+    header[headerLength] = '\0';
+    struct npy_header h;
+    const char *err = parse_npy_header(header, &h);
+    free(header);
+    if (err)
+        lisa_file_error(path, err);
+
+    size_t offset = start + headerLength;
+    int64_t size = count_elements(h.rank, h.shape);
+    if (size < 0 || (uint64_t)size > (length - offset) / h.itemsize)
+        lisa_file_error(path, "truncated .npy file");
+    lisa_tensor *t;
+    // doubles on a cache line are used where they are, NumPy pads the
+    // header to 64 bytes so that is the usual case
+    if (h.kind == 'f' && h.itemsize == 8 && size > 0 && offset % LISA_ALIGNMENT == 0)
+        t = mapped_tensor(base, length, (double *)(base + offset), h.rank, h.shape);
+    else {
+        t = lisa_tensor_new(h.rank, h.shape);
+        convert(base + offset, t->data, size, h.kind, h.itemsize);
+        munmap(base, length);
+    }
+    if (h.fortran)
+        fortran_strides(t);
+    return t;
+}
+
+
+lisa_tensor *lisa_tensor_load_raw(const char *path, int64_t rank, const int64_t *shape) {
+    if (rank < 1 || rank > LISA_MAX_RANK)
+        lisa_runtime_error("tensor rank out of range");
+    int64_t dims[LISA_MAX_RANK];
+    int64_t known = 1, inferred = -1;
+    for (int64_t k = 0; k < rank; k++) {
+        dims[k] = shape[k];
+        if (shape[k] == -1 && inferred < 0)
+            inferred = k;
+        else if (shape[k] < 0)
+            lisa_runtime_error("negative tensor dimension");
+        else if (__builtin_mul_overflow(known, shape[k], &known))
+            lisa_file_error(path, "tensor shape too large");
+    }
+    size_t length;
+    char *base = lisa_map_file(path, &length, 1);
+    if (length % sizeof(double) != 0)
+        lisa_file_error(path, "size is not a whole number of doubles");
+    int64_t count = length / sizeof(double);
+    if (inferred >= 0 && known > 0 && count % known == 0)
+        dims[inferred] = count / known;
+    else if (inferred >= 0 || known != count) {
+        char msg[256];
+        int len = snprintf(msg, sizeof(msg), "%lld doubles do not fill a tensor of shape [",
+                           (long long)count);
+        for (int64_t k = 0; k < rank; k++)
+            len += snprintf(msg + len, sizeof(msg) - len, k ? ", %lld" : "%lld",
+                            (long long)shape[k]);
+        snprintf(msg + len, sizeof(msg) - len, "]");
+        lisa_file_error(path, msg);
+    }
+    if (count == 0)
+        return lisa_tensor_new(rank, dims);
+    return mapped_tensor(base, length, (double *)base, rank, dims);
+}
+
+
+// all of buf at offset
+static void write_at(int fd, const char *path, const void *buf, size_t bytes, off_t offset) {
+    const char *p = buf;
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            lisa_file_error(path, strerror(errno));
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+
+// the elements of t in row-major order, a strided tensor is gathered in
+// chunks
+static void write_data(int fd, const char *path, const lisa_tensor *t, off_t offset) {
+    if (lisa_tensor_is_contiguous(t)) {
+        write_at(fd, path, t->data, t->size * sizeof(double), offset);
+        return;
+    }
+    double chunk[WRITE_CHUNK];
+    int64_t index[LISA_MAX_RANK] = {0};
+    int64_t filled = 0;
+    for (int64_t i = 0; i < t->size; i++) {
+        int64_t element = 0;
+        for (int64_t k = 0; k < t->rank; k++)
+            element += index[k] * t->strides[k];
+        chunk[filled++] = t->data[element];
+        for (int64_t k = t->rank - 1; k >= 0 && ++index[k] == t->shape[k]; k--)
+            index[k] = 0;
+        if (filled == WRITE_CHUNK || i + 1 == t->size) {
+            write_at(fd, path, chunk, filled * sizeof(double), offset);
+            offset += filled * sizeof(double);
+            filled = 0;
+        }
+    }
+}
+
+
+// a version 1.0 header for doubles of the given shape, padded with spaces
+// to at least minLength bytes and a multiple of LISA_ALIGNMENT, so the
+// data is aligned when the file is mapped, returns its length
+static size_t npy_header(char *buf, size_t size, int64_t rank, const int64_t *shape,
+                         size_t minLength) {
+    int len = NPY_MAGIC_SIZE + 4;
+    len += snprintf(buf + len, size - len,
+                    "{'descr': '<f8', 'fortran_order': False, 'shape': (");
+    for (int64_t k = 0; k < rank; k++)
+        len += snprintf(buf + len, size - len, k ? ", %lld" : "%lld", (long long)shape[k]);
+    len += snprintf(buf + len, size - len, rank == 1 ? ",), }" : "), }");
+    size_t total = len + 1;
+    if (total < minLength)
+        total = minLength;
+    total = (total + LISA_ALIGNMENT - 1) / LISA_ALIGNMENT * LISA_ALIGNMENT;
+    memset(buf + len, ' ', total - 1 - len);
+    buf[total - 1] = '\n';
+    memcpy(buf, NPY_MAGIC, NPY_MAGIC_SIZE);
+    size_t headerLength = total - NPY_MAGIC_SIZE - 4;
+    buf[6] = 1;
+    buf[7] = 0;
+    buf[8] = (char)(headerLength & 0xff);
+    buf[9] = (char)(headerLength >> 8);
+    return total;
+}
+
+
+int64_t lisa_tensor_save_npy(const lisa_tensor *t, const char *path) {
+    // a file that was being appended to starts over
+    lisa_tensor_close_npy(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        lisa_file_error(path, strerror(errno));
+    char header[256];
+    size_t length = npy_header(header, sizeof(header), t->rank, t->shape, 0);
+    write_at(fd, path, header, length, 0);
+    write_data(fd, path, t, length);
+    if (close(fd) != 0)
+        lisa_file_error(path, strerror(errno));
+    return t->size;
+}
+
+
+static struct writer *find_writer(const char *path) {
+    for (struct writer *w = writers; w; w = w->next)
+        if (strcmp(w->path, path) == 0)
+            return w;
+    return NULL;
+}
+
+
+static struct writer *open_writer(const char *path, const lisa_tensor *t) {
+    struct writer *w = calloc(1, sizeof(*w));
+    if (!w || !(w->path = strdup(path)))
+        lisa_runtime_error("out of memory");
+    w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (w->fd < 0)
+        lisa_file_error(path, strerror(errno));
+    w->rank = t->rank;
+    memcpy(w->shape, t->shape, sizeof(w->shape));
+    w->shape[0] = 0;
+    w->end = NPY_APPEND_HEADER;
+    w->next = writers;
+    writers = w;
+    return w;
+}
+
+
+int64_t lisa_tensor_append_npy(const lisa_tensor *t, const char *path) {
+    if (t->rank < 1)
+        lisa_file_error(path, "only tensors of rank 1 or more can be appended");
+    pthread_mutex_lock(&writersLock);
+    struct writer *w = find_writer(path);
+    if (!w)
+        w = open_writer(path, t);
+    else if (w->rank != t->rank ||
+             memcmp(w->shape + 1, t->shape + 1, (t->rank - 1) * sizeof(int64_t)) != 0) {
+        char msg[256];
+        int len = snprintf(msg, sizeof(msg), "cannot append a tensor of shape ");
+        len += lisa_format_shape(msg + len, sizeof(msg) - len, t);
+        snprintf(msg + len, sizeof(msg) - len, " to rows of another shape");
+        lisa_file_error(path, msg);
+    }
+    write_data(w->fd, path, t, w->end);
+    w->end += t->size * sizeof(double);
+    w->shape[0] += t->shape[0];
+    // the header follows every append, so the file is complete whenever
+    // the program stops
+    char header[NPY_APPEND_HEADER];
+    npy_header(header, sizeof(header), w->rank, w->shape, NPY_APPEND_HEADER);
+    write_at(w->fd, path, header, NPY_APPEND_HEADER, 0);
+    int64_t rows = w->shape[0];
+    pthread_mutex_unlock(&writersLock);
+    return rows;
+}
+
+
+void lisa_tensor_close_npy(const char *path) {
+    pthread_mutex_lock(&writersLock);
+    for (struct writer **p = &writers; *p; p = &(*p)->next) {
+        struct writer *w = *p;
+        if (strcmp(w->path, path) != 0)
+            continue;
+        *p = w->next;
+        close(w->fd);
+        free(w->path);
+        free(w);
+        break;
+    }
+    pthread_mutex_unlock(&writersLock);
+}
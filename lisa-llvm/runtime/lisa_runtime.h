@@ -0,0 +1,176 @@
+/**
+ * @file lisa_runtime.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef LISA_RUNTIME_H
+#define LISA_RUNTIME_H
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// runtime support of compiled Lisa code, written in C so it links into
+// C, C++ and Lisa programs alike, executables and shared libraries built
+// by lisa link liblisart.a automatically
+
+#define LISA_MAX_RANK 4
+#define LISA_ALIGNMENT 64       // tensor buffers start on a cache line
+
+// allocated by the runtime and reference counted, lisa_tensor_free drops
+// a reference and releases the buffer with the last one
+#define LISA_TENSOR_OWNED 1
+
+// a dense tensor of doubles
+// strides are in elements, tensors made by Lisa are contiguous and row
+// major, views of C buffers may be strided
+// the layout is mirrored by CodeGenVisitor::tensorType(), keep them in sync
+typedef struct lisa_tensor {
+    double *data;
+    int64_t rank;
+    int64_t size;                       // number of elements
+    int64_t shape[LISA_MAX_RANK];
+    int64_t strides[LISA_MAX_RANK];
+    int64_t flags;
+    int64_t refs;                       // references to an owned tensor
+} lisa_tensor;
+
+
+// a contiguous tensor with an uninitialized, aligned buffer
+lisa_tensor *lisa_tensor_new(int64_t rank, const int64_t *shape);
+// a contiguous tensor of the same shape as t
+lisa_tensor *lisa_tensor_new_like(const lisa_tensor *t);
+// a contiguous tensor with every element set to value
+lisa_tensor *lisa_tensor_full(int64_t rank, const int64_t *shape, double value);
+// the shape of t as a tensor of rank 1
+lisa_tensor *lisa_tensor_shape(const lisa_tensor *t);
+// t itself if it is contiguous, a packed copy otherwise
+lisa_tensor *lisa_tensor_contiguous(lisa_tensor *t);
+// add a reference to an owned tensor, every reference is dropped with
+// lisa_tensor_free, both do nothing for views
+void lisa_tensor_retain(lisa_tensor *t);
+void lisa_tensor_free(lisa_tensor *t);
+int lisa_tensor_is_contiguous(const lisa_tensor *t);
+
+// matrix product of two rank 2 tensors, strided operands are fine
+// runs on up to LISA_NUM_THREADS threads (default every CPU) with the
+// widest SIMD kernel the CPU supports, LISA_MATMUL_KERNEL=avx2 or generic
+// picks a narrower one
+lisa_tensor *lisa_tensor_matmul(const lisa_tensor *a, const lisa_tensor *b);
+// name of the kernel lisa_tensor_matmul runs
+const char *lisa_matmul_kernel(void);
+
+// y[i] = f(x[i]) for n doubles, x and y may be the same array
+// the math.* functions of compiled code use the same vector kernels, with
+// the widest SIMD variant the CPU supports, LISA_VMATH_KERNEL=avx2 or
+// generic picks a narrower one, error bounds are in docs/tensors.md
+void lisa_vmath_exp(const double *x, double *y, int64_t n);
+void lisa_vmath_log(const double *x, double *y, int64_t n);
+void lisa_vmath_sin(const double *x, double *y, int64_t n);
+void lisa_vmath_cos(const double *x, double *y, int64_t n);
+void lisa_vmath_tanh(const double *x, double *y, int64_t n);
+void lisa_vmath_sigmoid(const double *x, double *y, int64_t n);
+void lisa_vmath_erf(const double *x, double *y, int64_t n);
+// name of the kernel the lisa_vmath_* functions run
+const char *lisa_vmath_kernel(void);
+
+// tensors in files, a failure prints a message and aborts
+// .npy files of doubles and raw files are memory-mapped, nothing is
+// copied, pages are read when first touched and stores into the tensor
+// stay in memory, other .npy element types are converted
+lisa_tensor *lisa_tensor_load_npy(const char *path);
+// little-endian doubles in row-major order, one dimension may be -1 and
+// is then taken from the size of the file
+lisa_tensor *lisa_tensor_load_raw(const char *path, int64_t rank, const int64_t *shape);
+// write t as a .npy file of doubles, returns the number of elements
+int64_t lisa_tensor_save_npy(const lisa_tensor *t, const char *path);
+// append the rows of t (its first dimension) to a .npy file, the first
+// append of the program creates the file and the next ones must have the
+// same row shape, the header is updated every time so the file is always
+// complete, returns the rows in the file
+int64_t lisa_tensor_append_npy(const lisa_tensor *t, const char *path);
+// stop appending to path, the next append starts a new file
+void lisa_tensor_close_npy(const char *path);
+// a CSV file of numbers as a tensor of shape [columns, rows], so every
+// column of the file is contiguous, a first line with text in it is a header and is
+// skipped, empty or unreadable fields are NaN, the file is parsed on up to
+// LISA_NUM_THREADS threads
+lisa_tensor *lisa_tensor_load_csv(const char *path);
+// the next batch of up to rows rows of a CSV file, in the same layout, the
+// first call opens the file and each one goes on where the last stopped,
+// the batch after the last row has no rows, and the next call after it
+// starts over
+lisa_tensor *lisa_tensor_read_csv(const char *path, int64_t rows);
+// stop reading path, the next batch is the first one again
+void lisa_tensor_close_csv(const char *path);
+
+// every call of a Lisa function that uses tensors is a scope, the scope
+// holds a reference to each tensor made during the call and variables
+// hold one to their values, both are dropped when it returns, except for
+// the returned tensor, whose reference moves to the scope of the caller,
+// or to the C caller who then frees it with lisa_tensor_free
+// codegen emits these around the body, enter returns the mark to pass to
+// exit, keep is the returned tensor or NULL
+int64_t lisa_arena_enter(void);
+void lisa_arena_exit(int64_t mark, lisa_tensor *keep);
+// a variable takes over the reference of its new value t
+void lisa_tensor_adopt(lisa_tensor *t);
+// t if nothing else refers to it, so it can be overwritten in place,
+// otherwise a new copy (copy on write)
+lisa_tensor *lisa_tensor_unique(lisa_tensor *t);
+
+// counters of the tensor allocator, LISA_ALLOC_STATS=1 prints them to
+// stderr at exit
+typedef struct lisa_alloc_stats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t pool_hits;             // allocations served by a freed block
+    uint64_t system_allocations;    // allocations that went to malloc
+    uint64_t arena_releases;        // frees at function exit
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} lisa_alloc_stats;
+
+void lisa_alloc_stats_get(lisa_alloc_stats *stats);
+void lisa_alloc_stats_print(void);
+
+// checks emitted by codegen, they print a message and abort on failure
+void lisa_tensor_check_shapes(const lisa_tensor *a, const lisa_tensor *b);
+void lisa_tensor_index_error(const lisa_tensor *t, int64_t dim, int64_t index);
+void lisa_tensor_rank_error(const lisa_tensor *t, int64_t indices);
+
+
+// wrap an existing contiguous row-major buffer, nothing is copied and the
+// buffer stays owned by the caller, pass &view to a Lisa function
+static inline lisa_tensor lisa_tensor_view(double *data, int64_t rank,
+                                           const int64_t *shape) {
+    lisa_tensor t;
+    int64_t stride = 1;
+    t.data = data;
+    t.rank = rank;
+    t.flags = 0;
+    t.refs = 0;
+    for (int64_t k = LISA_MAX_RANK - 1; k >= 0; k--) {
+        t.shape[k] = k < rank ? shape[k] : 1;
+        t.strides[k] = k < rank ? stride : 0;
+        if (k < rank)
+            stride *= shape[k];
+    }
+    t.size = stride;
+    return t;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
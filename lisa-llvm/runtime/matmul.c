@@ -0,0 +1,309 @@
+/**
+ * @file matmul.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// matrix product in the GotoBLAS layout
+// b is packed in KC x NC panels that stay in L2, a in MC x KC blocks that
+// stay in L1/L2, both split into the MR rows and NR columns the
+// micro-kernel reads contiguously, the micro-kernel keeps an MR x NR tile
+// of c in registers for the whole KC loop
+#define KC 256
+#define MC 96       // a multiple of every MR
+#define NC 512      // a multiple of every NR
+#define MAX_MR 12
+#define MAX_NR 16
+
+// c[MR x NR] += a[MR x kc] * b[kc x NR], a and b packed, c row major
+typedef void (*micro_kernel)(int64_t kc, const double *a, const double *b,
+                             double *c, int64_t ldc);
+
+struct kernel {
+    const char *name;
+    int mr, nr;
+    micro_kernel run;
+};
+
+
+static void kernel_generic(int64_t kc, const double *a, const double *b,
+                           double *c, int64_t ldc) {
+    double acc[4][4] = {{0}};
+    for (int64_t p = 0; p < kc; p++, a += 4, b += 4)
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                acc[i][j] += a[i] * b[j];
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            c[i * ldc + j] += acc[i][j];
+}
+
+
+#if defined(__x86_64__)
+// 6 x 8 tile in 12 ymm accumulators
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(int64_t kc, const double *a, const double *b,
+                        double *c, int64_t ldc) {
+    __m256d acc[6][2];
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++)
+        acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+    for (int64_t p = 0; p < kc; p++, a += 6, b += 8) {
+        __m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+#pragma GCC unroll 6
+        for (int i = 0; i < 6; i++) {
+            __m256d ai = _mm256_broadcast_sd(a + i);
+            acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+        }
+    }
+#pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        double *row = c + i * ldc;
+        _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+        _mm256_storeu_pd(row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+    }
+}
+
+
+// 12 x 16 tile in 24 zmm accumulators
+__attribute__((target("avx512f")))
+static void kernel_avx512(int64_t kc, const double *a, const double *b,
+                          double *c, int64_t ldc) {
+    __m512d acc[12][2];
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++)
+        acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+    for (int64_t p = 0; p < kc; p++, a += 12, b += 16) {
+        __m512d b0 = _mm512_load_pd(b), b1 = _mm512_load_pd(b + 8);
+#pragma GCC unroll 12
+        for (int i = 0; i < 12; i++) {
+            __m512d ai = _mm512_set1_pd(a[i]);
+            acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+        }
+    }
+#pragma GCC unroll 12
+    for (int i = 0; i < 12; i++) {
+        double *row = c + i * ldc;
+        _mm512_storeu_pd(row, _mm512_add_pd(_mm512_loadu_pd(row), acc[i][0]));
+        _mm512_storeu_pd(row + 8, _mm512_add_pd(_mm512_loadu_pd(row + 8), acc[i][1]));
+    }
+}
+#endif
+
+
+static const struct kernel kernels[] = {
+#if defined(__x86_64__)
+    {"avx512", 12, 16, kernel_avx512},
+    {"avx2", 6, 8, kernel_avx2},
+#endif
+    {"generic", 4, 4, kernel_generic},
+};
+
+
+static int supported(const struct kernel *k) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (k->run == kernel_avx512)
+        return __builtin_cpu_supports("avx512f");
+    if (k->run == kernel_avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return 1;
+}
+
+
+// the widest kernel the CPU runs, LISA_MATMUL_KERNEL can ask for a
+// narrower one by name
+static const struct kernel *select_kernel(void) {
+    static const struct kernel *selected;
+    if (selected)
+        return selected;
+    const struct kernel *k = NULL;
+    const char *name = getenv("LISA_MATMUL_KERNEL");
+    size_t count = sizeof(kernels) / sizeof(kernels[0]);
+    for (size_t i = 0; name && i < count; i++)
+        if (strcmp(kernels[i].name, name) == 0 && supported(&kernels[i]))
+            k = &kernels[i];
+    for (size_t i = 0; !k && i < count; i++)
+        if (supported(&kernels[i]))
+            k = &kernels[i];
+    return selected = k;
+}
+
+
+// a strided matrix, element (i, j) is at data[i * rs + j * cs]
+struct matrix {
+    const double *data;
+    int64_t rs, cs;
+};
+
+
+// rows [0, mc) of a, in panels of mr rows, each stored column by column
+static void pack_a(const struct kernel *k, struct matrix a, int64_t mc,
+                   int64_t kc, double *ap) {
+    for (int64_t ir = 0; ir < mc; ir += k->mr)
+        for (int64_t p = 0; p < kc; p++)
+            for (int i = 0; i < k->mr; i++)
+                *ap++ = ir + i < mc ? a.data[(ir + i) * a.rs + p * a.cs] : 0;
+}
+
+
+// columns [0, nc) of b, in panels of nr columns, each stored row by row
+static void pack_b(const struct kernel *k, struct matrix b, int64_t kc,
+                   int64_t nc, double *bp) {
+    for (int64_t jr = 0; jr < nc; jr += k->nr)
+        for (int64_t p = 0; p < kc; p++)
+            for (int j = 0; j < k->nr; j++)
+                *bp++ = jr + j < nc ? b.data[p * b.rs + (jr + j) * b.cs] : 0;
+}
+
+
+// one output block, c[m x n] += a[m x k] * b[k x n]
+struct block {
+    const struct kernel *kernel;
+    struct matrix a, b;
+    double *c;
+    int64_t ldc, m, n, k;
+};
+
+
+static void *gemm_block(void *arg) {
+    const struct block *blk = arg;
+    const struct kernel *k = blk->kernel;
+    double *ap = aligned_alloc(LISA_ALIGNMENT, sizeof(double) * MC * KC);
+    double *bp = aligned_alloc(LISA_ALIGNMENT, sizeof(double) * KC * NC);
+    if (!ap || !bp)
+        lisa_runtime_error("out of memory");
+    double edge[MAX_MR * MAX_NR];
+
+    for (int64_t jc = 0; jc < blk->n; jc += NC) {
+        int64_t nc = blk->n - jc < NC ? blk->n - jc : NC;
+        for (int64_t pc = 0; pc < blk->k; pc += KC) {
+            int64_t kc = blk->k - pc < KC ? blk->k - pc : KC;
+            struct matrix b = blk->b;
+            b.data += pc * b.rs + jc * b.cs;
+            pack_b(k, b, kc, nc, bp);
+            for (int64_t ic = 0; ic < blk->m; ic += MC) {
+                int64_t mc = blk->m - ic < MC ? blk->m - ic : MC;
+                struct matrix a = blk->a;
+                a.data += ic * a.rs + pc * a.cs;
+                pack_a(k, a, mc, kc, ap);
+                for (int64_t jr = 0; jr < nc; jr += k->nr) {
+                    for (int64_t ir = 0; ir < mc; ir += k->mr) {
+                        const double *at = ap + ir * kc, *bt = bp + jr * kc;
+                        double *c = blk->c + (ic + ir) * blk->ldc + jc + jr;
+                        int64_t rows = mc - ir < k->mr ? mc - ir : k->mr;
+                        int64_t cols = nc - jr < k->nr ? nc - jr : k->nr;
+                        if (rows == k->mr && cols == k->nr) {
+                            k->run(kc, at, bt, c, blk->ldc);
+                            continue;
+                        }
+                        // partial tiles go through a full one on the stack
+                        memset(edge, 0, sizeof(edge));
+                        k->run(kc, at, bt, edge, k->nr);
+                        for (int64_t i = 0; i < rows; i++)
+                            for (int64_t j = 0; j < cols; j++)
+                                c[i * blk->ldc + j] += edge[i * k->nr + j];
+                    }
+                }
+            }
+        }
+    }
+    free(ap);
+    free(bp);
+    return NULL;
+}
+
+
+int64_t lisa_max_threads(void) {
+    const char *env = getenv("LISA_NUM_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > 64 ? 64 : n;
+}
+
+
+lisa_tensor *lisa_tensor_matmul(const lisa_tensor *a, const lisa_tensor *b) {
+    if (a->rank != 2 || b->rank != 2 || a->shape[1] != b->shape[0]) {
+        char msg[256];
+        int len = snprintf(msg, sizeof(msg), "cannot multiply matrices of shape ");
+        len += lisa_format_shape(msg + len, sizeof(msg) - len, a);
+        len += snprintf(msg + len, sizeof(msg) - len, " and ");
+        lisa_format_shape(msg + len, sizeof(msg) - len, b);
+        lisa_runtime_error(msg);
+    }
+    int64_t m = a->shape[0], n = b->shape[1], k = a->shape[1];
+    int64_t shape[2] = {m, n};
+    lisa_tensor *c = lisa_tensor_full(2, shape, 0.0);
+    if (m == 0 || n == 0 || k == 0)
+        return c;
+
+    struct block whole = {select_kernel(),
+                          {a->data, a->strides[0], a->strides[1]},
+                          {b->data, b->strides[0], b->strides[1]},
+                          c->data, n, m, n, k};
+    // the output is split into bands along its longer side, one thread
+    // per band, each band needs about a million multiply-adds to pay for
+    // its thread and its own packed copy of the other operand
+    int split_rows = m >= n;
+    int64_t unit = split_rows ? whole.kernel->mr : whole.kernel->nr;
+    int64_t units = ((split_rows ? m : n) + unit - 1) / unit;
+    int64_t threads = m * n * k / (1 << 20);
+    if (threads > units)
+        threads = units;
+    if (threads > lisa_max_threads())
+        threads = lisa_max_threads();
+    if (threads <= 1) {
+        gemm_block(&whole);
+        return c;
+    }
+
+    struct block blocks[64];
+    pthread_t ids[64];
+    int started[64];
+    int64_t per = (units + threads - 1) / threads * unit;
+    int64_t count = 0;
+    for (int64_t start = 0; start < (split_rows ? m : n); start += per, count++) {
+        struct block *blk = &blocks[count];
+        *blk = whole;
+        if (split_rows) {
+            blk->a.data += start * a->strides[0];
+            blk->c += start * n;
+            blk->m = m - start < per ? m - start : per;
+        }
+        else {
+            blk->b.data += start * b->strides[1];
+            blk->c += start;
+            blk->n = n - start < per ? n - start : per;
+        }
+        // the first band runs on this thread
+        started[count] = count > 0 && pthread_create(&ids[count], NULL, gemm_block, blk) == 0;
+    }
+    for (int64_t t = 0; t < count; t++)
+        if (!started[t])
+            gemm_block(&blocks[t]);
+    for (int64_t t = 0; t < count; t++)
+        if (started[t])
+            pthread_join(ids[t], NULL);
+    return c;
+}
+
+
+const char *lisa_matmul_kernel(void) {
+    return select_kernel()->name;
+}
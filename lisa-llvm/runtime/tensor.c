@@ -0,0 +1,206 @@
+/**
+ * @file tensor.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// the descriptor is padded to whole cache lines and the buffer follows it
+// in the same allocation, so a tensor costs a single block from the pool
+#define HEADER_SIZE \
+    ((sizeof(lisa_tensor) + LISA_ALIGNMENT - 1) / LISA_ALIGNMENT * LISA_ALIGNMENT)
+
+
+static size_t block_size(int64_t size) {
+    return HEADER_SIZE + (size * sizeof(double) + LISA_ALIGNMENT - 1) /
+        LISA_ALIGNMENT * LISA_ALIGNMENT;
+}
+
+
+void lisa_runtime_error(const char *msg) {
+    fprintf(stderr, "\033[1;31mLisa Runtime Error:\033[0m %s\n", msg);
+    abort();
+}
+
+
+lisa_tensor *lisa_tensor_new(int64_t rank, const int64_t *shape) {
+    if (rank < 0 || rank > LISA_MAX_RANK)
+        lisa_runtime_error("tensor rank out of range");
+    int64_t size = 1;
+    for (int64_t k = 0; k < rank; k++) {
+        if (shape[k] < 0)
+            lisa_runtime_error("negative tensor dimension");
+        size *= shape[k];
+    }
+    int cls;
+    lisa_tensor *t = lisa_pool_alloc(block_size(size), &cls);
+    if (!t)
+        lisa_runtime_error("out of memory");
+    *t = lisa_tensor_view((double *)((char *)t + HEADER_SIZE), rank, shape);
+    t->flags = LISA_TENSOR_OWNED | (int64_t)(cls + 1) << LISA_TENSOR_CLASS_SHIFT;
+    t->refs = 1;
+    lisa_arena_track(t);
+    return t;
+}
+
+
+lisa_tensor *lisa_tensor_new_like(const lisa_tensor *t) {
+    return lisa_tensor_new(t->rank, t->shape);
+}
+
+
+lisa_tensor *lisa_tensor_full(int64_t rank, const int64_t *shape, double value) {
+    lisa_tensor *t = lisa_tensor_new(rank, shape);
+    for (int64_t i = 0; i < t->size; i++)
+        t->data[i] = value;
+    return t;
+}
+
+
+lisa_tensor *lisa_tensor_shape(const lisa_tensor *t) {
+    lisa_tensor *shape = lisa_tensor_new(1, &t->rank);
+    for (int64_t k = 0; k < t->rank; k++)
+        shape->data[k] = (double)t->shape[k];
+    return shape;
+}
+
+
+int lisa_tensor_is_contiguous(const lisa_tensor *t) {
+    int64_t stride = 1;
+    for (int64_t k = t->rank - 1; k >= 0; k--) {
+        if (t->shape[k] != 1 && t->strides[k] != stride)
+            return 0;
+        stride *= t->shape[k];
+    }
+    return 1;
+}
+
+
+// a new contiguous tensor with the elements of t
+static lisa_tensor *copy(const lisa_tensor *t) {
+    lisa_tensor *packed = lisa_tensor_new_like(t);
+    if (lisa_tensor_is_contiguous(t)) {
+        memcpy(packed->data, t->data, t->size * sizeof(double));
+        return packed;
+    }
+    int64_t index[LISA_MAX_RANK] = {0};
+    for (int64_t i = 0; i < packed->size; i++) {
+        int64_t offset = 0;
+        for (int64_t k = 0; k < t->rank; k++)
+            offset += index[k] * t->strides[k];
+        packed->data[i] = t->data[offset];
+        // advance the multi-index, last dimension fastest
+        for (int64_t k = t->rank - 1; k >= 0 && ++index[k] == t->shape[k]; k--)
+            index[k] = 0;
+    }
+    return packed;
+}
+
+
+lisa_tensor *lisa_tensor_contiguous(lisa_tensor *t) {
+    return lisa_tensor_is_contiguous(t) ? t : copy(t);
+}
+
+
+static void destroy(lisa_tensor *t) {
+    if (t->flags & LISA_TENSOR_MAPPED) {
+        lisa_tensor_unmap(t);
+        return;
+    }
+    lisa_pool_free(t, block_size(t->size), (int)(t->flags >> LISA_TENSOR_CLASS_SHIFT) - 1);
+}
+
+
+// the count is atomic so threads can share an input tensor
+static int64_t drop(lisa_tensor *t) {
+    return __atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+
+void lisa_tensor_retain(lisa_tensor *t) {
+    if (t && (t->flags & LISA_TENSOR_OWNED))
+        __atomic_add_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+}
+
+
+int lisa_tensor_unref(lisa_tensor *t) {
+    if (!t || !(t->flags & LISA_TENSOR_OWNED) || drop(t) > 0)
+        return 0;
+    destroy(t);
+    return 1;
+}
+
+
+void lisa_tensor_free(lisa_tensor *t) {
+    if (!t || !(t->flags & LISA_TENSOR_OWNED) || drop(t) > 0)
+        return;
+    // made and freed by C while a Lisa function runs, its scope must not
+    // free it again
+    if (t->flags & LISA_TENSOR_TRACKED)
+        lisa_arena_forget(t);
+    destroy(t);
+}
+
+
+void lisa_tensor_adopt(lisa_tensor *t) {
+    if (!t || !(t->flags & LISA_TENSOR_OWNED))
+        return;
+    if (!(t->flags & LISA_TENSOR_TRACKED) || !lisa_arena_forget(t))
+        lisa_tensor_retain(t);
+}
+
+
+// codegen writes the result into it as a contiguous buffer, so a strided
+// tensor loaded from a column-major file is copied as well
+lisa_tensor *lisa_tensor_unique(lisa_tensor *t) {
+    if ((t->flags & LISA_TENSOR_OWNED) && __atomic_load_n(&t->refs, __ATOMIC_ACQUIRE) == 1 &&
+        lisa_tensor_is_contiguous(t))
+        return t;
+    return copy(t);
+}
+
+
+int lisa_format_shape(char *buf, size_t size, const lisa_tensor *t) {
+    int len = snprintf(buf, size, "[");
+    for (int64_t k = 0; k < t->rank; k++)
+        len += snprintf(buf + len, size - len, k ? ", %lld" : "%lld",
+                        (long long)t->shape[k]);
+    return len + snprintf(buf + len, size - len, "]");
+}
+
+
+void lisa_tensor_check_shapes(const lisa_tensor *a, const lisa_tensor *b) {
+    if (a->rank == b->rank &&
+        memcmp(a->shape, b->shape, a->rank * sizeof(int64_t)) == 0)
+        return;
+    char msg[256];
+    int len = snprintf(msg, sizeof(msg), "tensor shapes do not match: ");
+    len += lisa_format_shape(msg + len, sizeof(msg) - len, a);
+    len += snprintf(msg + len, sizeof(msg) - len, " and ");
+    lisa_format_shape(msg + len, sizeof(msg) - len, b);
+    lisa_runtime_error(msg);
+}
+
+
+void lisa_tensor_index_error(const lisa_tensor *t, int64_t dim, int64_t index) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "index %lld out of range for dimension %lld of size %lld",
+             (long long)index, (long long)dim, (long long)t->shape[dim]);
+    lisa_runtime_error(msg);
+}
+
+
+void lisa_tensor_rank_error(const lisa_tensor *t, int64_t indices) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%lld indices for a tensor of rank %lld",
+             (long long)indices, (long long)t->rank);
+    lisa_runtime_error(msg);
+}
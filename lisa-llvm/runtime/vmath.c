@@ -0,0 +1,228 @@
+/**
+ * @file vmath.c
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// exp, log, sin, cos, tanh, sigmoid and erf on vectors of 2 (SSE2, or
+// whatever the target has), 4 (AVX2 with FMA) and 8 (AVX-512) doubles,
+// written once with vector extensions in vmath_kernels.h and compiled per
+// width
+// compiled code calls lisa_v<name>_d<width> from vectorized loops, C calls
+// lisa_vmath_<name> on arrays, which dispatches on the CPU like matmul
+
+#define VM_PASTE_(a, b) a##b
+#define VM_PASTE(a, b) VM_PASTE_(a, b)
+
+typedef double vd2 __attribute__((vector_size(16)));
+typedef int64_t vi2 __attribute__((vector_size(16)));
+typedef uint64_t vu2 __attribute__((vector_size(16)));
+typedef double vd4 __attribute__((vector_size(32)));
+typedef int64_t vi4 __attribute__((vector_size(32)));
+typedef uint64_t vu4 __attribute__((vector_size(32)));
+typedef double vd8 __attribute__((vector_size(64)));
+typedef int64_t vi8 __attribute__((vector_size(64)));
+typedef uint64_t vu8 __attribute__((vector_size(64)));
+
+enum {
+    VMATH_EXP,
+    VMATH_LOG,
+    VMATH_SIN,
+    VMATH_COS,
+    VMATH_TANH,
+    VMATH_SIGMOID,
+    VMATH_ERF,
+    VMATH_FUNCTIONS
+};
+
+typedef void (*vmath_fn)(const double *x, double *y, int64_t n);
+
+
+#define SIGN_BIT INT64_MIN
+// adding 1.5 * 2^52 rounds to an integer, which is then in the low bits
+#define ROUND_SHIFT 0x1.8p52
+#define ROUND_SHIFT_BITS 0x4338000000000000
+#define LOG2E 1.44269504088896338700e+00
+#define SQRT2 1.41421356237309514547e+00
+#define TWO_OVER_PI 6.36619772367581382433e-01
+// ln2 and pi/2 in parts of 33 bits, so n times a part is exact (fdlibm)
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_3 2.02226624871116645580e-21
+#define PIO2_3T 8.47842766036889956997e-32
+// n stays below 2^20, where the parts above are exact
+#define SINCOS_LIMIT 0x1p20
+
+// 2^(j/32), rounded, and the rest
+static const double expTable[32] = {
+    1.0, 1.0218971486541166, 1.0442737824274138, 1.0671404006768237,
+    1.0905077326652577, 1.1143867425958924, 1.1387886347566916,
+    1.1637248587775775, 1.189207115002721, 1.215247359980469, 1.241857812073484,
+    1.2690509571917332, 1.2968395546510096, 1.3252366431597413,
+    1.3542555469368927, 1.383909881963832, 1.4142135623730951,
+    1.4451808069770467, 1.4768261459394993, 1.5091644275934228,
+    1.5422108254079407, 1.5759808451078865, 1.6104903319492543,
+    1.645755478153965, 1.681792830507429, 1.718619298122478, 1.7562521603732995,
+    1.7947090750031072, 1.8340080864093424, 1.8741676341103, 1.9152065613971474,
+    1.9571441241754002,
+};
+
+static const double expTableLo[32] = {
+    0.0, 5.109225028973444e-17, 8.551889705537965e-17, -7.899853966841582e-17,
+    -3.046782079812471e-17, 1.0410278456845571e-16, 8.912812676025408e-17,
+    3.8292048369240935e-17, 3.982015231465646e-17, -7.712630692681488e-17,
+    4.658027591836937e-17, 2.667932131342186e-18, 2.5382502794888315e-17,
+    -2.8587312100388614e-17, 7.70094837980299e-17, -6.770511658794786e-17,
+    -9.667293313452913e-17, -3.0237581349939873e-17, -3.483994556892796e-17,
+    -1.016455327754295e-16, 7.949834809697621e-17, -1.0136916471278304e-17,
+    2.4707192569797888e-17, -1.0125679913674773e-16, 8.199010020581497e-17,
+    -1.851380418263111e-17, 2.960140695448873e-17, 1.8227458427912087e-17,
+    3.283107224245627e-17, -6.122763413004143e-17, -1.0619946056195963e-16,
+    8.960767791036668e-17,
+};
+
+// erf, fitted with mpmath, erfSmall in x^2 on [0, 1.5), erfMid in
+// x - 2.25 on [1.5, 3) and erfLarge in x - 4.475 on [3, 5.95], lowest
+// degree first
+#define ERF_DEGREE 15
+#define ERF_MID 2.25
+#define ERF_LARGE 4.475
+
+static const double erfSmall[ERF_DEGREE + 1] = {
+    1.1283791670955126, -0.3761263890318375, 0.11283791670955019,
+    -0.026866170645115376, 0.005223977625317255, -0.0008548327017499108,
+    0.00012055332795419675, -1.4925646319299433e-05, 1.6462051744758016e-06,
+    -1.6365135951628023e-07, 1.4801276360093684e-08, -1.2254075631992835e-09,
+    9.257929022544438e-11, -6.1758411722331915e-12, 3.2537896660097213e-13,
+    -9.854893631973009e-15,
+};
+
+static const double erfMid[ERF_DEGREE + 1] = {
+    0.23108725873039168, -0.08848650280874912, 0.03199262741074777,
+    -0.01100206075644965, 0.0036189953528101663, -0.0011437284832955758,
+    0.0003485354440100915, -0.00010272108624013288, 2.935309454538099e-05,
+    -8.150247876442747e-06, 2.2035979177662704e-06, -5.807667178566903e-07,
+    1.4823625176600436e-07, -3.732438132577977e-08, 1.0540535620333677e-08,
+    -2.5315810338866077e-09,
+};
+
+static const double erfLarge[ERF_DEGREE + 1] = {
+    0.12313860303886702, -0.0262886698975987, 0.005496805247463857,
+    -0.0011269776112336068, 0.00022679021518671875, -4.483655270034925e-05,
+    8.715559887687686e-06, -1.6669957365818209e-06, 3.1391563752679435e-07,
+    -5.824574860962251e-08, 1.0675670884807824e-08, -1.9256413809049248e-09,
+    3.3081884599608187e-10, -5.824082347937884e-11, 1.3501673165855975e-11,
+    -2.301841702607895e-12,
+};
+
+
+#define VM_WIDTH 2
+#define VM_TARGET
+#include "vmath_kernels.h"
+
+#if defined(__x86_64__)
+#define VM_WIDTH 4
+#define VM_TARGET __attribute__((target("avx2,fma")))
+#include "vmath_kernels.h"
+
+#define VM_WIDTH 8
+#define VM_TARGET __attribute__((target("avx512f")))
+#include "vmath_kernels.h"
+#endif
+
+
+struct vmath_kernel {
+    const char *name;
+    const vmath_fn *arrays;
+};
+
+
+static const struct vmath_kernel kernels[] = {
+#if defined(__x86_64__)
+    {"avx512", arrays_d8},
+    {"avx2", arrays_d4},
+#endif
+    {"generic", arrays_d2},
+};
+
+
+static int supported(const struct vmath_kernel *k) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (k->arrays == arrays_d8)
+        return __builtin_cpu_supports("avx512f");
+    if (k->arrays == arrays_d4)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return 1;
+}
+
+
+// the widest kernel the CPU runs, LISA_VMATH_KERNEL can ask for a
+// narrower one by name
+static const struct vmath_kernel *select_kernel(void) {
+    static const struct vmath_kernel *selected;
+    if (selected)
+        return selected;
+    const struct vmath_kernel *k = NULL;
+    const char *name = getenv("LISA_VMATH_KERNEL");
+    size_t count = sizeof(kernels) / sizeof(kernels[0]);
+    for (size_t i = 0; name && i < count; i++)
+        if (strcmp(kernels[i].name, name) == 0 && supported(&kernels[i]))
+            k = &kernels[i];
+    for (size_t i = 0; !k && i < count; i++)
+        if (supported(&kernels[i]))
+            k = &kernels[i];
+    return selected = k;
+}
+
+
+const char *lisa_vmath_kernel(void) {
+    return select_kernel()->name;
+}
+
+
+void lisa_vmath_exp(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_EXP](x, y, n);
+}
+
+
+void lisa_vmath_log(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_LOG](x, y, n);
+}
+
+
+void lisa_vmath_sin(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_SIN](x, y, n);
+}
+
+
+void lisa_vmath_cos(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_COS](x, y, n);
+}
+
+
+void lisa_vmath_tanh(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_TANH](x, y, n);
+}
+
+
+void lisa_vmath_sigmoid(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_SIGMOID](x, y, n);
+}
+
+
+void lisa_vmath_erf(const double *x, double *y, int64_t n) {
+    select_kernel()->arrays[VMATH_ERF](x, y, n);
+}
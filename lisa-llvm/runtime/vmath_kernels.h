@@ -0,0 +1,296 @@
+/**
+ * @file vmath_kernels.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// the vector math kernels, included by vmath.c once per vector width with
+//   VM_WIDTH   doubles per vector, 2, 4 or 8
+//   VM_TARGET  the target attribute of the width, every function has it
+//              so the kernels inline into each other
+// so there is no include guard
+
+#define VD VM_PASTE(vd, VM_WIDTH)
+#define VI VM_PASTE(vi, VM_WIDTH)
+#define VU VM_PASTE(vu, VM_WIDTH)
+#define KERNEL(name) VM_PASTE(name##_d, VM_WIDTH)
+#define INLINE VM_TARGET static inline __attribute__((always_inline))
+#define SPLAT(c) ((VD){0} + (c))
+
+
+INLINE VD KERNEL(select)(VI mask, VD a, VD b) {
+    return (VD)((mask & (VI)a) | (~mask & (VI)b));
+}
+
+
+INLINE VD KERNEL(abs)(VD x) {
+    return (VD)((VI)x & ~SIGN_BIT);
+}
+
+
+// the magnitude of y with the sign of x
+INLINE VD KERNEL(copysign)(VD y, VD x) {
+    return (VD)(((VI)y & ~SIGN_BIT) | ((VI)x & SIGN_BIT));
+}
+
+
+// 2^k for k in [-1022, 1023]
+INLINE VD KERNEL(pow2)(VI k) {
+    return (VD)((k + 1023) << 52);
+}
+
+
+// x rounded to the nearest integer, as a double and in k, for |x| < 2^51
+INLINE VD KERNEL(round)(VD x, VI *k) {
+    VD t = x + ROUND_SHIFT;
+    *k = (VI)t - ROUND_SHIFT_BITS;
+    return t - ROUND_SHIFT;
+}
+
+
+// e^r - 1 for |r| <= ln2 / 2, Taylor to degree 13, exact near 0
+INLINE VD KERNEL(expm1_poly)(VD r) {
+    VD p = SPLAT(1.0 / 6227020800);
+    p = p * r + 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    return r + r * r * p;
+}
+
+
+// e^x = 2^n e^r
+// on SSE2 n counts 32nds, 2^(j/32) comes from a table in two parts, so
+// |r| <= ln2/64 and degree 6 do, 2^(n - j/32) goes straight into the
+// exponent bits and lanes beyond 708 (subnormal or infinite results, NaN)
+// go to libm
+// with FMA the Taylor polynomial of degree 13 is faster than the table,
+// 2^n is applied in two halves so subnormal results and the overflow
+// threshold come out right
+INLINE VD KERNEL(exp)(VD x) {
+    VI k;
+#if VM_WIDTH == 2
+    VD n = KERNEL(round)(x * (32 * LOG2E), &k);
+    VD r = x - n * (LN2_HI / 32) - n * (LN2_LO / 32);
+    VD p = SPLAT(1.0 / 720);
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = r + r * r * p;
+    VD t, tlo;
+    for (int i = 0; i < VM_WIDTH; i++) {
+        t[i] = expTable[k[i] & 31];
+        tlo[i] = expTableLo[k[i] & 31];
+    }
+    VD y = t + (t * p + tlo);
+    y *= (VD)(((k + 1023 * 32) & ~31) << 47);
+    VI far = ~(KERNEL(abs)(x) <= 708.0);
+    for (int i = 0; i < VM_WIDTH; i++)
+        if (far[i])
+            y[i] = exp(x[i]);
+    return y;
+#else
+    x = KERNEL(select)(x > 710.0, SPLAT(710.0), x);
+    x = KERNEL(select)(x < -746.0, SPLAT(-746.0), x);
+    VD n = KERNEL(round)(x * LOG2E, &k);
+    VD r = x - n * LN2_HI - n * LN2_LO;
+    VD y = 1.0 + KERNEL(expm1_poly)(r);
+    VI k1 = (VI)((VU)(k + 2048) >> 1) - 1024;     // k >> 1, AVX2 has no vpsraq
+    return y * KERNEL(pow2)(k1) * KERNEL(pow2)(k - k1);
+#endif
+}
+
+
+// e^x - 1 for x <= 0, exact near 0, -1 below -40
+INLINE VD KERNEL(expm1_neg)(VD x) {
+    x = KERNEL(select)(x < -40.0, SPLAT(-40.0), x);
+    VI k;
+    VD n = KERNEL(round)(x * LOG2E, &k);
+    VD r = x - n * LN2_HI - n * LN2_LO;
+    VD s = KERNEL(pow2)(k);
+    return s * KERNEL(expm1_poly)(r) + (s - 1.0);
+}
+
+
+// fdlibm's log, x = 2^k m with m in [sqrt(2)/2, sqrt(2)), f = m - 1 and
+// log(1 + f) = f - f^2/2 + s (f^2/2 + R(s^2)) with s = f / (2 + f)
+INLINE VD KERNEL(log)(VD x) {
+    VI tiny = x < 0x1p-1022;
+    VD xs = KERNEL(select)(tiny, x * 0x1p54, x);
+    VI bits = (VI)xs;
+    VI k = (VI)((VU)bits >> 52) - 1023 - (tiny & 54);
+    VD m = (VD)((bits & 0x000fffffffffffff) | 0x3ff0000000000000);
+    VI big = m > SQRT2;
+    m = KERNEL(select)(big, m * 0.5, m);
+    k -= big;   // true is -1
+    VD dk = (VD)(k + ROUND_SHIFT_BITS) - ROUND_SHIFT;
+    VD f = m - 1.0;
+    VD s = f / (2.0 + f);
+    VD z = s * s;
+    VD R = SPLAT(1.479819860511658591e-01);
+    R = R * z + 1.531383769920937332e-01;
+    R = R * z + 1.818357216161805012e-01;
+    R = R * z + 2.222219843214978396e-01;
+    R = R * z + 2.857142874366239149e-01;
+    R = R * z + 3.999999999940941908e-01;
+    R = R * z + 6.666666666666735130e-01;
+    R = R * z;
+    VD hfsq = 0.5 * f * f;
+    VD y = dk * LN2_HI - ((hfsq - (s * (hfsq + R) + dk * LN2_LO)) - f);
+    y = KERNEL(select)(x < INFINITY, y, x + x);     // inf and NaN
+    y = KERNEL(select)(x < 0.0, SPLAT(NAN), y);
+    return KERNEL(select)(x == 0.0, SPLAT(-INFINITY), y);
+}
+
+
+// sin(x + q pi/2), r reduced by fdlibm's three part pi/2, lanes beyond
+// SINCOS_LIMIT (and inf and NaN) go to libm
+INLINE VD KERNEL(sincos)(VD x, int64_t q0, double (*scalar)(double)) {
+    VI k;
+    VD n = KERNEL(round)(x * TWO_OVER_PI, &k);
+    VD r = x - n * PIO2_1;
+    r = r - n * PIO2_2;
+    r = r - n * PIO2_3;
+    r = r - n * PIO2_3T;
+    VD z = r * r;
+    VD ps = SPLAT(1.58969099521155010221e-10);
+    ps = ps * z - 2.50507602534068634195e-08;
+    ps = ps * z + 2.75573137070700676789e-06;
+    ps = ps * z - 1.98412698298579493134e-04;
+    ps = ps * z + 8.33333333332248946124e-03;
+    ps = ps * z - 1.66666666666666324348e-01;
+    VD sinr = r + r * z * ps;
+    VD pc = SPLAT(-1.13596475577881948265e-11);
+    pc = pc * z + 2.08757232129817482790e-09;
+    pc = pc * z - 2.75573143513906633035e-07;
+    pc = pc * z + 2.48015872894767294178e-05;
+    pc = pc * z - 1.38888888888741095749e-03;
+    pc = pc * z + 4.16666666666666019037e-02;
+    VD hz = 0.5 * z;
+    VD w = 1.0 - hz;
+    VD cosr = w + (((1.0 - w) - hz) + z * z * pc);
+    k += q0;
+    VD y = KERNEL(select)((k & 1) != 0, cosr, sinr);
+    y = KERNEL(select)((k & 2) != 0, -y, y);
+    VI far = ~(KERNEL(abs)(x) <= SINCOS_LIMIT);
+    for (int i = 0; i < VM_WIDTH; i++)
+        if (far[i])
+            y[i] = scalar(x[i]);
+    return y;
+}
+
+
+// tanh |x| = -u / (u + 2) with u = e^(-2|x|) - 1, which never cancels
+INLINE VD KERNEL(tanh)(VD x) {
+    VD u = KERNEL(expm1_neg)(-2.0 * KERNEL(abs)(x));
+    return KERNEL(copysign)(-u / (u + 2.0), x);
+}
+
+
+// 1 / (1 + e^-x), as e^x / (1 + e^x) below 0 so tiny results keep their
+// precision
+INLINE VD KERNEL(sigmoid)(VD x) {
+    VD e = KERNEL(exp)(-KERNEL(abs)(x));
+    return KERNEL(select)(x < 0.0, e, SPLAT(1.0)) / (1.0 + e);
+}
+
+
+// erf |x| = |x| P(x^2) below 1.5, 1 - e^(-x^2) P(|x| - c) on [1.5, 3) and
+// [3, 5.95], all three P of degree 15 fitted to within 0.25 ulp, the
+// coefficients of each lane are picked per step, so it is one polynomial
+INLINE VD KERNEL(erf)(VD x) {
+    VD ax = KERNEL(abs)(x);
+    ax = KERNEL(select)(ax > 6.0, SPLAT(6.0), ax);
+    VI a = ax < 1.5;
+    VI b = ~a & (ax < 3.0);
+    VD v = KERNEL(select)(a, ax * ax, ax - KERNEL(select)(b, SPLAT(ERF_MID), SPLAT(ERF_LARGE)));
+    VD p = SPLAT(0.0);
+    for (int i = ERF_DEGREE; i >= 0; i--) {
+        VD coef = KERNEL(select)(b, SPLAT(erfMid[i]), SPLAT(erfLarge[i]));
+        p = p * v + KERNEL(select)(a, SPLAT(erfSmall[i]), coef);
+    }
+    VD y = KERNEL(select)(a, ax * p, 1.0 - KERNEL(exp)(-(ax * ax)) * p);
+    y = KERNEL(select)(ax > 5.95, SPLAT(1.0), y);
+    return KERNEL(copysign)(y, x);
+}
+
+
+// the vector variants compiled code calls through
+// vector-function-abi-variant, see src/vectormath.cpp
+#define VM_VARIANT(name) \
+    VM_TARGET VD KERNEL(lisa_v##name)(VD x) { \
+        return KERNEL(name)(x); \
+    }
+
+VM_VARIANT(exp)
+VM_VARIANT(log)
+VM_VARIANT(tanh)
+VM_VARIANT(erf)
+
+// r + r z ps rounds -0 to +0, zeros give themselves back as in libm
+VM_TARGET VD KERNEL(lisa_vsin)(VD x) {
+    return KERNEL(select)(x == 0.0, x, KERNEL(sincos)(x, 0, sin));
+}
+
+VM_TARGET VD KERNEL(lisa_vcos)(VD x) {
+    return KERNEL(sincos)(x, 1, cos);
+}
+
+
+// y[i] = f(x[i]) over arrays, the tail goes through a partial vector
+#define VM_ARRAY(name) \
+    VM_TARGET static void KERNEL(name##_array)(const double *x, double *y, int64_t n) { \
+        int64_t i = 0; \
+        VD v; \
+        for (; i + VM_WIDTH <= n; i += VM_WIDTH) { \
+            memcpy(&v, x + i, sizeof(v)); \
+            v = KERNEL(lisa_v##name)(v); \
+            memcpy(y + i, &v, sizeof(v)); \
+        } \
+        if (i < n) { \
+            v = (VD){0}; \
+            memcpy(&v, x + i, (n - i) * sizeof(double)); \
+            v = KERNEL(lisa_v##name)(v); \
+            memcpy(y + i, &v, (n - i) * sizeof(double)); \
+        } \
+    }
+
+VM_TARGET static VD KERNEL(lisa_vsigmoid)(VD x) {
+    return KERNEL(sigmoid)(x);
+}
+
+VM_ARRAY(exp)
+VM_ARRAY(log)
+VM_ARRAY(sin)
+VM_ARRAY(cos)
+VM_ARRAY(tanh)
+VM_ARRAY(sigmoid)
+VM_ARRAY(erf)
+
+static const vmath_fn KERNEL(arrays)[VMATH_FUNCTIONS] = {
+    KERNEL(exp_array), KERNEL(log_array), KERNEL(sin_array), KERNEL(cos_array),
+    KERNEL(tanh_array), KERNEL(sigmoid_array), KERNEL(erf_array),
+};
+
+
+#undef VM_VARIANT
+#undef VM_ARRAY
+#undef SPLAT
+#undef INLINE
+#undef KERNEL
+#undef VU
+#undef VI
+#undef VD
+#undef VM_WIDTH
+#undef VM_TARGET
@@ -16,6 +16,8 @@
 #include <utility>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
@@ -38,12 +40,14 @@
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "jit.h"
+#include "lisa_runtime.h"
 using namespace llvm;
 
 
 // define all the AST nodes
 class ExprAST;
 class NumberExprAST;
+class StringExprAST;
 class VariableExprAST;
 class BinaryExprAST;
 class IfExprAST;
@@ -51,10 +55,62 @@ class ForExprAST;
 class WhileExprAST;
 class ReturnExprAST;
 class CallExprAST;
+class TensorExprAST;
+class IndexExprAST;
+class FusedExprAST;
 class PrototypeAST;
 class FunctionAST;
 
 
+// the types of Lisa values
+enum ValueKind {
+    VALUE_SCALAR,   // double
+    VALUE_TENSOR,   // lisa_tensor*, see runtime/lisa_runtime.h
+};
+
+
+// reductions of a tensor to a scalar, math.sum, math.max, math.min
+// and math.mean
+enum ReduceKind {
+    REDUCE_SUM,
+    REDUCE_MAX,
+    REDUCE_MIN,
+    REDUCE_MEAN,
+};
+
+
+// math.* built-ins applied to every element of a tensor, and reductions
+// the tables are in tensorgen.cpp
+bool isElementwiseBuiltin(const std::string &name);
+bool isReductionBuiltin(const std::string &name, ReduceKind &kind);
+
+
+// the dimensions of a tensor value when they are known at compile time,
+// set by shape inference (shapes.h), such a tensor was made by Lisa code
+// and so is contiguous
+struct StaticShape {
+    bool known = false;
+    std::vector<int64_t> dims;
+
+    int64_t size() const {
+        int64_t n = 1;
+        for (int64_t dim : dims)
+            n *= dim;
+        return n;
+    }
+};
+
+
+// a function callable from C, as listed in the generated header
+struct ExportedFunction {
+    std::string name;
+    std::vector<std::string> args;
+    bool batch;                     // has a name_batch wrapper (@batch)
+    std::vector<ValueKind> argKinds;
+    ValueKind resultKind;
+};
+
+
 class CodeGenVisitor 
 {
 private:
@@ -64,13 +120,59 @@ private:
     std::unique_ptr<legacy::FunctionPassManager> fpm;
     std::unique_ptr<lisa::LisaJIT> jit;
     std::map<std::string, AllocaInst*> namedValues;
+    std::vector<Function*> topLevelFunctions;
+    std::vector<ExportedFunction> exportedFunctions;
+    // the type of every declared function, streaming (-fstream) frees
+    // emitted bodies and the optimizer may drop their declarations
+    std::map<std::string, FunctionType*> functionProtos;
+    // functions with a body, including emitted ones and @batch wrappers
+    std::set<std::string> definedFunctions;
+    // if expressions of the current function whose branches give a tensor
+    // and a scalar, only an error if their value is used
+    std::vector<PHINode*> mixedIfs;
+    // the right-hand side of the assignment to inPlaceVar being generated
+    ExprAST *inPlaceSite = nullptr;
+    std::string inPlaceVar;
+    Function* getFunction(const std::string &name);
+    FunctionType* prototypeType(PrototypeAST *node);
+    void eraseFunction(Function *theFunction);
+    bool checkMixedIfs(bool topLevel);
+    Function* createBatchWrapper(Function *scalar);
+    // tensor lowering, in tensorgen.cpp
+    Type* valueType(ValueKind kind);
+    FunctionCallee runtimeFunction(const std::string &name);
+    void addArenaScope(Function *theFunction);
+    Value* createStackTensor(const StaticShape &shape, Value *fill = nullptr);
+    Value* tensorField(Value *tensor, unsigned field, const Twine &name,
+                       int dim = -1);
+    Value* tensorElementPtr(IndexExprAST *node);
+    Value* createScalarBinary(char op, Value *lhs, Value *rhs);
+    Value* createMathCall(const std::string &name, ArrayRef<Value *> args);
+    bool createElementwise(ArrayRef<Value *> operands,
+                           ArrayRef<const StaticShape *> shapes,
+                           function_ref<Value *(ArrayRef<Value *>)> body,
+                           ExprAST *output, ArrayRef<ReduceKind> reductions,
+                           Value *&result, std::vector<Value *> &reduced,
+                           Value *dest = nullptr);
+    Value* inPlaceOutput(ExprAST *node, ArrayRef<ExprAST *> leaves,
+                         std::vector<Value *> &operands);
+    Value* emitFusedTree(ExprAST *node, ArrayRef<Value *> leaves, size_t &next);
+    Value* createBuiltinCall(CallExprAST *node);
+    Value* createFileCall(CallExprAST *node);
+    Value* createQualifiedVariable(VariableExprAST *node);
+    Value* assignVariable(const std::string &name, bool declaredTensor, Value *val);
 public:
     CodeGenVisitor();
     virtual ~CodeGenVisitor() = default;
     Module* borrowModule() {return module.get();}
+    GlobalVariable* createTopLevelList();
+    const std::vector<ExportedFunction>& exports() const {return exportedFunctions;}
+    StructType* tensorType();
     AllocaInst* createEntryBlockAlloca(Function *theFunction, 
-                                       const std::string &varName);
+                                       const std::string &varName,
+                                       Type *type = nullptr);
     virtual Value* visit(NumberExprAST *node);
+    virtual Value* visit(StringExprAST *node);
     virtual Value* visit(VariableExprAST *node);
     virtual Value* visit(BinaryExprAST *node);
     virtual Value* visit(IfExprAST *node);
@@ -78,6 +180,9 @@ public:
     virtual Value* visit(WhileExprAST *node);
     virtual Value* visit(ReturnExprAST *node);
     virtual Value* visit(CallExprAST *node);
+    virtual Value* visit(TensorExprAST *node);
+    virtual Value* visit(IndexExprAST *node);
+    virtual Value* visit(FusedExprAST *node);
     virtual Function* visit(PrototypeAST *node);
     virtual Function* visit(FunctionAST *node);
 };
@@ -85,6 +190,9 @@ public:
 
 class ExprAST
 {
+public:
+    StaticShape staticShape;
+    bool stackTensor = false;   // its tensor does not escape, see escape.h
 public:
     virtual ~ExprAST() = default;
     virtual Value* accept(CodeGenVisitor &v) = 0;
@@ -99,6 +207,20 @@ public:
     explicit NumberExprAST(const std::string& valStr) {
         val = strtod(valStr.c_str(), nullptr);
     }
+    explicit NumberExprAST(double val) : val(val) {}
+    Value* accept(CodeGenVisitor &v) override {
+        return v.visit(this);
+    }
+};
+
+
+// a string literal, only file names of the tensor I/O built-ins
+class StringExprAST : public ExprAST
+{
+public:
+    std::string val;
+public:
+    explicit StringExprAST(std::string val) : val(std::move(val)) {}
     Value* accept(CodeGenVisitor &v) override {
         return v.visit(this);
     }
@@ -109,6 +231,7 @@ class VariableExprAST : public ExprAST
 {
 public:
     std::string name;
+    bool declaredTensor = false;    // "tensor x: ..." as an assignment target
 public:
     explicit VariableExprAST(std::string name) : name(std::move(name)) {}
     Value* accept(CodeGenVisitor &v) override {
@@ -210,14 +333,79 @@ public:
 };
 
 
+// tensor literal, [1, 2, 3] or [[1, 2], [3, 4]]
+// nested lists are flattened in row-major order
+class TensorExprAST : public ExprAST
+{
+public:
+    std::vector<int64_t> shape;
+    std::vector<std::unique_ptr<ExprAST>> elements;
+public:
+    TensorExprAST(std::vector<int64_t> shape,
+                  std::vector<std::unique_ptr<ExprAST>> elements) :
+        shape(std::move(shape)), elements(std::move(elements)) {}
+    Value* accept(CodeGenVisitor &v) override {
+        return v.visit(this);
+    }
+};
+
+
+// element access, a[i] or a[i, j]
+class IndexExprAST : public ExprAST
+{
+public:
+    std::unique_ptr<ExprAST> tensor;
+    std::vector<std::unique_ptr<ExprAST>> indices;
+public:
+    IndexExprAST(std::unique_ptr<ExprAST> tensor,
+                 std::vector<std::unique_ptr<ExprAST>> indices) :
+        tensor(std::move(tensor)), indices(std::move(indices)) {}
+    Value* accept(CodeGenVisitor &v) override {
+        return v.visit(this);
+    }
+};
+
+
+// element-wise operations evaluated in a single loop, made by the fusion
+// pass (fusion.h) from the original expression tree in root
+// binary operators and element-wise math.* calls in the tree form the
+// loop body, every other subexpression is a leaf evaluated before the
+// loop, if no leaf is a tensor the tree is computed on scalars
+class FusedExprAST : public ExprAST
+{
+public:
+    // a reduction of the element values, stored into a variable when
+    // var is set, otherwise the value of the whole group
+    struct Reduction {
+        ReduceKind kind;
+        std::string var;
+    };
+    std::unique_ptr<ExprAST> root;
+    std::vector<Reduction> reductions;
+    bool reduced = false;   // the value is reductions[0], no tensor is built
+public:
+    explicit FusedExprAST(std::unique_ptr<ExprAST> root) : root(std::move(root)) {}
+    Value* accept(CodeGenVisitor &v) override {
+        return v.visit(this);
+    }
+};
+
+
 class PrototypeAST
 {
 public:
     std::string name;
     std::vector<std::string> args;
+    std::vector<ValueKind> argKinds;    // "tensor" before an argument name
+    ValueKind resultKind = VALUE_SCALAR; // "tensor" before the function name
 public:
     PrototypeAST(std::string name, std::vector<std::string> args) :
-        name(std::move(name)), args(std::move(args)) {}
+        name(std::move(name)), args(std::move(args)),
+        argKinds(this->args.size(), VALUE_SCALAR) {}
+    bool usesTensors() const {
+        return resultKind == VALUE_TENSOR ||
+            std::find(argKinds.begin(), argKinds.end(), VALUE_TENSOR) != argKinds.end();
+    }
     const std::string& getName() const { return name; }
     Function* accept(CodeGenVisitor &v) {
         return v.visit(this);
@@ -230,6 +418,7 @@ class FunctionAST
 public:
     std::unique_ptr<PrototypeAST> proto;
     std::vector<std::unique_ptr<ExprAST>> body;
+    std::vector<std::string> decorators;    // @name lines before "fn"
 public:
     FunctionAST(std::unique_ptr<PrototypeAST> proto,
                 std::vector<std::unique_ptr<ExprAST>> body) :
@@ -0,0 +1,96 @@
+/**
+ * @file cheader.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "cheader.h"
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+
+namespace lisa
+{
+// FOO_H for foo.h, anything that is not a C identifier becomes '_'
+static std::string includeGuard(const std::string &file) {
+    std::string guard = sys::path::filename(file).str();
+    for (char &c : guard)
+        c = std::isalnum((unsigned char)c) ? std::toupper((unsigned char)c) : '_';
+    if (guard.empty() || std::isdigit((unsigned char)guard[0]))
+        guard = "LISA_" + guard;
+    return guard;
+}
+
+
+// a parameter name that none of the function's arguments use
+static std::string freshName(std::string name, const std::vector<std::string> &args) {
+    while (std::find(args.begin(), args.end(), name) != args.end())
+        name += "_";
+    return name;
+}
+
+
+static void writeParams(raw_ostream &os, const std::vector<std::string> &args,
+                        const char *type) {
+    for (size_t i = 0; i < args.size(); i++)
+        os << (i ? ", " : "") << type << args[i];
+}
+
+
+static const char *cType(ValueKind kind) {
+    return kind == VALUE_TENSOR ? "lisa_tensor *" : "double ";
+}
+
+
+bool writeCHeader(const std::string &file,
+                  const std::vector<ExportedFunction> &functions) {
+    std::error_code ec;
+    raw_fd_ostream os(file, ec, sys::fs::OF_Text);
+    if (ec) {
+        errs() << "Could not open file: " << ec.message() << "\n";
+        return false;
+    }
+    std::string guard = includeGuard(file);
+    os << "/* generated by the Lisa compiler, do not edit */\n\n"
+       << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+       << "#include <stddef.h>\n";
+    // the tensor descriptor comes with the runtime
+    bool tensors = std::any_of(functions.begin(), functions.end(),
+        [](const ExportedFunction &fn) {
+            return fn.resultKind == VALUE_TENSOR ||
+                std::count(fn.argKinds.begin(), fn.argKinds.end(), VALUE_TENSOR);
+        });
+    if (tensors)
+        os << "#include \"lisa_runtime.h\"\n";
+    os << "\n#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+    // a function defined in several inputs is declared once
+    std::set<std::string> declared;
+    for (auto &fn : functions) {
+        if (!declared.insert(fn.name).second)
+            continue;
+        os << cType(fn.resultKind) << fn.name << "(";
+        if (fn.args.empty())
+            os << "void";
+        for (size_t i = 0; i < fn.args.size(); i++)
+            os << (i ? ", " : "") << cType(fn.argKinds[i]) << fn.args[i];
+        os << ");\n";
+        if (!fn.batch)
+            continue;
+        os << "void " << fn.name << "_batch(";
+        writeParams(os, fn.args, "const double *");
+        os << (fn.args.empty() ? "" : ", ") << "double *"
+           << freshName("out", fn.args) << ", size_t " << freshName("n", fn.args)
+           << ");\n";
+    }
+    os << "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+    return !os.has_error();
+}
+}
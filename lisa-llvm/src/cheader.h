@@ -0,0 +1,33 @@
+/**
+ * @file cheader.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef CHEADER_H
+#define CHEADER_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ast.h"
+
+
+namespace lisa
+{
+// write a C header declaring the exported functions of all inputs
+// scalars are doubles and tensors are passed as lisa_tensor pointers
+// (lisa_runtime.h), wrap existing buffers with lisa_tensor_view to pass
+// them without copying, @batch functions also get
+//   void name_batch(const double *arg..., double *out, size_t n)
+// which applies the function element-wise to arrays of length n
+bool writeCHeader(const std::string &file,
+                  const std::vector<ExportedFunction> &functions);
+}
+
+
+#endif
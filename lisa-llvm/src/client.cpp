@@ -0,0 +1,42 @@
+/**
+ * @file client.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// thin client of the compile server, takes the same arguments as lisa
+// it does not link LLVM, so starting it costs next to nothing, the socket
+// is $LISA_SERVER or the server's default
+// without a server the lisa installed next to it compiles the request
+
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "server.h"
+
+
+int main(int argc, char **argv) {
+    const char *socket = getenv("LISA_SERVER");
+    std::string socketPath = socket ? socket : lisa::defaultSocketPath();
+    int status = lisa::runClient(socketPath, argc, argv);
+    if (status >= 0)
+        return status;
+
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n < 0) {
+        perror("lisa-client");
+        return 1;
+    }
+    std::string lisa(self, n);
+    lisa = lisa.substr(0, lisa.find_last_of('/') + 1) + "lisa";
+    argv[0] = const_cast<char *>(lisa.c_str());
+    execv(lisa.c_str(), argv);
+    perror(lisa.c_str());
+    return 1;
+}
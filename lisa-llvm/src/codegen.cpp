@@ -8,6 +8,8 @@
  */
 
 #include "ast.h"
+#include "profiler.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 using namespace llvm;
 
 
@@ -18,6 +20,12 @@ Value *codeGenError(const char *str) {
 }
 
 
+// warning printing function
+void codeGenWarning(const char *str) {
+    fprintf(stderr, "\033[1;33mCode Gen Warning:\033[0m %s\n", str);
+}
+
+
 // Code Generation Visitor
 CodeGenVisitor::CodeGenVisitor() : 
     context(std::make_unique<LLVMContext>()), 
@@ -37,11 +45,20 @@ CodeGenVisitor::CodeGenVisitor() :
     }
 
 
+// variables are doubles unless a type is given
 AllocaInst *CodeGenVisitor::createEntryBlockAlloca(Function *theFunction,
-                                          const std::string &varName) {
+                                          const std::string &varName,
+                                          Type *type) {
     IRBuilder<> tmpB(&theFunction->getEntryBlock(),
                      theFunction->getEntryBlock().begin());
-    return tmpB.CreateAlloca(Type::getDoubleTy(*context), nullptr, varName);
+    if (!type)
+        type = Type::getDoubleTy(*context);
+    return tmpB.CreateAlloca(type, nullptr, varName);
+}
+
+
+static const char *kindName(Type *type) {
+    return type->isPointerTy() ? "a tensor" : "a scalar";
 }
 
 
@@ -51,10 +68,20 @@ Value *CodeGenVisitor::visit(NumberExprAST *node) {
 }
 
 
+// for StringExprAST, a string is not a value, createFileCall reads the
+// file names of the built-ins
+Value *CodeGenVisitor::visit(StringExprAST *) {
+    return codeGenError("strings can only be file names of tensor.load, tensor.load_raw, "
+                        "tensor.load_csv, tensor.read_csv, tensor.save and tensor.append");
+}
+
+
 // for VariableExprAST
 Value *CodeGenVisitor::visit(VariableExprAST *node) {
     // Value *v = namedValues[node->name];
     AllocaInst *v = namedValues[node->name];
+    if (!v && node->name.find('.') != std::string::npos)
+        return createQualifiedVariable(node);
     if (!v) {
         std::string err = "Undefined identifier: " + node->name;
         return codeGenError(err.c_str());
@@ -67,22 +94,30 @@ Value *CodeGenVisitor::visit(VariableExprAST *node) {
 Value *CodeGenVisitor::visit(BinaryExprAST *node) {
     // assignment
     if (node->op == ':') {
-        auto *lhs = dynamic_cast<VariableExprAST*>(node->lhs.get());
-        if (!lhs)
-            return codeGenError("invalid assignment target");
+        // "x: x * 2" may update x in place, see inPlaceOutput
+        auto *target = dynamic_cast<VariableExprAST*>(node->lhs.get());
+        if (target) {
+            inPlaceSite = node->rhs.get();
+            inPlaceVar = target->name;
+        }
         Value *rhsVal = node->rhs->accept(*this);
+        inPlaceSite = nullptr;
         if (!rhsVal)
             return nullptr;
-        Value *lhsVal = namedValues[lhs->name];
-        if (!lhsVal) {
-            Function *theFunction = builder.GetInsertBlock()->getParent();
-            AllocaInst *alloca = createEntryBlockAlloca(theFunction, lhs->name);
-            builder.CreateStore(rhsVal, alloca);
-            namedValues[lhs->name] = alloca;
+        // element of a tensor
+        if (auto *index = dynamic_cast<IndexExprAST*>(node->lhs.get())) {
+            if (!rhsVal->getType()->isDoubleTy())
+                return codeGenError("tensor elements have to be scalars");
+            Value *ptr = tensorElementPtr(index);
+            if (!ptr)
+                return nullptr;
+            builder.CreateStore(rhsVal, ptr);
             return rhsVal;
         }
-        builder.CreateStore(rhsVal, lhsVal);
-        return rhsVal;
+        auto *lhs = dynamic_cast<VariableExprAST*>(node->lhs.get());
+        if (!lhs)
+            return codeGenError("invalid assignment target");
+        return assignVariable(lhs->name, lhs->declaredTensor, rhsVal);
     }
 
     // other binary operations
@@ -90,7 +125,56 @@ Value *CodeGenVisitor::visit(BinaryExprAST *node) {
     Value *rhs = node->rhs->accept(*this);
     if (!lhs || !rhs)
         return nullptr;
-    switch (node->op) {
+    if (lhs->getType()->isPointerTy() || rhs->getType()->isPointerTy()) {
+        Value *result;
+        std::vector<Value *> reduced;
+        std::vector<Value *> operands = {lhs, rhs};
+        Value *dest = inPlaceOutput(node, {node->lhs.get(), node->rhs.get()}, operands);
+        if (!createElementwise(operands,
+                               {&node->lhs->staticShape, &node->rhs->staticShape},
+                               [&](ArrayRef<Value *> x) {
+                return createScalarBinary(node->op, x[0], x[1]);
+            }, node, {}, result, reduced, dest))
+            return nullptr;
+        return result;
+    }
+    return createScalarBinary(node->op, lhs, rhs);
+}
+
+
+// store into a variable, the first assignment decides its type
+Value *CodeGenVisitor::assignVariable(const std::string &name, bool declaredTensor,
+                                      Value *val) {
+    if (declaredTensor && !val->getType()->isPointerTy()) {
+        std::string err = "tensor " + name + " is assigned a scalar";
+        return codeGenError(err.c_str());
+    }
+    AllocaInst *var = namedValues[name];
+    if (!var) {
+        Function *theFunction = builder.GetInsertBlock()->getParent();
+        var = createEntryBlockAlloca(theFunction, name, val->getType());
+        namedValues[name] = var;
+    }
+    else if (var->getAllocatedType() != val->getType()) {
+        std::string err = name + " is " + kindName(var->getAllocatedType()) +
+            " and cannot be assigned " + kindName(val->getType());
+        return codeGenError(err.c_str());
+    }
+    // a tensor variable holds a reference to its value, taken before the
+    // old one is dropped in case they are the same (see addArenaScope)
+    if (val->getType()->isPointerTy()) {
+        builder.CreateCall(runtimeFunction("lisa_tensor_adopt"), {val});
+        Value *old = builder.CreateLoad(val->getType(), var, name + ".old");
+        builder.CreateCall(runtimeFunction("lisa_tensor_free"), {old});
+    }
+    builder.CreateStore(val, var);
+    return val;
+}
+
+
+// arithmetic and comparisons on doubles, comparisons give 1.0 or 0.0
+Value *CodeGenVisitor::createScalarBinary(char op, Value *lhs, Value *rhs) {
+    switch (op) {
         case '+':
             return builder.CreateFAdd(lhs, rhs, "addtmp");
         case '-':
@@ -128,36 +212,51 @@ Value *CodeGenVisitor::visit(IfExprAST *node) {
     BasicBlock *elseBodyBB = nullptr;
     if (!node->els_body.empty())
         elseBodyBB = BasicBlock::Create(*context, "elsebody");
+    BasicBlock *condBB = builder.GetInsertBlock();
     builder.CreateCondBr(condV, ifBodyBB, elseBodyBB ? elseBodyBB : mergeBB);
 
     // Generate code for the "if" body
     builder.SetInsertPoint(ifBodyBB);
-    Value *ifBodyV = nullptr;
-    for (auto &expr : node->if_body)
+    Value *ifBodyV = ConstantFP::get(*context, APFloat(0.0));
+    for (auto &expr : node->if_body) {
         ifBodyV = expr->accept(*this);
+        if (!ifBodyV)
+            return nullptr;
+    }
     builder.CreateBr(mergeBB);
     ifBodyBB = builder.GetInsertBlock();
 
     // Generate code for the "else" body (if it exists)
-    Value *elseBodyV = nullptr;
+    Value *elseBodyV = ConstantFP::get(*context, APFloat(0.0));
     if (elseBodyBB) {
         theFunction->getBasicBlockList().push_back(elseBodyBB);
         builder.SetInsertPoint(elseBodyBB);
-        for (auto &expr : node->els_body)
+        for (auto &expr : node->els_body) {
             elseBodyV = expr->accept(*this);
+            if (!elseBodyV)
+                return nullptr;
+        }
         builder.CreateBr(mergeBB);
         elseBodyBB = builder.GetInsertBlock();
     }
 
     // Generate code for the merge block
+    // the value is a tensor only if both branches give one, otherwise
+    // tensors are replaced by 0 and using the value is an error
     theFunction->getBasicBlockList().push_back(mergeBB);
     builder.SetInsertPoint(mergeBB);
-    PHINode *phiNode = builder.CreatePHI(Type::getDoubleTy(*context), 2, "iftmp");
-    phiNode->addIncoming(ifBodyV, ifBodyBB);
+    Type *type = Type::getDoubleTy(*context);
+    if (elseBodyBB && ifBodyV->getType() == elseBodyV->getType())
+        type = ifBodyV->getType();
+    Value *zero = ConstantFP::get(*context, APFloat(0.0));
+    PHINode *phiNode = builder.CreatePHI(type, 2, "iftmp");
+    phiNode->addIncoming(ifBodyV->getType() == type ? ifBodyV : zero, ifBodyBB);
     if (elseBodyBB)
-        phiNode->addIncoming(elseBodyV, elseBodyBB);
+        phiNode->addIncoming(elseBodyV->getType() == type ? elseBodyV : zero, elseBodyBB);
     else
-        phiNode->addIncoming(ConstantFP::get(*context, APFloat(0.0)), mergeBB);
+        phiNode->addIncoming(zero, condBB);
+    if (ifBodyV->getType() != type || (elseBodyBB && elseBodyV->getType() != type))
+        mixedIfs.push_back(phiNode);
 
     return phiNode;
 }
@@ -249,14 +348,27 @@ Value *CodeGenVisitor::visit(ReturnExprAST *node) {
     Value *retVal = node->expr->accept(*this);
     if (!retVal)
         return nullptr;
+    Function *theFunction = builder.GetInsertBlock()->getParent();
+    if (retVal->getType() != theFunction->getReturnType()) {
+        std::string err = theFunction->getName().str() + " returns " +
+            kindName(retVal->getType()) + " but is declared to return " +
+            kindName(theFunction->getReturnType());
+        return codeGenError(err.c_str());
+    }
     builder.CreateRet(retVal);
+    // anything after a return is unreachable, keep emitting into a
+    // detached block so every block ends with exactly one terminator
+    builder.SetInsertPoint(BasicBlock::Create(*context, "afterret", theFunction));
     return retVal;
 }
 
 
 // for CallExprAST
 Value *CodeGenVisitor::visit(CallExprAST *node) {
-    Function *calleeF = module->getFunction(node->callee);
+    // only built-ins have qualified names
+    if (node->callee.find('.') != std::string::npos)
+        return createBuiltinCall(node);
+    Function *calleeF = getFunction(node->callee);
     if (!calleeF) {
         std::string err = "Unknown function referenced: " + node->callee;
         return codeGenError(err.c_str());
@@ -268,14 +380,97 @@ Value *CodeGenVisitor::visit(CallExprAST *node) {
         argsV.push_back(arg->accept(*this));
         if (!argsV.back())
             return nullptr;
+        Type *paramTy = calleeF->getArg(argsV.size() - 1)->getType();
+        if (argsV.back()->getType() != paramTy) {
+            std::string err = "Argument " + std::to_string(argsV.size()) + " of " +
+                node->callee + " has to be " + kindName(paramTy);
+            return codeGenError(err.c_str());
+        }
     }
     return builder.CreateCall(calleeF, argsV, "calltmp");
 }
 
 
+// look a function up in the module, or declare it again from its
+// prototype if its body was already emitted and the declaration dropped
+Function *CodeGenVisitor::getFunction(const std::string &name) {
+    if (Function *f = module->getFunction(name))
+        return f;
+    auto it = functionProtos.find(name);
+    if (it == functionProtos.end())
+        return nullptr;
+    return Function::Create(it->second, Function::ExternalLinkage, name, module.get());
+}
+
+
+// drop a function whose body failed to generate, calls to it are errors
+void CodeGenVisitor::eraseFunction(Function *theFunction) {
+    functionProtos.erase(theFunction->getName().str());
+    theFunction->eraseFromParent();
+}
+
+
+// whether the value of an if is used, through the ifs it is the value of,
+// the value of a top-level expression is discarded
+static bool ifValueUsed(Value *value, bool topLevel) {
+    for (User *user : value->users()) {
+        if (isa<PHINode>(user) && !ifValueUsed(user, topLevel))
+            continue;
+        if (isa<ReturnInst>(user) && topLevel)
+            continue;
+        return true;
+    }
+    return false;
+}
+
+
+// report the ifs of the function whose tensor branch would be replaced by 0
+bool CodeGenVisitor::checkMixedIfs(bool topLevel) {
+    bool ok = true;
+    for (PHINode *phi : mixedIfs) {
+        if (ifValueUsed(phi, topLevel)) {
+            codeGenError("if gives a tensor in one branch and a scalar in the other, "
+                         "its value cannot be used");
+            ok = false;
+        }
+    }
+    mixedIfs.clear();
+    return ok;
+}
+
+
 // for FunctionAST
 Function *CodeGenVisitor::visit(FunctionAST *node) {
-    Function *theFunction = module->getFunction(node->proto->name);
+    lisa::PhaseScope scope(lisa::PHASE_CODEGEN, node->proto->name);
+    bool batch = false;
+    for (auto &decorator : node->decorators) {
+        // @CPU, @GPU and @JIT are not implemented yet, compile as usual
+        if (decorator != "batch") {
+            std::string msg = "Unknown decorator @" + decorator + " on " +
+                node->proto->name + ", ignored";
+            codeGenWarning(msg.c_str());
+            continue;
+        }
+        batch = true;
+    }
+    if (batch && node->proto->usesTensors()) {
+        codeGenError("@batch functions take and return scalars");
+        return nullptr;
+    }
+    const std::string &name = node->proto->name;
+    if (batch && (definedFunctions.count(name + "_batch") || getFunction(name + "_batch"))) {
+        std::string err = "@batch wrapper clashes with function: " + name + "_batch";
+        codeGenError(err.c_str());
+        return nullptr;
+    }
+    // an extern may be defined once, with the arguments it was declared with
+    Function *theFunction = name.empty() ? nullptr : getFunction(name);
+    if (definedFunctions.count(name) ||
+        (theFunction && theFunction->getFunctionType() != prototypeType(node->proto.get()))) {
+        std::string err = "Redefinition of function: " + name;
+        codeGenError(err.c_str());
+        return nullptr;
+    }
     if (!theFunction)
         theFunction = node->proto->accept(*this);
     if (!theFunction)
@@ -283,9 +478,10 @@ Function *CodeGenVisitor::visit(FunctionAST *node) {
     BasicBlock *bb = BasicBlock::Create(*context, "entry", theFunction);
     builder.SetInsertPoint(bb);
     namedValues.clear();
+    mixedIfs.clear();
     for (auto &arg : theFunction->args()) {
         AllocaInst *alloca = createEntryBlockAlloca(
-            theFunction, std::string(arg.getName()));
+            theFunction, std::string(arg.getName()), arg.getType());
         builder.CreateStore(&arg, alloca);
         namedValues[std::string(arg.getName())] = alloca;
     }
@@ -295,42 +491,170 @@ Function *CodeGenVisitor::visit(FunctionAST *node) {
         if (expr == node->body.back()) {
             if (auto *ret = dynamic_cast<ReturnExprAST *>(expr.get())) {
                 if (!expr->accept(*this)) {
-                    theFunction->eraseFromParent();
+                    eraseFunction(theFunction);
                     return nullptr;
                 }
+                builder.CreateUnreachable();
             }
             else {
                 Value *retVal = expr->accept(*this);
                 if (!retVal) {
-                    theFunction->eraseFromParent();
+                    eraseFunction(theFunction);
+                    return nullptr;
+                }
+                // the value of a top-level expression is discarded
+                if (node->proto->name.empty() && retVal->getType()->isPointerTy())
+                    retVal = ConstantFP::get(*context, APFloat(0.0));
+                if (retVal->getType() != theFunction->getReturnType()) {
+                    std::string err = node->proto->name + " returns " +
+                        kindName(retVal->getType()) + " but is declared to return " +
+                        kindName(theFunction->getReturnType());
+                    codeGenError(err.c_str());
+                    eraseFunction(theFunction);
                     return nullptr;
                 }
                 builder.CreateRet(retVal);
             }
         }
         else if (!expr->accept(*this)) {
-            theFunction->eraseFromParent();
+            eraseFunction(theFunction);
             return nullptr;
         }
     }
+    if (!checkMixedIfs(node->proto->name.empty())) {
+        eraseFunction(theFunction);
+        return nullptr;
+    }
+    addArenaScope(theFunction);
     verifyFunction(*theFunction);
-    fpm->run(*theFunction); // function pass optimization
+    // top-level expressions are only reachable through the entry point
+    if (node->proto->name.empty()) {
+        theFunction->setName("__lisa_toplevel");
+        theFunction->setLinkage(Function::InternalLinkage);
+        topLevelFunctions.push_back(theFunction);
+    }
+    {
+        lisa::PhaseScope optScope(lisa::PHASE_OPTIMIZE, node->proto->name);
+        fpm->run(*theFunction); // function pass optimization
+    }
+    if (batch) {
+        Function *wrapper = createBatchWrapper(theFunction);
+        if (!wrapper) {
+            eraseFunction(theFunction);
+            return nullptr;
+        }
+        fpm->run(*wrapper);
+        definedFunctions.insert(wrapper->getName().str());
+    }
+    // recorded last, the header only declares what the object defines
+    if (!name.empty()) {
+        definedFunctions.insert(name);
+        exportedFunctions.push_back({name, node->proto->args, batch,
+                                     node->proto->argKinds, node->proto->resultKind});
+    }
     return theFunction;
 }
 
 
+// void name_batch(const double *arg..., double *out, size_t n)
+// applies the function to every element, the scalar body is inlined into
+// the loop so the optimizer can vectorize it
+Function *CodeGenVisitor::createBatchWrapper(Function *scalar) {
+    std::string name = scalar->getName().str() + "_batch";
+    if (module->getFunction(name)) {
+        std::string err = "@batch wrapper clashes with function: " + name;
+        codeGenError(err.c_str());
+        return nullptr;
+    }
+    Type *doubleTy = Type::getDoubleTy(*context);
+    Type *sizeTy = Type::getInt64Ty(*context);  // size_t, lisa targets are 64-bit
+    unsigned numArgs = scalar->arg_size();
+    std::vector<Type *> params(numArgs + 1, doubleTy->getPointerTo());
+    params.push_back(sizeTy);
+    FunctionType *ft = FunctionType::get(Type::getVoidTy(*context), params, false);
+    Function *wrapper = Function::Create(ft, Function::ExternalLinkage, name, module.get());
+    for (unsigned i = 0; i <= numArgs; i++) {
+        Argument *arg = wrapper->getArg(i);
+        arg->setName(i < numArgs ? scalar->getArg(i)->getName() : "out");
+        arg->addAttr(Attribute::NoAlias);
+        arg->addAttr(Attribute::NoCapture);
+        arg->addAttr(i < numArgs ? Attribute::ReadOnly : Attribute::WriteOnly);
+    }
+    Argument *out = wrapper->getArg(numArgs);
+    Argument *n = wrapper->getArg(numArgs + 1);
+    n->setName("n");
+
+    BasicBlock *entryBB = BasicBlock::Create(*context, "entry", wrapper);
+    BasicBlock *loopBB = BasicBlock::Create(*context, "loop", wrapper);
+    BasicBlock *exitBB = BasicBlock::Create(*context, "exit", wrapper);
+    builder.SetInsertPoint(entryBB);
+    Value *zero = ConstantInt::get(sizeTy, 0);
+    builder.CreateCondBr(builder.CreateICmpEQ(n, zero, "empty"), exitBB, loopBB);
+    builder.SetInsertPoint(loopBB);
+    PHINode *i = builder.CreatePHI(sizeTy, 2, "i");
+    i->addIncoming(zero, entryBB);
+    std::vector<Value *> argsV;
+    for (unsigned k = 0; k < numArgs; k++) {
+        Value *ptr = builder.CreateInBoundsGEP(doubleTy, wrapper->getArg(k), i);
+        argsV.push_back(builder.CreateLoad(doubleTy, ptr, scalar->getArg(k)->getName()));
+    }
+    CallInst *call = builder.CreateCall(scalar, argsV, "val");
+    builder.CreateStore(call, builder.CreateInBoundsGEP(doubleTy, out, i));
+    Value *next = builder.CreateNUWAdd(i, ConstantInt::get(sizeTy, 1), "next");
+    i->addIncoming(next, loopBB);
+    BranchInst *br = builder.CreateCondBr(builder.CreateICmpEQ(next, n, "done"),
+                                          exitBB, loopBB);
+    // the caller opted in with @batch, so vectorize whenever it is legal
+    Metadata *enable[] = {
+        MDString::get(*context, "llvm.loop.vectorize.enable"),
+        ConstantAsMetadata::get(builder.getTrue())
+    };
+    MDNode *loopID = MDNode::getDistinct(*context, {nullptr, MDNode::get(*context, enable)});
+    loopID->replaceOperandWith(0, loopID);
+    br->setMetadata(LLVMContext::MD_loop, loopID);
+    builder.SetInsertPoint(exitBB);
+    builder.CreateRetVoid();
+
+    InlineFunctionInfo ifi;
+    InlineFunction(*call, ifi);
+    verifyFunction(*wrapper);
+    return wrapper;
+}
+
+
+// the LLVM type of a prototype, from its argument and result kinds
+FunctionType *CodeGenVisitor::prototypeType(PrototypeAST *node) {
+    std::vector<Type *> params;
+    for (ValueKind kind : node->argKinds)
+        params.push_back(valueType(kind));
+    return FunctionType::get(valueType(node->resultKind), params, false);
+}
+
+
 // for PrototypeAST
 Function *CodeGenVisitor::visit(PrototypeAST *node) {
-    std::vector<Type *> doubles(node->args.size(), Type::getDoubleTy(*context));
-    FunctionType *ft = FunctionType::get(Type::getDoubleTy(*context), doubles, false);
+    FunctionType *ft = prototypeType(node);
     Function *f = Function::Create(ft, Function::ExternalLinkage, node->name, module.get());
     unsigned idx = 0;
     for (auto &arg : f->args())
         arg.setName(node->args[idx++]);
+    if (!node->name.empty())
+        functionProtos[node->name] = ft;
     return f;
 }
 
 
+// collect the top-level expressions, in source order, into an appending
+// array, linking modules together concatenates the arrays in link order
+GlobalVariable *CodeGenVisitor::createTopLevelList() {
+    FunctionType *ft = FunctionType::get(Type::getDoubleTy(*context), false);
+    ArrayType *listTy = ArrayType::get(ft->getPointerTo(), topLevelFunctions.size());
+    std::vector<Constant *> fns(topLevelFunctions.begin(), topLevelFunctions.end());
+    return new GlobalVariable(*module, listTy, true, GlobalValue::AppendingLinkage,
+                              ConstantArray::get(listTy, fns), "lisa.toplevel");
+}
+
+
 // #define TEST_CODEGEN
 #ifdef TEST_CODEGEN
 int main() {
@@ -0,0 +1,280 @@
+/**
+ * @file consteval.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "consteval.h"
+#include <cmath>
+#include "profiler.h"
+
+
+// evaluate a subexpression, stop as soon as a return has fired
+#define EVAL(expr, val) \
+    if (!eval((expr), frame, (val))) return false; \
+    if (frame.returned) return true;
+
+
+namespace lisa
+{
+// variables of one interpreted call, flat like the codegen's namedValues
+struct ConstEvaluator::Frame {
+    std::map<std::string, double> vars;
+    unsigned depth;
+    bool returned = false;
+    double retVal = 0;
+};
+
+
+// conditions are compared as (x != 0) with an ordered compare, as in codegen
+static bool isTrue(double x) {
+    return !std::isnan(x) && x != 0;
+}
+
+
+// the binary operators codegen supports, with the same IEEE semantics
+// comparisons are unordered, so NaN compares true
+static bool applyBinop(char op, double lhs, double rhs, double &result) {
+    bool unordered = std::isnan(lhs) || std::isnan(rhs);
+    switch (op) {
+        case '+': result = lhs + rhs; return true;
+        case '-': result = lhs - rhs; return true;
+        case '*': result = lhs * rhs; return true;
+        case '/': result = lhs / rhs; return true;
+        case '<': result = unordered || lhs < rhs; return true;
+        case '>': result = unordered || lhs > rhs; return true;
+        case '=': result = unordered || lhs == rhs; return true;
+        default:  return false;
+    }
+}
+
+
+void ConstEvaluator::fold(FunctionAST &fn) {
+    PhaseScope scope(PHASE_CONST_EVAL, fn.proto->name);
+    foldAll(fn.body);
+}
+
+
+void ConstEvaluator::remember(std::unique_ptr<FunctionAST> fn) {
+    // top-level expressions cannot be called
+    if (!fn || fn->proto->name.empty())
+        return;
+    // a call that failed on an extern may succeed now it is defined
+    for (auto it = folded.begin(); it != folded.end();)
+        it = it->second.first ? std::next(it) : folded.erase(it);
+    functions[fn->proto->name] = std::move(fn);
+}
+
+
+void ConstEvaluator::foldAll(std::vector<std::unique_ptr<ExprAST>> &exprs) {
+    for (auto &expr : exprs)
+        expr = fold(std::move(expr));
+}
+
+
+std::unique_ptr<ExprAST> ConstEvaluator::fold(std::unique_ptr<ExprAST> expr) {
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr.get())) {
+        bin->rhs = fold(std::move(bin->rhs));
+        if (bin->op == ':')
+            return expr;
+        bin->lhs = fold(std::move(bin->lhs));
+        auto *lhs = dynamic_cast<NumberExprAST*>(bin->lhs.get());
+        auto *rhs = dynamic_cast<NumberExprAST*>(bin->rhs.get());
+        double result;
+        if (lhs && rhs && applyBinop(bin->op, lhs->val, rhs->val, result))
+            return std::make_unique<NumberExprAST>(result);
+    }
+    else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr.get())) {
+        ifExpr->cond = fold(std::move(ifExpr->cond));
+        foldAll(ifExpr->if_body);
+        foldAll(ifExpr->els_body);
+    }
+    else if (auto *forExpr = dynamic_cast<ForExprAST*>(expr.get())) {
+        forExpr->start = fold(std::move(forExpr->start));
+        forExpr->end = fold(std::move(forExpr->end));
+        if (forExpr->step)
+            forExpr->step = fold(std::move(forExpr->step));
+        foldAll(forExpr->body);
+    }
+    else if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr.get())) {
+        whileExpr->cond = fold(std::move(whileExpr->cond));
+        foldAll(whileExpr->body);
+    }
+    else if (auto *ret = dynamic_cast<ReturnExprAST*>(expr.get())) {
+        ret->expr = fold(std::move(ret->expr));
+    }
+    else if (auto *tensor = dynamic_cast<TensorExprAST*>(expr.get())) {
+        foldAll(tensor->elements);
+    }
+    else if (auto *index = dynamic_cast<IndexExprAST*>(expr.get())) {
+        index->tensor = fold(std::move(index->tensor));
+        foldAll(index->indices);
+    }
+    else if (auto *fused = dynamic_cast<FusedExprAST*>(expr.get())) {
+        fused->root = fold(std::move(fused->root));
+    }
+    else if (auto *callExpr = dynamic_cast<CallExprAST*>(expr.get())) {
+        foldAll(callExpr->args);
+        CallKey key(callExpr->callee, {});
+        for (auto &arg : callExpr->args) {
+            auto *num = dynamic_cast<NumberExprAST*>(arg.get());
+            // NaN would break the ordering of the cache
+            if (!num || std::isnan(num->val))
+                return expr;
+            key.second.push_back(num->val);
+        }
+        auto it = folded.find(key);
+        if (it == folded.end()) {
+            remaining = fuel;
+            double result = 0;
+            bool ok = call(key.first, key.second, 0, result);
+            it = folded.insert({key, {ok, result}}).first;
+        }
+        if (it->second.first)
+            return std::make_unique<NumberExprAST>(it->second.second);
+    }
+    return expr;
+}
+
+
+// interpret a call, false if it cannot be evaluated at compile time
+bool ConstEvaluator::call(const std::string &callee, const std::vector<double> &args,
+                          unsigned depth, double &result) {
+    auto it = functions.find(callee);
+    if (it == functions.end() || depth > maxDepth)
+        return false;
+    FunctionAST *fn = it->second.get();
+    // only scalars are interpreted
+    if (fn->proto->args.size() != args.size() || fn->proto->usesTensors())
+        return false;
+    Frame frame;
+    frame.depth = depth;
+    for (size_t i = 0; i < args.size(); i++)
+        frame.vars[fn->proto->args[i]] = args[i];
+    double value = 0;
+    if (!evalAll(fn->body, frame, value))
+        return false;
+    result = frame.returned ? frame.retVal : value;
+    return true;
+}
+
+
+// the value of a body is its last expression, 0 if it is empty
+bool ConstEvaluator::evalAll(std::vector<std::unique_ptr<ExprAST>> &exprs,
+                             Frame &frame, double &result) {
+    for (auto &expr : exprs) {
+        EVAL(expr.get(), result)
+    }
+    return true;
+}
+
+
+// mirrors CodeGenVisitor, loops run their body before the condition
+bool ConstEvaluator::eval(ExprAST *expr, Frame &frame, double &result) {
+    if (remaining == 0)
+        return false;
+    remaining--;
+
+    if (auto *num = dynamic_cast<NumberExprAST*>(expr)) {
+        result = num->val;
+        return true;
+    }
+    if (auto *var = dynamic_cast<VariableExprAST*>(expr)) {
+        auto it = frame.vars.find(var->name);
+        if (it == frame.vars.end())
+            return false;
+        result = it->second;
+        return true;
+    }
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+        if (bin->op == ':') {
+            auto *lhs = dynamic_cast<VariableExprAST*>(bin->lhs.get());
+            if (!lhs)
+                return false;
+            EVAL(bin->rhs.get(), result)
+            frame.vars[lhs->name] = result;
+            return true;
+        }
+        double lhs, rhs;
+        EVAL(bin->lhs.get(), lhs)
+        EVAL(bin->rhs.get(), rhs)
+        return applyBinop(bin->op, lhs, rhs, result);
+    }
+    if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr)) {
+        double cond;
+        EVAL(ifExpr->cond.get(), cond)
+        result = 0;
+        return evalAll(isTrue(cond) ? ifExpr->if_body : ifExpr->els_body,
+                       frame, result);
+    }
+    if (auto *forExpr = dynamic_cast<ForExprAST*>(expr)) {
+        double start, step = 1, end, value;
+        EVAL(forExpr->start.get(), start)
+        // the loop variable shadows an outer one until the loop ends
+        auto outer = frame.vars.find(forExpr->var_name);
+        bool shadows = outer != frame.vars.end();
+        double outerVal = shadows ? outer->second : 0;
+        frame.vars[forExpr->var_name] = start;
+        bool more;
+        do {
+            if (!evalAll(forExpr->body, frame, value))
+                return false;
+            if (frame.returned)
+                return true;
+            if (forExpr->step) {
+                EVAL(forExpr->step.get(), step)
+            }
+            EVAL(forExpr->end.get(), end)
+            double next = frame.vars[forExpr->var_name] + step;
+            frame.vars[forExpr->var_name] = next;
+            more = !std::isnan(end) && !std::isnan(next) && end != next;
+        } while (more);
+        if (shadows)
+            frame.vars[forExpr->var_name] = outerVal;
+        else
+            frame.vars.erase(forExpr->var_name);
+        result = 0;
+        return true;
+    }
+    if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr)) {
+        double value, cond;
+        do {
+            if (!evalAll(whileExpr->body, frame, value))
+                return false;
+            if (frame.returned)
+                return true;
+            EVAL(whileExpr->cond.get(), cond)
+        } while (isTrue(cond));
+        result = 0;
+        return true;
+    }
+    if (auto *ret = dynamic_cast<ReturnExprAST*>(expr)) {
+        EVAL(ret->expr.get(), result)
+        frame.returned = true;
+        frame.retVal = result;
+        return true;
+    }
+    if (auto *callExpr = dynamic_cast<CallExprAST*>(expr)) {
+        std::vector<double> args;
+        for (auto &arg : callExpr->args) {
+            double value;
+            EVAL(arg.get(), value)
+            args.push_back(value);
+        }
+        return call(callExpr->callee, args, frame.depth + 1, result);
+    }
+    if (auto *fused = dynamic_cast<FusedExprAST*>(expr)) {
+        // the evaluator only sees scalars, and a reduction of a scalar is
+        // the scalar itself
+        EVAL(fused->root.get(), result)
+        for (auto &reduction : fused->reductions)
+            if (!reduction.var.empty())
+                frame.vars[reduction.var] = result;
+        return true;
+    }
+    return false;
+}
+}
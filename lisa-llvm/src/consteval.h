@@ -0,0 +1,65 @@
+/**
+ * @file consteval.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef CONSTEVAL_H
+#define CONSTEVAL_H
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include "ast.h"
+
+
+namespace lisa
+{
+// compile-time evaluation on the AST, run before code generation
+// constant subtrees are folded into numbers, and calls to Lisa functions
+// with constant arguments are interpreted and replaced by their result
+// a call is only evaluated if every function it reaches was defined
+// earlier in the file (externs are never called), since Lisa functions
+// have no other side effects that makes the result exact
+// the interpreter gives up, leaving the runtime call, when it runs out of
+// fuel (evaluated nodes per call) or the call depth gets too large
+class ConstEvaluator
+{
+public:
+    explicit ConstEvaluator(uint64_t fuel = 1000000, unsigned maxDepth = 256) :
+        fuel(fuel), maxDepth(maxDepth) {}
+
+    // fold the body of a function in place
+    void fold(FunctionAST &fn);
+    // keep a folded definition so later calls to it can be evaluated
+    void remember(std::unique_ptr<FunctionAST> fn);
+
+private:
+    struct Frame;
+    std::unique_ptr<ExprAST> fold(std::unique_ptr<ExprAST> expr);
+    void foldAll(std::vector<std::unique_ptr<ExprAST>> &exprs);
+    bool call(const std::string &callee, const std::vector<double> &args,
+              unsigned depth, double &result);
+    bool eval(ExprAST *expr, Frame &frame, double &result);
+    bool evalAll(std::vector<std::unique_ptr<ExprAST>> &exprs, Frame &frame,
+                 double &result);
+
+    std::map<std::string, std::unique_ptr<FunctionAST>> functions;
+    // outcome of every call folded so far, a call that ran out of fuel
+    // once is not tried again
+    typedef std::pair<std::string, std::vector<double>> CallKey;
+    std::map<CallKey, std::pair<bool, double>> folded;
+    uint64_t fuel;
+    unsigned maxDepth;
+    uint64_t remaining = 0;     // fuel left for the current evaluation
+};
+}
+
+
+#endif
@@ -8,78 +8,213 @@
  */
 
 #include <getopt.h>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
+#include "profiler.h"
+#include "linker.h"
+#include "optimizer.h"
+#include "consteval.h"
+#include "escape.h"
+#include "fusion.h"
+#include "shapes.h"
+#include "cheader.h"
+#include "multiversion.h"
+#include "queue.h"
+#include "server.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
 
 
 bool debug = false; // tidy this up later !!!
+unsigned jobs = 1;             // number of worker threads (-j)
+std::string linkedOutput;      // single linked object (-m), empty if unused
+bool timeReport = false;       // print per-phase timings (-ftime-report)
+bool timeTrace = false;        // write a chrome trace (-ftime-trace[=file])
+std::string timeTraceFile;
+lisa::OutputKind outputKind = lisa::OUTPUT_OBJECT;
+std::string outputFile;        // linked output (-o)
+lisa::OptimizerOptions optOptions; // -O<n>, -fprofile-generate, -fprofile-use
+unsigned streamBatch = 0;      // functions per streamed batch (-fstream), 0 if off
+unsigned pipelineDepth = 0;    // parsed items queued ahead of codegen (-fpipeline), 0 if off
+bool constEval = true;         // compile-time evaluation (-fno-const-eval to disable)
+bool fusion = true;            // element-wise fusion (-fno-fusion to disable)
+uint64_t constEvalFuel = 1000000; // nodes one evaluated call may run (-fconst-eval-fuel)
+unsigned parallelCodegen = 1;  // module partitions emitted in parallel (-fparallel-codegen)
+std::vector<unsigned> multiversionLevels; // x86-64 levels to clone for (-fmultiversion)
+bool emitLLVM = false;         // write LLVM IR instead of machine code (-emit-llvm)
+bool textOutput = false;       // textual IR or assembly instead of binary (-S)
+std::string headerFile;        // C header of the exported functions (-header), empty if unused
 
 
-// handle definition
-static void handleDefinition(Lexer *lex, CodeGenVisitor *codegen) {
-    if (auto fnAST = Definition(lex)) {
-        if (auto *fnIR = fnAST->accept(*codegen)) {
-            if (debug) {
-                fprintf(stderr, "\033[1;34m->\033[0m Read function definition:\n");
-                fnIR->print(errs());
-            }
+// options without a single-letter form
+enum LongOption {
+    OPT_SHARED = 256,
+    OPT_STATIC_LIB,
+    OPT_HEADER,
+    OPT_EMIT_LLVM,
+};
+
+
+static const struct option longOptions[] = {
+    {"shared", no_argument, nullptr, OPT_SHARED},
+    {"static-lib", no_argument, nullptr, OPT_STATIC_LIB},
+    {"header", required_argument, nullptr, OPT_HEADER},
+    {"emit-llvm", no_argument, nullptr, OPT_EMIT_LLVM},
+    {nullptr, 0, nullptr, 0}
+};
+
+
+// one parsed definition, extern or top-level expression
+// the AST is null if it failed to parse
+struct ParsedItem {
+    enum Kind {DEFINITION, EXTERN, TOPLEVEL, END} kind = END;
+    std::unique_ptr<FunctionAST> fnAST;
+    std::unique_ptr<PrototypeAST> protoAST;
+};
+
+
+// parse the next item of the file
+static ParsedItem parseItem(Lexer *lex) {
+    ParsedItem item;
+    Token t = lex->peekTok();
+    if (t.tp == TOK_EOF)
+        return item;
+    // decorators start a definition
+    if (t.tp == TOK_SYM && t.lx == "@")
+        t.tp = TOK_FN;
+    {
+        lisa::PhaseScope scope(lisa::PHASE_PARSE);
+        switch (t.tp) {
+            case TOK_FN:
+                item.kind = ParsedItem::DEFINITION;
+                item.fnAST = Definition(lex);
+                break;
+            case TOK_EXTERN:
+                item.kind = ParsedItem::EXTERN;
+                item.protoAST = Extern(lex);
+                break;
+            default:
+                item.kind = ParsedItem::TOPLEVEL;
+                item.fnAST = TopLevelExpr(lex);
+                break;
         }
-    } else {
-        lex->getTok();
     }
+    // skip the offending token
+    if (!item.fnAST && !item.protoAST)
+        lex->getTok();
+    return item;
 }
 
 
-// handle extern
-static void handleExtern(Lexer *lex, CodeGenVisitor *codegen) {
-    if (auto protoAST = Extern(lex)) {
-        if (auto *fnIR = protoAST->accept(*codegen)) {
-            if (debug) {
-                fprintf(stderr, "\033[1;34m->\033[0m Read extern:\n");
-                fnIR->print(errs());
-            }
-        }
-    } else {
-        lex->getTok();
-    }
+// evaluator for one file, null if -fno-const-eval
+static std::unique_ptr<lisa::ConstEvaluator> createEvaluator() {
+    if (!constEval)
+        return nullptr;
+    return std::make_unique<lisa::ConstEvaluator>(constEvalFuel);
 }
 
 
-// handle top-level expression
-static void handleTopLevelExpr(Lexer *lex, CodeGenVisitor *codegen) {
-    if (auto fnAST = TopLevelExpr(lex)) {
-        if (auto *fnIR = fnAST->accept(*codegen)) {
-            if (debug) {
-                fprintf(stderr, "\033[1;34m->\033[0m Read top-level expression:\n");
-                fnIR->print(errs());
-            }
+// generate code for a parsed item, false if it failed to parse or had
+// an error, which was already printed
+// with an evaluator the AST is folded first, and definitions are kept
+// afterwards so calls to them in later items can be evaluated
+// element-wise expressions are fused after folding, then the tensor
+// shapes inferred, an item with a shape error is not generated, and
+// tensors that do not escape are moved to the stack
+static bool handleItem(ParsedItem &item, CodeGenVisitor *codegen,
+                       lisa::ConstEvaluator *evaluator,
+                       lisa::ShapeInference &shapes) {
+    static const char *what[] = {
+        "function definition", "extern", "top-level expression"
+    };
+    Function *fnIR = nullptr;
+    if (item.fnAST) {
+        if (evaluator)
+            evaluator->fold(*item.fnAST);
+        if (fusion)
+            lisa::fuseFunction(*item.fnAST);
+        if (shapes.infer(*item.fnAST)) {
+            lisa::analyzeEscapes(*item.fnAST);
+            fnIR = item.fnAST->accept(*codegen);
         }
-    } else {
-        lex->getTok();
     }
+    else if (item.protoAST)
+        fnIR = item.protoAST->accept(*codegen);
+    if (fnIR && debug) {
+        fprintf(stderr, "\033[1;34m->\033[0m Read %s:\n", what[item.kind]);
+        fnIR->print(errs());
+    }
+    if (fnIR && evaluator && item.kind == ParsedItem::DEFINITION)
+        evaluator->remember(std::move(item.fnAST));
+    return fnIR != nullptr;
 }
 
 
-// main loop
-static void mainLoop(Lexer *lex, CodeGenVisitor *codegen) {
+// main loop, returns the number of items with errors
+// afterFunction, if set, runs after every definition or top-level expression
+static unsigned mainLoop(Lexer *lex, CodeGenVisitor *codegen,
+                         const std::function<void()> &afterFunction = nullptr) {
+    auto evaluator = createEvaluator();
+    lisa::ShapeInference shapes;
+    unsigned errors = 0;
     while (true) {
-        Token t = lex->peekTok();
-        switch (t.tp) {
-            case TOK_EOF:
-                return;
-            case TOK_FN:
-                handleDefinition(lex, codegen);
-                break;
-            case TOK_EXTERN:
-                handleExtern(lex, codegen);
-                break;
-            default:
-                handleTopLevelExpr(lex, codegen);
+        ParsedItem item = parseItem(lex);
+        if (item.kind == ParsedItem::END)
+            return errors;
+        if (!handleItem(item, codegen, evaluator.get(), shapes))
+            errors++;
+        if (afterFunction && item.kind != ParsedItem::EXTERN)
+            afterFunction();
+    }
+}
+
+
+// pipelined main loop (-fpipeline)
+// a parser thread runs ahead and hands the ASTs over through a bounded
+// queue, so lexing and parsing overlap with codegen and the function
+// passes on this thread, items are still generated in source order
+static unsigned pipelineLoop(Lexer *lex, CodeGenVisitor *codegen,
+                             const std::function<void()> &afterFunction = nullptr) {
+    lisa::SPSCQueue<ParsedItem> queue(pipelineDepth);
+    std::thread parser([&]() {
+        lisa::profilerThreadBegin();
+        while (true) {
+            ParsedItem item = parseItem(lex);
+            bool end = item.kind == ParsedItem::END;
+            queue.push(std::move(item));
+            if (end)
                 break;
         }
+        lisa::profilerThreadEnd();
+    });
+    auto evaluator = createEvaluator();
+    lisa::ShapeInference shapes;
+    unsigned errors = 0;
+    while (true) {
+        ParsedItem item = queue.pop();
+        if (item.kind == ParsedItem::END)
+            break;
+        if (!handleItem(item, codegen, evaluator.get(), shapes))
+            errors++;
+        if (afterFunction && item.kind != ParsedItem::EXTERN)
+            afterFunction();
     }
+    parser.join();
+    return errors;
 }
 
 
@@ -92,20 +227,152 @@ static void initEnv() {
 }
 
 
+// parse -f<feature> options
+static void parseFeatureOpt(const std::string &feature) {
+    if (feature == "time-report")
+        timeReport = true;
+    else if (feature == "time-trace")
+        timeTrace = true;
+    else if (feature.compare(0, 11, "time-trace=") == 0) {
+        timeTrace = true;
+        timeTraceFile = feature.substr(11);
+    }
+    else if (feature == "profile-generate")
+        optOptions.profileGenerate = true;
+    else if (feature.compare(0, 17, "profile-generate=") == 0) {
+        optOptions.profileGenerate = true;
+        optOptions.profileDir = feature.substr(17);
+    }
+    else if (feature.compare(0, 12, "profile-use=") == 0)
+        optOptions.profileUse = feature.substr(12);
+    else if (feature == "stream")
+        streamBatch = 64;
+    else if (feature.compare(0, 7, "stream=") == 0)
+        streamBatch = std::max(1, atoi(feature.substr(7).c_str()));
+    else if (feature == "no-specialize")
+        optOptions.specialize = false;
+    else if (feature.compare(0, 18, "specialize-budget=") == 0)
+        optOptions.specializeOptions.budget = atoi(feature.substr(18).c_str());
+    else if (feature.compare(0, 22, "specialize-max-clones=") == 0)
+        optOptions.specializeOptions.maxClones = atoi(feature.substr(22).c_str());
+    else if (feature == "no-const-eval")
+        constEval = false;
+    else if (feature == "no-fusion")
+        fusion = false;
+    else if (feature == "no-vector-math")
+        optOptions.vectorMath = false;
+    else if (feature.compare(0, 16, "const-eval-fuel=") == 0)
+        constEvalFuel = strtoull(feature.substr(16).c_str(), nullptr, 10);
+    else if (feature == "pipeline")
+        pipelineDepth = 64;
+    else if (feature.compare(0, 9, "pipeline=") == 0)
+        pipelineDepth = std::max(1, atoi(feature.substr(9).c_str()));
+    else if (feature == "lto" || feature == "lto=full")
+        optOptions.lto = lisa::LTO_FULL;
+    else if (feature == "lto=thin")
+        optOptions.lto = lisa::LTO_THIN;
+    else if (feature.compare(0, 17, "parallel-codegen=") == 0)
+        parallelCodegen = std::max(1, atoi(feature.substr(17).c_str()));
+    else if (feature == "multiversion")
+        multiversionLevels = {2, 3, 4};
+    else if (feature.compare(0, 13, "multiversion=") == 0) {
+        // a comma separated list of v2, v3 and v4
+        multiversionLevels.clear();
+        std::stringstream levels(feature.substr(13));
+        std::string level;
+        while (std::getline(levels, level, ',')) {
+            if (level != "v2" && level != "v3" && level != "v4") {
+                std::cerr << "Invalid x86-64 level: " << level << "\n";
+                exit(1);
+            }
+            multiversionLevels.push_back(level[1] - '0');
+        }
+        std::sort(multiversionLevels.begin(), multiversionLevels.end());
+        multiversionLevels.erase(std::unique(multiversionLevels.begin(),
+            multiversionLevels.end()), multiversionLevels.end());
+    }
+    else {
+        std::cerr << "Invalid option: -f" << feature << "\n";
+        exit(1);
+    }
+}
+
+
 // parse options
 static void parseOpt(int argc, char **argv) {
     int opt;
-    while ((opt = getopt(argc, argv, "dhv")) != -1) {
+    while ((opt = getopt_long_only(argc, argv, "dhvSj:m:f:o:O:", 
+                                   longOptions, nullptr)) != -1) {
         switch (opt) {
             case 'd':
                 debug = true;
                 break;
+            case 'j':
+                jobs = std::max(1, atoi(optarg));
+                break;
+            case 'm':
+                linkedOutput = optarg;
+                break;
+            case 'f':
+                parseFeatureOpt(optarg);
+                break;
+            case 'o':
+                outputFile = optarg;
+                if (outputKind == lisa::OUTPUT_OBJECT)
+                    outputKind = lisa::OUTPUT_EXECUTABLE;
+                break;
+            case 'O':
+                optOptions.level = std::min(3, std::max(0, atoi(optarg)));
+                break;
+            case OPT_SHARED:
+                outputKind = lisa::OUTPUT_SHARED;
+                break;
+            case OPT_STATIC_LIB:
+                outputKind = lisa::OUTPUT_STATIC_LIB;
+                break;
+            case OPT_HEADER:
+                headerFile = optarg;
+                break;
+            case OPT_EMIT_LLVM:
+                emitLLVM = true;
+                break;
+            case 'S':
+                textOutput = true;
+                break;
             case 'h':
                 std::cout << "Usage: " << argv[0] 
-                    << " [options] <input_file>" << std::endl;
+                    << " [options] <input_files>" << std::endl;
                 std::cout << "Available options:" << std::endl;
                 std::cout << "-h:  Display this information" << std::endl;
                 std::cout << "-v:  Display version information" << std::endl;
+                std::cout << "-j <n>:  Compile input files on n threads" << std::endl;
+                std::cout << "-m <file>:  Link all inputs into a single object file" << std::endl;
+                std::cout << "-o <file>:  Link an executable that runs the top-level expressions" << std::endl;
+                std::cout << "-shared:  Link a shared library instead, use with -o" << std::endl;
+                std::cout << "-static-lib:  Write a static library instead, use with -o" << std::endl;
+                std::cout << "-emit-llvm:  Write LLVM bitcode instead of object files (.bc)" << std::endl;
+                std::cout << "-S:  Write textual output, LLVM IR with -emit-llvm (.ll) or assembly (.s)" << std::endl;
+                std::cout << "-header <file>:  Write a C header declaring the exported functions" << std::endl;
+                std::cout << "-O<n>:  Run the whole-module optimization pipeline at level n (0-3)" << std::endl;
+                std::cout << "-fprofile-generate[=<dir>]:  Instrument the code to write a PGO profile" << std::endl;
+                std::cout << "-fprofile-use=<file>:  Optimize with a profile merged by llvm-profdata" << std::endl;
+                std::cout << "-fno-specialize:  Do not clone functions for constant arguments (-O2 and up)" << std::endl;
+                std::cout << "-fspecialize-budget=<n>:  Instructions clones may add in total (default 4000)" << std::endl;
+                std::cout << "-fspecialize-max-clones=<n>:  Clones made per module (default 16)" << std::endl;
+                std::cout << "-fno-const-eval:  Do not fold constants and pure calls at compile time" << std::endl;
+                std::cout << "-fconst-eval-fuel=<n>:  Give up evaluating a call after n steps (default 1000000)" << std::endl;
+                std::cout << "-fno-fusion:  Evaluate every element-wise tensor operation in its own loop" << std::endl;
+                std::cout << "-fno-vector-math:  Call libm per element in vectorized loops instead of the runtime's SIMD math" << std::endl;
+                std::cout << "-flto[=thin]:  Write bitcode for link-time optimization, with a ThinLTO summary for thin" << std::endl;
+                std::cout << "-fparallel-codegen=<n>:  Split each module and emit the parts on n threads" << std::endl;
+                std::cout << "-fmultiversion[=v2,v3,v4]:  Clone exported functions per x86-64 level, picked at load time" << std::endl;
+                std::cout << "-fpipeline[=<n>]:  Parse on a separate thread, up to n items ahead (default 64)" << std::endl;
+                std::cout << "-fstream[=<n>]:  Emit and free every n functions (default 64)" << std::endl;
+                std::cout << "--server[=<socket>] [-j <n>]:  Stay resident and compile requests on n processes (first argument)" << std::endl;
+                std::cout << "--client[=<socket>] <args>:  Compile on the server, or here if none is running (first argument)" << std::endl;
+                std::cout << "--server-stats[=<socket>]:  Print the request latencies of a running server" << std::endl;
+                std::cout << "-ftime-report:  Print time spent in each compiler phase" << std::endl;
+                std::cout << "-ftime-trace[=<file>]:  Write a Chrome trace of the compilation" << std::endl;
                 exit(0);
             case 'v':
                 std::cout << "Lisa Compiler v0.1.2" << std::endl;
@@ -116,77 +383,574 @@ static void parseOpt(int argc, char **argv) {
                 exit(1);
         }
     }
+    if (outputKind != lisa::OUTPUT_OBJECT && outputFile.empty()) {
+        std::cerr << "-shared and -static-lib need an output file (-o)\n";
+        exit(1);
+    }
+    if (streamBatch && (!linkedOutput.empty() || outputKind == lisa::OUTPUT_EXECUTABLE)) {
+        std::cerr << "-fstream cannot be used with -m or executables, "
+            "they need the whole module\n";
+        exit(1);
+    }
+    // bitcode has to go through an LTO-capable linker, lisa links machine code
+    bool bitcode = emitLLVM || optOptions.lto != lisa::LTO_NONE;
+    if ((bitcode || textOutput) && (outputKind == lisa::OUTPUT_EXECUTABLE || 
+                                    outputKind == lisa::OUTPUT_SHARED)) {
+        std::cerr << "-emit-llvm, -flto and -S cannot be linked by lisa, "
+            "link the output with an LTO-capable linker instead\n";
+        exit(1);
+    }
+    if (streamBatch && (bitcode || textOutput)) {
+        std::cerr << "-fstream cannot be used with -emit-llvm, -flto or -S\n";
+        exit(1);
+    }
+    if (streamBatch && !multiversionLevels.empty()) {
+        std::cerr << "-fstream cannot be used with -fmultiversion\n";
+        exit(1);
+    }
+    if (optOptions.profileGenerate && !optOptions.profileUse.empty()) {
+        std::cerr << "-fprofile-generate and -fprofile-use are exclusive\n";
+        exit(1);
+    }
 }
 
 
-// parse input file name
-static std::string parseFilenames(int argc, char **argv) {
-    std::string inputFilename;
-    std::string outputFilename;
-    if (argc < 2) {
+// parse input file names
+static std::vector<std::string> parseFilenames(int argc, char **argv) {
+    if (optind >= argc) {
         std::cerr << "Missing input file\n";
         exit(1);
     }
-    inputFilename = argv[argc - 1];
-    size_t lastDot = inputFilename.find_last_of('.');
-    if (lastDot == std::string::npos)
-        outputFilename = inputFilename + ".o";
-    else
-        outputFilename = inputFilename.substr(0, lastDot) + ".o";
-    return outputFilename;
+    return std::vector<std::string>(argv + optind, argv + argc);
 }
 
 
-// main driver code
-int main(int argc, char **argv) {
-    // Initialize the environment
-    initEnv();
+// derive the object file name from an input file name
+// LTO bitcode keeps the .o extension, as with clang -flto
+static std::string objectFilename(const std::string &inputFilename) {
+    std::string ext = textOutput ? (emitLLVM ? ".ll" : ".s") 
+        : emitLLVM ? ".bc" : ".o";
+    size_t lastDot = inputFilename.find_last_of('.');
+    if (lastDot == std::string::npos)
+        return inputFilename + ext;
+    return inputFilename.substr(0, lastDot) + ext;
+}
 
-    // Parse command line arguments
-    parseOpt(argc, argv);
-    std::string outputFile;
-    outputFile = parseFilenames(argc, argv);
 
-    // Create the lexer and codegen visitor
-    auto lex = std::make_unique<Lexer>(argv[argc - 1]);
-    auto codegen = std::make_unique<CodeGenVisitor>();
+// built ahead by the compile server, handed to the first caller
+static std::unique_ptr<TargetMachine> warmTargetMachine;
+static std::mutex warmTargetMachineLock;
 
-    // start the main loop
-    mainLoop(lex.get(), codegen.get());
 
-    // configure target
+// create a target machine for the host
+// each worker owns one, target machines are not shared between threads
+static std::unique_ptr<TargetMachine> createTargetMachine() {
+    {
+        std::lock_guard<std::mutex> lock(warmTargetMachineLock);
+        if (warmTargetMachine)
+            return std::move(warmTargetMachine);
+    }
     std::string error;
     auto targetTriple = llvm::sys::getDefaultTargetTriple();
     auto target = TargetRegistry::lookupTarget(targetTriple, error);
     if (!target) {
         errs() << error;
-        return 1;
+        return nullptr;
     }
     auto cpu = "generic";
     auto features = "";
     TargetOptions opt;
-    auto rm = Optional<Reloc::Model>();
-    auto targetMachine = target->createTargetMachine(
-        targetTriple, cpu, features, opt, rm);
-    auto module = codegen->borrowModule();
-    module->setDataLayout(targetMachine->createDataLayout());
-    module->setTargetTriple(targetTriple);
+    auto rm = Optional<Reloc::Model>(Reloc::PIC_);
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+        targetTriple, cpu, features, opt, rm));
+}
+
 
-    // write to file
+// run the backend on a module as it is and write an object file
+static bool emitModule(Module *module, TargetMachine *targetMachine,
+                       const std::string &outputFile) {
     std::error_code ec;
     raw_fd_ostream dest(outputFile, ec, sys::fs::OF_None);
     if (ec) {
         errs() << "Could not open file: " << ec.message();
-        return 1;
+        return false;
     }
     legacy::PassManager pass;
-    auto fileType = CGFT_ObjectFile;
+    auto fileType = textOutput ? CGFT_AssemblyFile : CGFT_ObjectFile;
     if (targetMachine->addPassesToEmitFile(pass, dest, nullptr, fileType)) {
         errs() << "TargetMachine can't emit a file of this type";
-        return 1;
+        return false;
+    }
+    {
+        lisa::PhaseScope scope(lisa::PHASE_EMIT, outputFile);
+        pass.run(*module);
     }
-    pass.run(*module);
     dest.flush();
+    return true;
+}
+
+
+// write the module as LLVM IR, with a summary for the LTO link
+static bool emitIR(Module *module, const std::string &outputFile) {
+    std::error_code ec;
+    raw_fd_ostream dest(outputFile, ec, textOutput ? sys::fs::OF_Text 
+                                                   : sys::fs::OF_None);
+    if (ec) {
+        errs() << "Could not open file: " << ec.message();
+        return false;
+    }
+    lisa::PhaseScope scope(lisa::PHASE_EMIT, outputFile);
+    // as with clang, a summary without this flag means ThinLTO
+    if (optOptions.lto == lisa::LTO_FULL)
+        module->addModuleFlag(Module::Error, "ThinLTO", 0u);
+    if (textOutput) {
+        module->print(dest, nullptr);
+        return true;
+    }
+    if (optOptions.lto == lisa::LTO_NONE) {
+        WriteBitcodeToFile(*module, dest);
+        return true;
+    }
+    ProfileSummaryInfo psi(*module);
+    ModuleSummaryIndex index = buildModuleSummaryIndex(*module, nullptr, &psi);
+    WriteBitcodeToFile(*module, dest, false, &index);
+    return true;
+}
+
+
+// split the module into partitions and run the backend on every one on
+// its own thread with its own TargetMachine, the partitioning only depends
+// on the module so the combined object is the same on every run
+static bool emitPartitioned(Module *module, const std::string &outputFile) {
+    std::string stem = outputFile.substr(0, outputFile.find_last_of('.'));
+    std::vector<std::string> parts;
+    for (unsigned i = 0; i < parallelCodegen; i++)
+        parts.push_back(stem + ".cg" + std::to_string(i) + ".o");
+    // ifuncs (-fmultiversion) would be lost by the split, they are
+    // emitted on their own
+    LLVMContext context;
+    auto dispatch = lisa::extractIFuncs(*module, context);
+    bool ok = true;
+    {
+        std::vector<std::unique_ptr<raw_fd_ostream>> streams;
+        std::vector<raw_pwrite_stream *> dests;
+        for (auto &part : parts) {
+            std::error_code ec;
+            streams.push_back(std::make_unique<raw_fd_ostream>(part, ec,
+                                                               sys::fs::OF_None));
+            if (ec) {
+                errs() << "Could not open file: " << ec.message();
+                ok = false;
+                break;
+            }
+            dests.push_back(streams.back().get());
+        }
+        if (ok) {
+            lisa::PhaseScope scope(lisa::PHASE_EMIT, outputFile);
+            // keep internal symbols such as __lisa_toplevel internal, the
+            // split puts them in the partition of their users instead
+            splitCodeGen(*module, dests, {}, createTargetMachine,
+                         CGFT_ObjectFile, true);
+        }
+    }
+    if (ok && dispatch) {
+        parts.push_back(stem + ".cg" + std::to_string(parallelCodegen) + ".o");
+        auto targetMachine = createTargetMachine();
+        ok = targetMachine && emitModule(dispatch.get(), targetMachine.get(),
+                                         parts.back());
+    }
+    ok = ok && lisa::linkObjects(lisa::OUTPUT_RELOCATABLE, parts, outputFile);
+    for (auto &part : parts)
+        sys::fs::remove(part);
+    return ok;
+}
+
+
+// optimize a module, then run the backend and write an object file
+static bool emitObjectFile(Module *module, TargetMachine *targetMachine,
+                           const std::string &outputFile) {
+    module->setDataLayout(targetMachine->createDataLayout());
+    module->setTargetTriple(targetMachine->getTargetTriple().str());
+    if (!multiversionLevels.empty() && 
+        !lisa::multiversionModule(*module, multiversionLevels))
+        errs() << "-fmultiversion needs an x86-64 ELF target, ignored\n";
+    lisa::optimizeModule(*module, targetMachine, optOptions);
+    if (emitLLVM || optOptions.lto != lisa::LTO_NONE)
+        return emitIR(module, outputFile);
+    if (parallelCodegen > 1 && !textOutput)
+        return emitPartitioned(module, outputFile);
+    return emitModule(module, targetMachine, outputFile);
+}
+
+
+// emits the functions of a module in bounded batches while the file is
+// still being compiled, then frees their IR, only declarations are kept
+// so later functions can still call them
+class BatchEmitter
+{
+public:
+    BatchEmitter(Module *module, TargetMachine *targetMachine,
+                 const std::string &objectFile) :
+        module(module), targetMachine(targetMachine), objectFile(objectFile),
+        pending(0), failed(false) {}
+
+    void functionDone() {
+        if (++pending >= streamBatch)
+            flush();
+    }
+
+    void flush() {
+        if (pending == 0 || failed)
+            return;
+        std::string stem = objectFile.substr(0, objectFile.find_last_of('.'));
+        std::string part = stem + ".part" + std::to_string(parts.size()) + ".o";
+        if (!emitObjectFile(module, targetMachine, part)) {
+            failed = true;
+            return;
+        }
+        parts.push_back(part);
+        pending = 0;
+        for (auto it = module->begin(); it != module->end();) {
+            Function &fn = *it++;
+            if (fn.isDeclaration())
+                continue;
+            // replace rather than deleteBody(), a fresh declaration does not
+            // hold on to the symbol table of the old body
+            if (!fn.hasLocalLinkage()) {
+                Function *decl = Function::Create(fn.getFunctionType(),
+                    Function::ExternalLinkage, "", module);
+                decl->takeName(&fn);
+                fn.replaceAllUsesWith(decl);
+            }
+            fn.eraseFromParent();
+        }
+        // globals only used by the emitted bodies are not needed any more
+        for (auto it = module->global_begin(); it != module->global_end();) {
+            GlobalVariable &gv = *it++;
+            if (gv.hasLocalLinkage() && gv.use_empty())
+                gv.eraseFromParent();
+        }
+    }
+
+    // remove the batches written so far, the file had errors
+    void discard() {
+        for (auto &part : parts)
+            sys::fs::remove(part);
+        parts.clear();
+    }
+
+    // combine the batches into the requested object file
+    bool finish() {
+        flush();
+        if (failed)
+            return false;
+        if (parts.empty())
+            return emitObjectFile(module, targetMachine, objectFile);
+        bool ok = parts.size() == 1
+            ? !sys::fs::rename(parts[0], objectFile)
+            : lisa::linkObjects(lisa::OUTPUT_RELOCATABLE, parts, objectFile);
+        for (auto &part : parts)
+            sys::fs::remove(part);
+        return ok;
+    }
+
+private:
+    Module *module;
+    TargetMachine *targetMachine;
+    std::string objectFile;
+    std::vector<std::string> parts;
+    unsigned pending;
+    bool failed;
+};
+
+
+// lex, parse and generate code for one input file, null if it could
+// not be read or any item in it had an error
+// every call owns its lexer, codegen visitor and LLVMContext,
+// so calls on different threads do not share any state
+static std::unique_ptr<CodeGenVisitor> compileFile(
+        const std::string &input,
+        const std::function<void(CodeGenVisitor*)> &afterFunction = nullptr) {
+    if (!sys::fs::exists(input)) {
+        std::cerr << "Error: could not open file " << input << std::endl;
+        return nullptr;
+    }
+    auto lex = std::make_unique<Lexer>(input);
+    auto codegen = std::make_unique<CodeGenVisitor>();
+    CodeGenVisitor *cg = codegen.get();
+    auto loop = pipelineDepth ? pipelineLoop : mainLoop;
+    unsigned errors = afterFunction
+        ? loop(lex.get(), cg, [&]() { afterFunction(cg); })
+        : loop(lex.get(), cg, nullptr);
+    if (errors) {
+        std::cerr << "Error: " << errors << (errors == 1 ? " error" : " errors")
+                  << " in " << input << std::endl;
+        return nullptr;
+    }
+    return codegen;
+}
+
+
+// compile one input file to its own object file
+static bool compileToObject(const std::string &input, const std::string &objectFile,
+                            std::vector<ExportedFunction> &exports) {
+    auto targetMachine = createTargetMachine();
+    if (!targetMachine)
+        return false;
+    if (streamBatch) {
+        std::unique_ptr<BatchEmitter> emitter;
+        auto codegen = compileFile(input, [&](CodeGenVisitor *cg) {
+            if (!emitter)
+                emitter = std::make_unique<BatchEmitter>(
+                    cg->borrowModule(), targetMachine.get(), objectFile);
+            emitter->functionDone();
+        });
+        if (!codegen) {
+            if (emitter)
+                emitter->discard();
+            return false;
+        }
+        exports = codegen->exports();
+        if (!emitter)
+            return emitObjectFile(codegen->borrowModule(), targetMachine.get(), 
+                                  objectFile);
+        return emitter->finish();
+    }
+    auto codegen = compileFile(input);
+    if (!codegen)
+        return false;
+    exports = codegen->exports();
+    return emitObjectFile(codegen->borrowModule(), targetMachine.get(), objectFile);
+}
+
+
+// compile one input file to an in-memory bitcode buffer
+static bool compileToBitcode(const std::string &input, 
+                             SmallVectorImpl<char> &buffer,
+                             std::vector<ExportedFunction> &exports) {
+    auto codegen = compileFile(input);
+    if (!codegen)
+        return false;
+    exports = codegen->exports();
+    if (outputKind == lisa::OUTPUT_EXECUTABLE)
+        codegen->createTopLevelList();
+    raw_svector_ostream os(buffer);
+    WriteBitcodeToFile(*codegen->borrowModule(), os);
+    return true;
+}
+
+
+// link the bitcode of every input into one module and emit it
+static bool linkAndEmit(const std::vector<std::string> &inputs,
+                        std::vector<SmallVector<char, 0>> &buffers,
+                        const std::string &objectFile) {
+    LLVMContext context;
+    auto linked = std::make_unique<Module>("lisa", context);
+    Linker linker(*linked);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        MemoryBufferRef ref(StringRef(buffers[i].data(), buffers[i].size()),
+                            inputs[i]);
+        auto module = parseBitcodeFile(ref, context);
+        if (!module) {
+            errs() << "Could not read module " << inputs[i] << ": "
+                << toString(module.takeError()) << "\n";
+            return false;
+        }
+        if (linker.linkInModule(std::move(*module))) {
+            errs() << "Could not link module " << inputs[i] << "\n";
+            return false;
+        }
+        buffers[i].clear(); // release bitcode as soon as it is linked
+    }
+    if (outputKind == lisa::OUTPUT_EXECUTABLE && !lisa::createEntryPoint(*linked))
+        return false;
+    auto targetMachine = createTargetMachine();
+    if (!targetMachine)
+        return false;
+    return emitObjectFile(linked.get(), targetMachine.get(), objectFile);
+}
+
+
+// one compiler invocation, the environment is already initialized
+static int compileMain(int argc, char **argv) {
+    // Parse command line arguments
+    parseOpt(argc, argv);
+    std::vector<std::string> inputs = parseFilenames(argc, argv);
+    lisa::enableProfiler(timeReport, timeTrace);
+
+    // decide where the object files go, objects that only feed the
+    // linker are written to a temporary directory
+    // executables need a single module to generate main() in
+    bool linking = outputKind != lisa::OUTPUT_OBJECT;
+    bool merge = !linkedOutput.empty() || outputKind == lisa::OUTPUT_EXECUTABLE;
+    SmallString<128> tempDir;
+    if (linking && sys::fs::createUniqueDirectory("lisa", tempDir)) {
+        errs() << "Could not create a temporary directory\n";
+        return 1;
+    }
+    std::vector<std::string> objects;
+    std::vector<std::string> temporaries;
+    for (size_t i = 0; i < (merge ? 1 : inputs.size()); i++) {
+        std::string object = merge ? linkedOutput : objectFilename(inputs[i]);
+        if (linking && (object.empty() || !merge)) {
+            SmallString<128> path(tempDir);
+            std::string name = merge ? "lisa.o" : sys::path::filename(object).str();
+            sys::path::append(path, name);
+            if (sys::fs::exists(path))
+                path.append("." + std::to_string(i) + ".o");
+            object = path.str().str();
+            temporaries.push_back(object);
+        }
+        objects.push_back(object);
+    }
+
+    // compile every input on the worker pool, one file per task
+    std::atomic<bool> failed(false);
+    std::vector<SmallVector<char, 0>> buffers(inputs.size());
+    std::vector<std::vector<ExportedFunction>> exports(inputs.size());
+    ThreadPool pool(hardware_concurrency(jobs));
+    for (size_t i = 0; i < inputs.size(); i++) {
+        pool.async([&, i]() {
+            lisa::profilerThreadBegin();
+            bool ok = merge
+                ? compileToBitcode(inputs[i], buffers[i], exports[i])
+                : compileToObject(inputs[i], objects[i], exports[i]);
+            if (!ok)
+                failed = true;
+            lisa::profilerThreadEnd();
+        });
+    }
+    pool.wait();
+
+    // link everything into a single object if needed
+    if (!failed && merge && !linkAndEmit(inputs, buffers, objects[0]))
+        failed = true;
+
+    // declare what the objects export for C callers
+    if (!failed && !headerFile.empty()) {
+        std::vector<ExportedFunction> all;
+        for (auto &fileExports : exports)
+            all.insert(all.end(), fileExports.begin(), fileExports.end());
+        if (!lisa::writeCHeader(headerFile, all))
+            failed = true;
+    }
+
+    // produce the final executable or library
+    // instrumented code needs the profile runtime to write its counters
+    // and tensors need the Lisa runtime and the threads its matrix product
+    // runs on, the archive only adds what is used
+    std::vector<std::string> linkArgs;
+    if (linking && optOptions.profileGenerate && 
+        outputKind != lisa::OUTPUT_STATIC_LIB) {
+        std::string runtime = lisa::findProfileRuntime();
+        if (runtime.empty()) {
+            errs() << "-fprofile-generate needs the LLVM profile runtime "
+                "(compiler-rt), which was not found\n";
+            failed = true;
+        }
+        linkArgs = {"-u", "__llvm_profile_runtime", runtime};
+    }
+    if (linking && outputKind != lisa::OUTPUT_STATIC_LIB) {
+        std::string runtime = lisa::findRuntime();
+        if (!runtime.empty())
+            linkArgs.insert(linkArgs.end(), {runtime, "-lpthread"});
+    }
+    if (!failed && linking && 
+        !lisa::linkObjects(outputKind, objects, outputFile, linkArgs))
+        failed = true;
+    for (auto &temp : temporaries)
+        sys::fs::remove(temp);
+    if (linking)
+        sys::fs::remove(tempDir);
+    if (failed)
+        return 1;
+
+    // report where the time went
+    lisa::printTimeReport(errs());
+    if (timeTraceFile.empty()) {
+        std::string first = linkedOutput.empty() ? inputs[0] : linkedOutput;
+        timeTraceFile = first.substr(0, first.find_last_of('.')) + ".json";
+    }
+    if (!lisa::writeTimeTrace(timeTraceFile))
+        return 1;
 
     return 0;
 }
+
+
+// run by the compile server and by each of its workers before a request
+// arrives: a small module is optimized and emitted so LLVM's lazily built
+// pass and target tables are ready, and its target machine is kept for
+// the first compilation
+static void warmUp() {
+    auto targetMachine = createTargetMachine();
+    if (!targetMachine)
+        return;
+    LLVMContext context;
+    Module module("warmup", context);
+    module.setDataLayout(targetMachine->createDataLayout());
+    module.setTargetTriple(targetMachine->getTargetTriple().str());
+    Type *doubleTy = Type::getDoubleTy(context);
+    Function *fn = Function::Create(FunctionType::get(doubleTy, {doubleTy}, false),
+                                    Function::ExternalLinkage, "warmup", module);
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", fn));
+    builder.CreateRet(builder.CreateFMul(fn->getArg(0), fn->getArg(0)));
+    lisa::OptimizerOptions opts;
+    opts.level = 2;
+    lisa::optimizeModule(module, targetMachine.get(), opts);
+    SmallVector<char, 0> buffer;
+    raw_svector_ostream os(buffer);
+    legacy::PassManager pass;
+    if (!targetMachine->addPassesToEmitFile(pass, os, nullptr, CGFT_ObjectFile))
+        pass.run(module);
+    std::lock_guard<std::mutex> lock(warmTargetMachineLock);
+    warmTargetMachine = std::move(targetMachine);
+}
+
+
+// main driver code
+// the compile server modes have to be the first argument:
+//   --server[=<socket>] [-j <n>]    serve requests on n processes
+//   --client[=<socket>] <args>      compile on the server, or here if none runs
+//   --server-stats[=<socket>]       print the server's latency statistics
+// lisa-client is the same client without LLVM, which starts faster
+int main(int argc, char **argv) {
+    // -server works as well as --server, like the other long options
+    std::string mode = argc > 1 && argv[1][0] == '-' ? argv[1] : "";
+    mode.erase(0, std::min<size_t>(mode.find_first_not_of('-'), 2));
+    std::string socketPath = lisa::defaultSocketPath();
+    size_t eq = mode.find('=');
+    if (eq != std::string::npos) {
+        socketPath = mode.substr(eq + 1);
+        mode.resize(eq);
+    }
+    if (mode == "server-stats")
+        return lisa::printServerStats(socketPath);
+    if (mode == "client") {
+        argv[1] = argv[0];
+        int status = lisa::runClient(socketPath, argc - 1, argv + 1);
+        if (status >= 0)
+            return status;
+        argc--;
+        argv++;
+    }
+
+    // Initialize the environment
+    initEnv();
+    if (mode == "server") {
+        unsigned serverJobs = hardware_concurrency().compute_thread_count();
+        if (argc == 4 && std::string(argv[2]) == "-j")
+            serverJobs = std::max(1, atoi(argv[3]));
+        else if (argc != 2) {
+            std::cerr << "--server only takes -j <n>\n";
+            return 1;
+        }
+        return lisa::runServer(socketPath, serverJobs, warmUp, 
+            [](int argc, char **argv) {
+                int status = compileMain(argc, argv);
+                outs().flush();
+                return status;
+            });
+    }
+    return compileMain(argc, argv);
+}
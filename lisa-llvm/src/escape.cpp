@@ -0,0 +1,211 @@
+/**
+ * @file escape.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "escape.h"
+#include <map>
+#include <set>
+#include "profiler.h"
+
+
+namespace lisa
+{
+typedef std::vector<std::unique_ptr<ExprAST>> Block;
+
+// elements of one stack tensor, and of all stack tensors of a function
+static const int64_t stackLimit = 512;
+static const int64_t frameLimit = 8192;
+
+
+// an expression that makes a new tensor when its operands are tensors
+static bool makesTensor(ExprAST *expr) {
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr))
+        return bin->op != ':';
+    if (auto *call = dynamic_cast<CallExprAST*>(expr))
+        return isElementwiseBuiltin(call->callee) || call->callee == "tensor.zeros" ||
+            call->callee == "tensor.fill";
+    if (auto *fused = dynamic_cast<FusedExprAST*>(expr))
+        return !fused->reduced;
+    return dynamic_cast<TensorExprAST*>(expr) != nullptr;
+}
+
+
+static bool isAssignment(ExprAST *expr) {
+    auto *bin = dynamic_cast<BinaryExprAST*>(expr);
+    return bin && bin->op == ':';
+}
+
+
+namespace
+{
+class EscapeAnalysis
+{
+public:
+    void run(FunctionAST &fn);
+
+private:
+    void walk(ExprAST *expr, int loops);
+    void walkBlock(Block &block, int loops);
+    void walkLeaves(ExprAST *expr, int loops);
+    void values(ExprAST *expr, std::vector<ExprAST *> &sites,
+                std::vector<std::string> &vars);
+
+    // tensor-making expressions in source order, with their loop depth
+    std::vector<std::pair<ExprAST *, int>> sites;
+    std::multimap<std::string, ExprAST *> assignments;
+    std::vector<ExprAST *> escaping;
+};
+}
+
+
+// the tensor-making expressions and variables the value of expr may be
+void EscapeAnalysis::values(ExprAST *expr, std::vector<ExprAST *> &sites,
+                            std::vector<std::string> &vars) {
+    if (auto *var = dynamic_cast<VariableExprAST*>(expr)) {
+        if (var->name.find('.') == std::string::npos)
+            vars.push_back(var->name);
+    }
+    else if (isAssignment(expr))
+        values(static_cast<BinaryExprAST*>(expr)->rhs.get(), sites, vars);
+    else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr)) {
+        for (Block *block : {&ifExpr->if_body, &ifExpr->els_body})
+            if (!block->empty())
+                values(block->back().get(), sites, vars);
+    }
+    else if (makesTensor(expr))
+        sites.push_back(expr);
+}
+
+
+void EscapeAnalysis::walkBlock(Block &block, int loops) {
+    for (auto &expr : block)
+        walk(expr.get(), loops);
+}
+
+
+// the operands of a fused loop, its operators make no tensors
+void EscapeAnalysis::walkLeaves(ExprAST *expr, int loops) {
+    auto *bin = dynamic_cast<BinaryExprAST*>(expr);
+    auto *call = dynamic_cast<CallExprAST*>(expr);
+    if (bin && bin->op != ':') {
+        walkLeaves(bin->lhs.get(), loops);
+        walkLeaves(bin->rhs.get(), loops);
+    }
+    else if (call && isElementwiseBuiltin(call->callee)) {
+        for (auto &arg : call->args)
+            walkLeaves(arg.get(), loops);
+    }
+    else
+        walk(expr, loops);
+}
+
+
+void EscapeAnalysis::walk(ExprAST *expr, int loops) {
+    if (makesTensor(expr))
+        sites.push_back({expr, loops});
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+        if (bin->op == ':')
+            if (auto *target = dynamic_cast<VariableExprAST*>(bin->lhs.get()))
+                assignments.insert({target->name, bin->rhs.get()});
+        walk(bin->lhs.get(), loops);
+        walk(bin->rhs.get(), loops);
+    }
+    else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr)) {
+        walk(ifExpr->cond.get(), loops);
+        walkBlock(ifExpr->if_body, loops);
+        walkBlock(ifExpr->els_body, loops);
+    }
+    else if (auto *forExpr = dynamic_cast<ForExprAST*>(expr)) {
+        walk(forExpr->start.get(), loops);
+        walk(forExpr->end.get(), loops);
+        if (forExpr->step)
+            walk(forExpr->step.get(), loops);
+        walkBlock(forExpr->body, loops + 1);
+    }
+    else if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr)) {
+        walkBlock(whileExpr->body, loops + 1);
+        walk(whileExpr->cond.get(), loops + 1);
+    }
+    else if (auto *ret = dynamic_cast<ReturnExprAST*>(expr)) {
+        escaping.push_back(ret->expr.get());
+        walk(ret->expr.get(), loops);
+    }
+    else if (auto *call = dynamic_cast<CallExprAST*>(expr)) {
+        // a Lisa or C function may keep or return its arguments
+        bool builtin = call->callee.find('.') != std::string::npos;
+        for (auto &arg : call->args) {
+            if (!builtin)
+                escaping.push_back(arg.get());
+            walk(arg.get(), loops);
+        }
+    }
+    else if (auto *literal = dynamic_cast<TensorExprAST*>(expr))
+        walkBlock(literal->elements, loops);
+    else if (auto *index = dynamic_cast<IndexExprAST*>(expr)) {
+        walk(index->tensor.get(), loops);
+        walkBlock(index->indices, loops);
+    }
+    else if (auto *fused = dynamic_cast<FusedExprAST*>(expr))
+        walkLeaves(fused->root.get(), loops);
+}
+
+
+void EscapeAnalysis::run(FunctionAST &fn) {
+    walkBlock(fn.body, 0);
+    // the value of a top-level expression is discarded
+    if (!fn.proto->name.empty() && !fn.body.empty())
+        escaping.push_back(fn.body.back().get());
+
+    // everything an escaping value may be escapes, and through a variable
+    // every value assigned to it
+    std::set<ExprAST *> escaped;
+    std::set<std::string> escapedVars;
+    while (!escaping.empty()) {
+        ExprAST *expr = escaping.back();
+        escaping.pop_back();
+        std::vector<ExprAST *> exprSites;
+        std::vector<std::string> vars;
+        values(expr, exprSites, vars);
+        escaped.insert(exprSites.begin(), exprSites.end());
+        for (auto &var : vars) {
+            if (!escapedVars.insert(var).second)
+                continue;
+            auto range = assignments.equal_range(var);
+            for (auto it = range.first; it != range.second; ++it)
+                escaping.push_back(it->second);
+        }
+    }
+    // a site in a loop has one buffer for all iterations, so its value
+    // must not live on in a variable
+    std::set<ExprAST *> stored;
+    for (auto &assignment : assignments) {
+        std::vector<ExprAST *> exprSites;
+        std::vector<std::string> vars;
+        values(assignment.second, exprSites, vars);
+        stored.insert(exprSites.begin(), exprSites.end());
+    }
+
+    int64_t frame = 0;
+    for (auto &site : sites) {
+        ExprAST *expr = site.first;
+        const StaticShape &shape = expr->staticShape;
+        if (!shape.known || escaped.count(expr) || (site.second > 0 && stored.count(expr)))
+            continue;
+        if (shape.size() > stackLimit || frame + shape.size() > frameLimit)
+            continue;
+        expr->stackTensor = true;
+        frame += shape.size();
+    }
+}
+
+
+void analyzeEscapes(FunctionAST &fn) {
+    PhaseScope scope(PHASE_ESCAPE, fn.proto->name);
+    EscapeAnalysis().run(fn);
+}
+}
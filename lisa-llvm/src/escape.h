@@ -0,0 +1,33 @@
+/**
+ * @file escape.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#pragma once
+
+#include "ast.h"
+
+
+namespace lisa
+{
+// escape analysis on the AST, run after shape inference
+// a tensor escapes if it can reach a return, the value of the function or
+// an argument of a call to a Lisa or C function, directly, through
+// variables or through if branches, element-wise operations, reductions,
+// indexing and math.matmul only read it
+// tensors made by literals, tensor.zeros/fill and element-wise operations
+// that do not escape and have a small known shape are given a buffer on
+// the stack (ExprAST::stackTensor), so they cost no allocation
+// single-use temporaries never get that far, fusion already removed them
+void analyzeEscapes(FunctionAST &fn);
+}
+
+
+#endif
@@ -0,0 +1,352 @@
+/**
+ * @file fusion.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "fusion.h"
+#include <map>
+#include "profiler.h"
+
+
+namespace lisa
+{
+typedef std::vector<std::unique_ptr<ExprAST>> Block;
+
+
+static bool isElementwise(ExprAST *expr) {
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr))
+        return bin->op != ':';
+    if (auto *call = dynamic_cast<CallExprAST*>(expr))
+        return isElementwiseBuiltin(call->callee);
+    return false;
+}
+
+
+static bool isReduction(ExprAST *expr, ReduceKind &kind) {
+    auto *call = dynamic_cast<CallExprAST*>(expr);
+    return call && call->args.size() == 1 && isReductionBuiltin(call->callee, kind);
+}
+
+
+static bool isBuiltin(const std::string &callee) {
+    return callee.find('.') != std::string::npos;
+}
+
+
+// reads and writes of every variable in a function, "x.size" reads x
+struct VarCounts {
+    std::map<std::string, unsigned> uses, assigns;
+
+    void count(ExprAST *expr) {
+        if (auto *var = dynamic_cast<VariableExprAST*>(expr)) {
+            uses[var->name.substr(0, var->name.find('.'))]++;
+        }
+        else if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+            auto *lhs = dynamic_cast<VariableExprAST*>(bin->lhs.get());
+            auto *index = dynamic_cast<IndexExprAST*>(bin->lhs.get());
+            if (bin->op == ':' && lhs)
+                assigns[lhs->name]++;
+            else {
+                // a store into an element changes the tensor
+                if (bin->op == ':' && index)
+                    if (auto *var = dynamic_cast<VariableExprAST*>(index->tensor.get()))
+                        assigns[var->name]++;
+                count(bin->lhs.get());
+            }
+            count(bin->rhs.get());
+        }
+        else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr)) {
+            count(ifExpr->cond.get());
+            countAll(ifExpr->if_body);
+            countAll(ifExpr->els_body);
+        }
+        else if (auto *forExpr = dynamic_cast<ForExprAST*>(expr)) {
+            assigns[forExpr->var_name]++;
+            count(forExpr->start.get());
+            count(forExpr->end.get());
+            if (forExpr->step)
+                count(forExpr->step.get());
+            countAll(forExpr->body);
+        }
+        else if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr)) {
+            count(whileExpr->cond.get());
+            countAll(whileExpr->body);
+        }
+        else if (auto *ret = dynamic_cast<ReturnExprAST*>(expr)) {
+            count(ret->expr.get());
+        }
+        else if (auto *call = dynamic_cast<CallExprAST*>(expr)) {
+            countAll(call->args);
+        }
+        else if (auto *tensor = dynamic_cast<TensorExprAST*>(expr)) {
+            countAll(tensor->elements);
+        }
+        else if (auto *index = dynamic_cast<IndexExprAST*>(expr)) {
+            count(index->tensor.get());
+            countAll(index->indices);
+        }
+    }
+
+    void countAll(Block &exprs) {
+        for (auto &expr : exprs)
+            count(expr.get());
+    }
+};
+
+
+// an element-wise tree whose leaves are only variables and numbers, so it
+// can be evaluated later without changing its value
+static bool isPureElementwise(ExprAST *expr) {
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+        if (bin->op == ':')
+            return false;
+        return isPureElementwise(bin->lhs.get()) && isPureElementwise(bin->rhs.get());
+    }
+    if (auto *call = dynamic_cast<CallExprAST*>(expr)) {
+        if (!isElementwiseBuiltin(call->callee))
+            return false;
+        for (auto &arg : call->args)
+            if (!isPureElementwise(arg.get()))
+                return false;
+        return true;
+    }
+    return dynamic_cast<VariableExprAST*>(expr) || dynamic_cast<NumberExprAST*>(expr);
+}
+
+
+// a statement evaluated once, straight through, in which no function but
+// the builtins runs (a Lisa function could store into a tensor) and
+// nothing but the statement itself assigns
+static bool isStraightLine(ExprAST *expr, bool top = true) {
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+        if (bin->op == ':' && !top)
+            return false;
+        return isStraightLine(bin->lhs.get(), false) &&
+            isStraightLine(bin->rhs.get(), false);
+    }
+    if (auto *call = dynamic_cast<CallExprAST*>(expr)) {
+        if (!isBuiltin(call->callee))
+            return false;
+        for (auto &arg : call->args)
+            if (!isStraightLine(arg.get(), false))
+                return false;
+        return true;
+    }
+    if (auto *ret = dynamic_cast<ReturnExprAST*>(expr))
+        return isStraightLine(ret->expr.get(), false);
+    if (auto *tensor = dynamic_cast<TensorExprAST*>(expr)) {
+        for (auto &element : tensor->elements)
+            if (!isStraightLine(element.get(), false))
+                return false;
+        return true;
+    }
+    if (auto *index = dynamic_cast<IndexExprAST*>(expr)) {
+        for (auto &i : index->indices)
+            if (!isStraightLine(i.get(), false))
+                return false;
+        return isStraightLine(index->tensor.get(), false);
+    }
+    return dynamic_cast<VariableExprAST*>(expr) || dynamic_cast<NumberExprAST*>(expr);
+}
+
+
+// replace the read of name in expr by value, false if there is none
+static bool substitute(std::unique_ptr<ExprAST> &expr, const std::string &name,
+                       std::unique_ptr<ExprAST> &value) {
+    if (auto *var = dynamic_cast<VariableExprAST*>(expr.get())) {
+        if (var->name != name)
+            return false;
+        expr = std::move(value);
+        return true;
+    }
+    if (auto *bin = dynamic_cast<BinaryExprAST*>(expr.get())) {
+        // the target of an assignment is not a read
+        if (bin->op != ':' || !dynamic_cast<VariableExprAST*>(bin->lhs.get()))
+            if (substitute(bin->lhs, name, value))
+                return true;
+        return substitute(bin->rhs, name, value);
+    }
+    if (auto *call = dynamic_cast<CallExprAST*>(expr.get())) {
+        for (auto &arg : call->args)
+            if (substitute(arg, name, value))
+                return true;
+        return false;
+    }
+    if (auto *ret = dynamic_cast<ReturnExprAST*>(expr.get()))
+        return substitute(ret->expr, name, value);
+    if (auto *tensor = dynamic_cast<TensorExprAST*>(expr.get())) {
+        for (auto &element : tensor->elements)
+            if (substitute(element, name, value))
+                return true;
+        return false;
+    }
+    if (auto *index = dynamic_cast<IndexExprAST*>(expr.get())) {
+        if (substitute(index->tensor, name, value))
+            return true;
+        for (auto &i : index->indices)
+            if (substitute(i, name, value))
+                return true;
+    }
+    return false;
+}
+
+
+// "name: value" with a plain variable as the target
+static bool isAssignment(ExprAST *expr, VariableExprAST *&target, ExprAST *&value) {
+    auto *bin = dynamic_cast<BinaryExprAST*>(expr);
+    if (!bin || bin->op != ':')
+        return false;
+    target = dynamic_cast<VariableExprAST*>(bin->lhs.get());
+    value = bin->rhs.get();
+    return target != nullptr;
+}
+
+
+class Fuser
+{
+public:
+    explicit Fuser(FunctionAST &fn) {
+        for (auto &arg : fn.proto->args)
+            counts.assigns[arg]++;
+        counts.countAll(fn.body);
+    }
+
+    void fuseBlock(Block &block) {
+        substituteTemporaries(block);
+        for (auto &stmt : block)
+            fuse(stmt);
+        mergeReductions(block);
+    }
+
+private:
+    VarCounts counts;
+
+    // "t: a * b  u: t + c" becomes "u: a * b + c" when u is the only read of t
+    void substituteTemporaries(Block &block) {
+        for (size_t i = 0; i + 1 < block.size();) {
+            VariableExprAST *target;
+            ExprAST *value;
+            if (isAssignment(block[i].get(), target, value) && !target->declaredTensor &&
+                isElementwise(value) && isPureElementwise(value) &&
+                counts.assigns[target->name] == 1 && counts.uses[target->name] == 1 &&
+                isStraightLine(block[i + 1].get())) {
+                auto &rhs = static_cast<BinaryExprAST*>(block[i].get())->rhs;
+                if (substitute(block[i + 1], target->name, rhs)) {
+                    block.erase(block.begin() + i);
+                    continue;
+                }
+            }
+            i++;
+        }
+    }
+
+    // "e: math.exp(x)  s: math.sum(e)" computes s in the loop making e
+    // the reduction is not merged if it is the last statement, whose
+    // value is the value of the block
+    void mergeReductions(Block &block) {
+        for (size_t i = 0; i + 2 < block.size();) {
+            VariableExprAST *target, *sum;
+            ExprAST *value, *reduction;
+            if (isAssignment(block[i].get(), target, value) &&
+                isAssignment(block[i + 1].get(), sum, reduction) &&
+                !sum->declaredTensor && sum->name != target->name) {
+                auto *producer = dynamic_cast<FusedExprAST*>(value);
+                auto *consumer = dynamic_cast<FusedExprAST*>(reduction);
+                auto *input = consumer ?
+                    dynamic_cast<VariableExprAST*>(consumer->root.get()) : nullptr;
+                if (producer && !producer->reduced && input && consumer->reduced &&
+                    consumer->reductions.size() == 1 && input->name == target->name) {
+                    producer->reductions.push_back({consumer->reductions[0].kind,
+                                                    sum->name});
+                    block.erase(block.begin() + i + 1);
+                    continue;
+                }
+            }
+            i++;
+        }
+    }
+
+    // turn element-wise trees in expr into FusedExprAST nodes
+    void fuse(std::unique_ptr<ExprAST> &expr) {
+        ReduceKind kind;
+        if (isReduction(expr.get(), kind)) {
+            auto *call = static_cast<CallExprAST*>(expr.get());
+            auto fused = std::make_unique<FusedExprAST>(std::move(call->args[0]));
+            fused->reduced = true;
+            fused->reductions.push_back({kind, ""});
+            fuseLeaves(fused->root);
+            expr = std::move(fused);
+        }
+        else if (isElementwise(expr.get())) {
+            auto fused = std::make_unique<FusedExprAST>(std::move(expr));
+            fuseLeaves(fused->root);
+            expr = std::move(fused);
+        }
+        else if (auto *bin = dynamic_cast<BinaryExprAST*>(expr.get())) {
+            fuse(bin->lhs);
+            fuse(bin->rhs);
+        }
+        else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr.get())) {
+            fuse(ifExpr->cond);
+            fuseBlock(ifExpr->if_body);
+            fuseBlock(ifExpr->els_body);
+        }
+        else if (auto *forExpr = dynamic_cast<ForExprAST*>(expr.get())) {
+            fuse(forExpr->start);
+            fuse(forExpr->end);
+            if (forExpr->step)
+                fuse(forExpr->step);
+            fuseBlock(forExpr->body);
+        }
+        else if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr.get())) {
+            fuse(whileExpr->cond);
+            fuseBlock(whileExpr->body);
+        }
+        else if (auto *ret = dynamic_cast<ReturnExprAST*>(expr.get())) {
+            fuse(ret->expr);
+        }
+        else if (auto *call = dynamic_cast<CallExprAST*>(expr.get())) {
+            for (auto &arg : call->args)
+                fuse(arg);
+        }
+        else if (auto *tensor = dynamic_cast<TensorExprAST*>(expr.get())) {
+            for (auto &element : tensor->elements)
+                fuse(element);
+        }
+        else if (auto *index = dynamic_cast<IndexExprAST*>(expr.get())) {
+            fuse(index->tensor);
+            for (auto &i : index->indices)
+                fuse(i);
+        }
+    }
+
+    // the operands below the element-wise nodes of a fused tree
+    void fuseLeaves(std::unique_ptr<ExprAST> &expr) {
+        if (auto *bin = dynamic_cast<BinaryExprAST*>(expr.get())) {
+            if (bin->op != ':') {
+                fuseLeaves(bin->lhs);
+                fuseLeaves(bin->rhs);
+                return;
+            }
+        }
+        if (auto *call = dynamic_cast<CallExprAST*>(expr.get())) {
+            if (isElementwiseBuiltin(call->callee)) {
+                for (auto &arg : call->args)
+                    fuseLeaves(arg);
+                return;
+            }
+        }
+        fuse(expr);
+    }
+};
+
+
+void fuseFunction(FunctionAST &fn) {
+    PhaseScope scope(PHASE_FUSION, fn.proto->name);
+    Fuser(fn).fuseBlock(fn.body);
+}
+}
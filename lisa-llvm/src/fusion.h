@@ -0,0 +1,32 @@
+/**
+ * @file fusion.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef FUSION_H
+#define FUSION_H
+
+#pragma once
+
+#include "ast.h"
+
+
+namespace lisa
+{
+// element-wise fusion on the AST, run after constant evaluation
+// trees of binary operators and element-wise math.* calls become a
+// FusedExprAST, which codegen turns into one loop over the elements, so
+// "a * b + c" makes a single tensor instead of one per operator
+// across statements, a temporary assigned an element-wise expression and
+// read once in the next statement is substituted into it, and a reduction
+// of a variable right after the statement computing it joins that loop,
+// so softmax ("e: math.exp(x)  s: math.sum(e)  e / s") runs two loops
+void fuseFunction(FunctionAST &fn);
+}
+
+
+#endif
@@ -8,6 +8,7 @@
  */
 
 #include "lexer.h"
+#include "profiler.h"
 
 
 // initialize the lexer
@@ -103,6 +104,8 @@ void Lexer::matchKeywordToken(Token *t, const std::string& id) {
         setToken(t, TOK_WHILE, id);
     else if (id == "return")
         setToken(t, TOK_RETURN, id);
+    else if (id == "tensor")
+        setToken(t, TOK_TENSOR, id);
     else
         setToken(t, TOK_ID, id);
 }
@@ -119,6 +122,7 @@ void Lexer::setToken(Token *t, TokenType tp, const std::string& lx) {
 
 // get the next token from the file
 Token Lexer::getTok() {
+    lisa::PhaseScope scope(lisa::PHASE_LEX);
     int c = ' ';
     std::string id;
     Token t;
@@ -150,10 +154,17 @@ Token Lexer::getTok() {
     // }
 
     // identifiers or keywords
+    // a dot followed by a letter continues the identifier, as in
+    // math.exp or x.shape, a dot followed by a digit starts a number
     if (isalpha(c) || c == '_') { 
         id = c;
-        while (isalnum((c = peekChar())) || c == '_') {
+        while (isalnum((c = peekChar())) || c == '_' || c == '.') {
             getChar();
+            if (c == '.' && !isalpha(peekChar()) && peekChar() != '_') {
+                this->file.unget();
+                this->col--;
+                break;
+            }
             id += c;
         }
         matchKeywordToken(&t, id);
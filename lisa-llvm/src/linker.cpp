@@ -0,0 +1,198 @@
+/**
+ * @file linker.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "linker.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#ifdef LISA_HAVE_LLD
+#include "lld/Common/Driver.h"
+#endif
+using namespace llvm;
+
+
+namespace lisa
+{
+// error printing function
+static bool linkError(const std::string &str) {
+    fprintf(stderr, "\033[1;31mLink Error:\033[0m %s\n", str.c_str());
+    return false;
+}
+
+
+Function *createEntryPoint(Module &module) {
+    if (module.getFunction("main")) {
+        linkError("a function named 'main' is already defined");
+        return nullptr;
+    }
+    LLVMContext &context = module.getContext();
+    FunctionType *ft = FunctionType::get(Type::getInt32Ty(context), false);
+    Function *mainFn = Function::Create(ft, Function::ExternalLinkage, "main", module);
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", mainFn));
+    // the list built by CodeGenVisitor::createTopLevelList
+    if (GlobalVariable *list = module.getGlobalVariable("lisa.toplevel")) {
+        if (auto *fns = dyn_cast<ConstantArray>(list->getInitializer())) {
+            for (auto &fn : fns->operands()) {
+                auto *f = cast<Function>(fn->stripPointerCasts());
+                builder.CreateCall(f);
+            }
+        }
+        list->eraseFromParent();
+    }
+    builder.CreateRet(builder.getInt32(0));
+    return mainFn;
+}
+
+
+std::string findRuntime() {
+    std::string exe = sys::fs::getMainExecutable(nullptr, nullptr);
+    SmallString<128> path(sys::path::parent_path(exe));
+    sys::path::append(path, "liblisart.a");
+    if (sys::fs::exists(path))
+        return path.str().str();
+#ifdef LISA_RUNTIME_LIBRARY
+    if (sys::fs::exists(LISA_RUNTIME_LIBRARY))
+        return LISA_RUNTIME_LIBRARY;
+#endif
+    return "";
+}
+
+
+// static libraries are plain archives, no linker needed
+static bool writeStaticLib(const std::vector<std::string> &objects,
+                           const std::string &output) {
+    std::vector<NewArchiveMember> members;
+    for (auto &obj : objects) {
+        auto member = NewArchiveMember::getFile(obj, true);
+        if (!member)
+            return linkError(toString(member.takeError()));
+        member->MemberName = sys::path::filename(obj);
+        members.push_back(std::move(*member));
+    }
+    if (Error err = writeArchive(output, members, true,
+                                 object::Archive::K_GNU, true, false))
+        return linkError(toString(std::move(err)));
+    return true;
+}
+
+
+#ifdef LISA_HAVE_LLD
+// directories searched for the C runtime start files
+static std::vector<std::string> libraryDirs() {
+    Triple triple(sys::getProcessTriple());
+    std::string multiarch = triple.getArchName().str() + "-linux-gnu";
+    return {"/usr/lib/" + multiarch, "/lib/" + multiarch,
+            "/usr/lib64", "/lib64", "/usr/lib", "/lib"};
+}
+
+
+static std::string findLibraryFile(const std::string &name) {
+    for (auto &dir : libraryDirs()) {
+        SmallString<128> path(dir);
+        sys::path::append(path, name);
+        if (sys::fs::exists(path))
+            return path.str().str();
+    }
+    return "";
+}
+
+
+static std::string dynamicLinker() {
+    switch (Triple(sys::getProcessTriple()).getArch()) {
+        case Triple::x86_64:  return "/lib64/ld-linux-x86-64.so.2";
+        case Triple::aarch64: return "/lib/ld-linux-aarch64.so.1";
+        default:              return "";
+    }
+}
+
+
+// link in-process, returns false without output if the C runtime
+// could not be located so the caller can fall back to the C driver
+static bool linkWithLLD(OutputKind kind, const std::vector<std::string> &objects,
+                        const std::string &output,
+                        const std::vector<std::string> &extraArgs, bool &attempted) {
+    attempted = false;
+    std::vector<std::string> args = {"ld.lld", "-o", output};
+    bool executable = kind == OUTPUT_EXECUTABLE;
+    std::string crtn;
+    if (kind == OUTPUT_RELOCATABLE)
+        args.push_back("-r");
+    if (kind == OUTPUT_SHARED)
+        args.push_back("-shared");
+    if (executable) {
+        std::string crt1 = findLibraryFile("Scrt1.o");
+        std::string crti = findLibraryFile("crti.o");
+        std::string interp = dynamicLinker();
+        crtn = findLibraryFile("crtn.o");
+        if (crt1.empty() || crti.empty() || crtn.empty() || interp.empty())
+            return false;
+        args.insert(args.end(), {"-pie", "-dynamic-linker", interp, crt1, crti});
+    }
+    args.insert(args.end(), objects.begin(), objects.end());
+    if (kind != OUTPUT_RELOCATABLE) {
+        for (auto &dir : libraryDirs())
+            args.push_back("-L" + dir);
+        args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+        args.insert(args.end(), {"-lm", "-lc"});
+    }
+    if (executable)
+        args.push_back(crtn);
+
+    std::vector<const char *> argv;
+    for (auto &arg : args)
+        argv.push_back(arg.c_str());
+    attempted = true;
+    return lld::elf::link(argv, outs(), errs(), false, false);
+}
+#endif
+
+
+// link through the system C compiler driver
+static bool linkWithDriver(OutputKind kind, const std::vector<std::string> &objects,
+                           const std::string &output,
+                           const std::vector<std::string> &extraArgs) {
+    auto cc = sys::findProgramByName("cc");
+    if (!cc)
+        return linkError("no linker found, install cc or build with LLD");
+    std::vector<StringRef> args = {*cc, "-o", output};
+    if (kind == OUTPUT_SHARED)
+        args.push_back("-shared");
+    if (kind == OUTPUT_RELOCATABLE)
+        args.push_back("-r");
+    args.insert(args.end(), objects.begin(), objects.end());
+    args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+    if (kind != OUTPUT_RELOCATABLE)
+        args.push_back("-lm");
+    std::string errMsg;
+    if (sys::ExecuteAndWait(*cc, args, None, {}, 0, 0, &errMsg) != 0)
+        return linkError(errMsg.empty() ? "linker command failed" : errMsg);
+    return true;
+}
+
+
+bool linkObjects(OutputKind kind, const std::vector<std::string> &objects,
+                 const std::string &output,
+                 const std::vector<std::string> &extraArgs) {
+    if (kind == OUTPUT_STATIC_LIB)
+        return writeStaticLib(objects, output);
+#ifdef LISA_HAVE_LLD
+    bool attempted;
+    bool ok = linkWithLLD(kind, objects, output, extraArgs, attempted);
+    if (attempted)
+        return ok || linkError("LLD failed to link " + output);
+#endif
+    return linkWithDriver(kind, objects, output, extraArgs);
+}
+}
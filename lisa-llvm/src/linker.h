@@ -0,0 +1,51 @@
+/**
+ * @file linker.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef LINKER_H
+#define LINKER_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+
+namespace lisa
+{
+// what the driver produces from the compiled objects
+enum OutputKind {
+    OUTPUT_OBJECT,      // one object file per input (default)
+    OUTPUT_EXECUTABLE,  // -o <file>
+    OUTPUT_SHARED,      // -shared -o <file>
+    OUTPUT_STATIC_LIB,  // -static-lib -o <file>
+    OUTPUT_RELOCATABLE, // objects combined into one object (ld -r)
+};
+
+
+// add a C main() that runs every top-level expression in source order
+llvm::Function *createEntryPoint(llvm::Module &module);
+
+// liblisart.a, the runtime library of compiled code, empty if not found
+// it is looked up next to the lisa executable, then in the build tree
+std::string findRuntime();
+
+// link object files into an executable, shared library or static library
+// executables and shared libraries are linked in-process with LLD when
+// the compiler is built against it, otherwise the system C compiler
+// driver is used, static libraries are always written in-process
+// extra arguments (libraries, -u symbols) are passed to either linker
+bool linkObjects(OutputKind kind, const std::vector<std::string> &objects,
+                 const std::string &output,
+                 const std::vector<std::string> &extraArgs = {});
+}
+
+
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @file multiversion.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "multiversion.h"
+#include <map>
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+using namespace llvm;
+
+
+namespace lisa
+{
+// cpuid bits each level needs on top of the one below, from the x86-64 psABI
+// leaf 1 ecx: SSE3 SSSE3 CMPXCHG16B SSE4.1 SSE4.2 POPCNT
+static const uint32_t V2_LEAF1_ECX = 0x00982201;
+// leaf 0x80000001 ecx: LAHF/SAHF
+static const uint32_t V2_EXT_ECX = 0x00000001;
+// leaf 1 ecx: FMA MOVBE OSXSAVE AVX F16C
+static const uint32_t V3_LEAF1_ECX = 0x38401000;
+// leaf 7 ebx: BMI1 AVX2 BMI2
+static const uint32_t V3_LEAF7_EBX = 0x00000128;
+// leaf 0x80000001 ecx: LZCNT
+static const uint32_t V3_EXT_ECX = 0x00000020;
+// leaf 7 ebx: AVX512F AVX512DQ AVX512CD AVX512BW AVX512VL
+static const uint32_t V4_LEAF7_EBX = 0xd0030000;
+// XCR0 state the OS has to save: SSE and AVX, then the AVX-512 registers
+static const uint32_t V3_XCR0 = 0x06;
+static const uint32_t V4_XCR0 = 0xe6;
+
+
+static bool isExported(const Function &fn) {
+    return !fn.isDeclaration() && !fn.hasLocalLinkage() && !fn.isIntrinsic() &&
+        fn.getName() != "main";
+}
+
+
+static Value *hasAll(IRBuilder<> &builder, Value *reg, uint32_t mask) {
+    Value *bits = builder.getInt32(mask);
+    return builder.CreateICmpEQ(builder.CreateAnd(reg, bits), bits);
+}
+
+
+// int __lisa_cpu_level(), the highest x86-64 level the CPU and OS support
+// (0 for the baseline), detected once and cached
+// resolvers run while the object is being relocated, so this must not
+// call anything outside the module
+static Function *createCPULevel(Module &module) {
+    LLVMContext &context = module.getContext();
+    IRBuilder<> builder(context);
+    Type *i32 = builder.getInt32Ty();
+    auto *cache = new GlobalVariable(module, i32, false, GlobalValue::InternalLinkage,
+                                     builder.getInt32(-1), "__lisa_cpu_level.cache");
+    Function *fn = Function::Create(FunctionType::get(i32, false),
+        Function::InternalLinkage, "__lisa_cpu_level", module);
+    fn->addFnAttr(Attribute::NoProfile);
+    fn->addFnAttr(Attribute::NoUnwind);
+
+    BasicBlock *entryBB = BasicBlock::Create(context, "entry", fn);
+    BasicBlock *hitBB = BasicBlock::Create(context, "hit", fn);
+    BasicBlock *detectBB = BasicBlock::Create(context, "detect", fn);
+    BasicBlock *xgetbvBB = BasicBlock::Create(context, "xgetbv", fn);
+    BasicBlock *doneBB = BasicBlock::Create(context, "done", fn);
+    builder.SetInsertPoint(entryBB);
+    Value *cached = builder.CreateLoad(i32, cache, "cached");
+    builder.CreateCondBr(builder.CreateICmpSGE(cached, builder.getInt32(0)),
+                         hitBB, detectBB);
+    builder.SetInsertPoint(hitBB);
+    builder.CreateRet(cached);
+
+    // cpuid never faults, leaves past the maximum only return garbage
+    // that is masked out below
+    builder.SetInsertPoint(detectBB);
+    Type *regs4 = StructType::get(context, {i32, i32, i32, i32});
+    InlineAsm *cpuidAsm = InlineAsm::get(FunctionType::get(regs4, {i32, i32}, false),
+        "cpuid", "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}",
+        true);
+    auto cpuid = [&](uint32_t leaf) {
+        return builder.CreateCall(cpuidAsm, {builder.getInt32(leaf), builder.getInt32(0)});
+    };
+    Value *maxLeaf = builder.CreateExtractValue(cpuid(0), 0);
+    Value *leaf1Ecx = builder.CreateExtractValue(cpuid(1), 2);
+    Value *leaf7Ebx = builder.CreateSelect(
+        builder.CreateICmpUGE(maxLeaf, builder.getInt32(7)),
+        builder.CreateExtractValue(cpuid(7), 1), builder.getInt32(0));
+    Value *maxExtLeaf = builder.CreateExtractValue(cpuid(0x80000000), 0);
+    Value *extEcx = builder.CreateSelect(
+        builder.CreateICmpUGE(maxExtLeaf, builder.getInt32(0x80000001)),
+        builder.CreateExtractValue(cpuid(0x80000001), 2), builder.getInt32(0));
+    Value *v2 = builder.CreateAnd(hasAll(builder, leaf1Ecx, V2_LEAF1_ECX),
+                                  hasAll(builder, extEcx, V2_EXT_ECX));
+    Value *v3 = builder.CreateAnd({v2, hasAll(builder, leaf1Ecx, V3_LEAF1_ECX),
+                                   hasAll(builder, leaf7Ebx, V3_LEAF7_EBX),
+                                   hasAll(builder, extEcx, V3_EXT_ECX)});
+    Value *v4 = builder.CreateAnd(v3, hasAll(builder, leaf7Ebx, V4_LEAF7_EBX));
+    // xgetbv faults unless the OS has enabled it (OSXSAVE)
+    builder.CreateCondBr(hasAll(builder, leaf1Ecx, 1u << 27), xgetbvBB, doneBB);
+
+    builder.SetInsertPoint(xgetbvBB);
+    InlineAsm *xgetbvAsm = InlineAsm::get(
+        FunctionType::get(StructType::get(context, {i32, i32}), {i32}, false),
+        "xgetbv", "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}", true);
+    Value *xcr0Low = builder.CreateExtractValue(
+        builder.CreateCall(xgetbvAsm, {builder.getInt32(0)}), 0);
+    builder.CreateBr(doneBB);
+
+    builder.SetInsertPoint(doneBB);
+    PHINode *xcr0 = builder.CreatePHI(i32, 2, "xcr0");
+    xcr0->addIncoming(builder.getInt32(0), detectBB);
+    xcr0->addIncoming(xcr0Low, xgetbvBB);
+    v3 = builder.CreateAnd(v3, hasAll(builder, xcr0, V3_XCR0));
+    v4 = builder.CreateAnd({v3, v4, hasAll(builder, xcr0, V4_XCR0)});
+    Value *level = builder.CreateAdd(builder.CreateZExt(v2, i32),
+        builder.CreateAdd(builder.CreateZExt(v3, i32), builder.CreateZExt(v4, i32)),
+        "level");
+    builder.CreateStore(level, cache);
+    builder.CreateRet(level);
+    return fn;
+}
+
+
+bool multiversionModule(Module &module, const std::vector<unsigned> &levels) {
+    Triple triple(module.getTargetTriple());
+    if (triple.getArch() != Triple::x86_64 || !triple.isOSBinFormatELF())
+        return false;
+    std::vector<Function*> functions;
+    for (Function &fn : module)
+        if (isExported(fn))
+            functions.push_back(&fn);
+    if (functions.empty() || levels.empty())
+        return true;
+
+    // versions[fn][i] is the clone of fn for levels[i]
+    std::map<Function*, std::vector<Function*>> versions;
+    std::map<Function*, size_t> levelOf;     // index into levels of a clone
+    for (Function *fn : functions) {
+        for (size_t i = 0; i < levels.size(); i++) {
+            std::string cpu = "x86-64-v" + std::to_string(levels[i]);
+            ValueToValueMapTy vmap;
+            Function *clone = CloneFunction(fn, vmap);
+            clone->setName(fn->getName() + "." + cpu);
+            clone->setLinkage(GlobalValue::InternalLinkage);
+            clone->setVisibility(GlobalValue::DefaultVisibility);
+            clone->addFnAttr("target-cpu", cpu);
+            clone->removeFnAttr("target-features");
+            versions[fn].push_back(clone);
+            levelOf[clone] = i;
+        }
+    }
+
+    Function *cpuLevel = createCPULevel(module);
+    IRBuilder<> builder(module.getContext());
+    for (Function *fn : functions) {
+        std::string name = fn->getName().str();
+        fn->setName(name + ".default");
+        fn->setLinkage(GlobalValue::InternalLinkage);
+        fn->setVisibility(GlobalValue::DefaultVisibility);
+
+        // the resolver returns the best clone, falling back to the baseline
+        PointerType *fnPtrTy = fn->getFunctionType()->getPointerTo();
+        Function *resolver = Function::Create(FunctionType::get(fnPtrTy, false),
+            Function::InternalLinkage, name + ".resolver", module);
+        resolver->addFnAttr(Attribute::NoProfile);
+        resolver->addFnAttr(Attribute::NoUnwind);
+        builder.SetInsertPoint(BasicBlock::Create(module.getContext(), "entry", resolver));
+        Value *level = builder.CreateCall(cpuLevel, {}, "level");
+        Value *best = fn;
+        for (size_t i = 0; i < levels.size(); i++)
+            best = builder.CreateSelect(
+                builder.CreateICmpSGE(level, builder.getInt32(levels[i] - 1)),
+                versions[fn][i], best);
+        builder.CreateRet(best);
+        GlobalIFunc *ifunc = GlobalIFunc::create(fn->getFunctionType(), 0,
+            GlobalValue::ExternalLinkage, name, resolver, &module);
+
+        // clones keep to their level, everything else goes through the ifunc
+        for (auto it = fn->use_begin(); it != fn->use_end();) {
+            Use &use = *it++;
+            auto *inst = dyn_cast<Instruction>(use.getUser());
+            Function *caller = inst ? inst->getFunction() : nullptr;
+            if (caller == resolver)
+                continue;
+            auto level = caller ? levelOf.find(caller) : levelOf.end();
+            if (level != levelOf.end())
+                use.set(versions[fn][level->second]);
+            else if (!caller || !versions.count(caller))
+                use.set(ifunc);
+        }
+    }
+    return true;
+}
+
+
+std::unique_ptr<Module> extractIFuncs(Module &module, LLVMContext &context) {
+    if (module.ifunc_empty())
+        return nullptr;
+    auto dispatch = std::make_unique<Module>(module.getModuleIdentifier() + ".ifunc",
+                                             context);
+    dispatch->setDataLayout(module.getDataLayout());
+    dispatch->setTargetTriple(module.getTargetTriple());
+    // the object file does not record signatures, so one type does for all
+    FunctionType *fnType = FunctionType::get(Type::getVoidTy(context), false);
+    FunctionType *resolverType = FunctionType::get(fnType->getPointerTo(), false);
+    IRBuilder<> builder(context);
+    for (auto it = module.ifunc_begin(); it != module.ifunc_end();) {
+        GlobalIFunc &ifunc = *it++;
+        Function *resolver = ifunc.getResolverFunction();
+        resolver->setLinkage(GlobalValue::ExternalLinkage);
+        resolver->setVisibility(GlobalValue::HiddenVisibility);
+        Function *decl = Function::Create(cast<FunctionType>(ifunc.getValueType()),
+            Function::ExternalLinkage, "", &module);
+        decl->takeName(&ifunc);
+        ifunc.replaceAllUsesWith(decl);
+        ifunc.eraseFromParent();
+
+        // an ifunc needs a resolver defined next to it
+        Function *target = Function::Create(resolverType, Function::ExternalLinkage,
+                                            resolver->getName(), dispatch.get());
+        target->setVisibility(GlobalValue::HiddenVisibility);
+        Function *stub = Function::Create(resolverType, Function::InternalLinkage,
+                                          resolver->getName() + ".stub", dispatch.get());
+        builder.SetInsertPoint(BasicBlock::Create(context, "entry", stub));
+        builder.CreateRet(builder.CreateCall(target));
+        GlobalIFunc::create(fnType, 0, GlobalValue::ExternalLinkage, decl->getName(),
+                            stub, dispatch.get());
+    }
+    return dispatch;
+}
+}
@@ -0,0 +1,42 @@
+/**
+ * @file multiversion.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef MULTIVERSION_H
+#define MULTIVERSION_H
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "llvm/IR/Module.h"
+
+
+namespace lisa
+{
+// runtime CPU dispatch across the x86-64 micro-architecture levels
+// every exported function is cloned once per level in levels (2 to 4,
+// i.e. x86-64-v2, v3 with AVX2/FMA and v4 with AVX-512), the original
+// becomes the baseline version and its symbol turns into an ifunc whose
+// resolver picks the best clone the CPU supports when the object is loaded
+// clones call the clones of their own level directly, so the inliner and
+// the vectorizer still see through calls between Lisa functions
+// run before the optimizer so every clone is optimized for its level,
+// returns false (and leaves the module alone) on non x86-64 ELF targets
+bool multiversionModule(llvm::Module &module, const std::vector<unsigned> &levels);
+
+// move the ifuncs of module into a new module in context, for code
+// generation that splits the module (CloneModule drops ifuncs)
+// declarations take their place and the resolvers become hidden external
+// functions the new module calls, null if there are no ifuncs
+std::unique_ptr<llvm::Module> extractIFuncs(llvm::Module &module,
+                                            llvm::LLVMContext &context);
+}
+
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file optimizer.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "optimizer.h"
+#include "profiler.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+using namespace llvm;
+
+
+namespace lisa
+{
+void optimizeModule(Module &module, TargetMachine *targetMachine,
+                    const OptimizerOptions &opts) {
+    Optional<PGOOptions> pgo;
+    if (opts.profileGenerate) {
+        // same default file name as clang, %m keeps modules apart
+        SmallString<128> path(opts.profileDir);
+        sys::path::append(path, "default_%m.profraw");
+        pgo = PGOOptions(path.str().str(), "", "", PGOOptions::IRInstr);
+    }
+    else if (!opts.profileUse.empty()) {
+        pgo = PGOOptions(opts.profileUse, "", "", PGOOptions::IRUse);
+    }
+    // profiles are only useful with the optimizations that consume them
+    unsigned level = opts.level;
+    if (pgo && level == 0)
+        level = 2;
+    if (level == 0)
+        return;
+
+    PhaseScope scope(PHASE_OPTIMIZE, module.getModuleIdentifier());
+    LoopAnalysisManager lam;
+    FunctionAnalysisManager fam;
+    CGSCCAnalysisManager cgam;
+    ModuleAnalysisManager mam;
+    PassBuilder pb(targetMachine, PipelineTuningOptions(), pgo);
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+    // after the early cleanup has promoted arguments to SSA values,
+    // before IPSCCP and the inliner see the call sites
+    if (opts.specialize && level >= 2) {
+        SpecializeOptions specializeOptions = opts.specializeOptions;
+        pb.registerPipelineEarlySimplificationEPCallback(
+            [specializeOptions](ModulePassManager &mpm, OptimizationLevel) {
+                mpm.addPass(SpecializePass(specializeOptions));
+            });
+    }
+    // before the inliner, so the mapping follows a call into any function
+    // it is inlined into, and into the bitcode of -flto
+    if (opts.vectorMath) {
+        TargetMachine *tm = targetMachine;
+        pb.registerPipelineStartEPCallback(
+            [tm](ModulePassManager &mpm, OptimizationLevel) {
+                mpm.addPass(VectorMathPass(tm));
+            });
+    }
+
+    OptimizationLevel optLevel = level == 1 ? OptimizationLevel::O1
+        : level == 2 ? OptimizationLevel::O2 : OptimizationLevel::O3;
+    ModulePassManager mpm = opts.lto == LTO_THIN
+        ? pb.buildThinLTOPreLinkDefaultPipeline(optLevel)
+        : opts.lto == LTO_FULL ? pb.buildLTOPreLinkDefaultPipeline(optLevel)
+        : pb.buildPerModuleDefaultPipeline(optLevel);
+    mpm.run(module, mam);
+}
+
+
+std::string findProfileRuntime() {
+#ifdef LISA_LLVM_LIBRARY_DIR
+    // <llvm>/lib/clang/<version>/lib/linux/libclang_rt.profile-<arch>.a
+    std::string name = "libclang_rt.profile-" +
+        Triple(sys::getProcessTriple()).getArchName().str() + ".a";
+    SmallString<128> clangDir(LISA_LLVM_LIBRARY_DIR);
+    sys::path::append(clangDir, "clang");
+    std::error_code ec;
+    for (sys::fs::directory_iterator it(clangDir, ec), end; it != end && !ec;
+         it.increment(ec)) {
+        SmallString<128> path(it->path());
+        sys::path::append(path, "lib", "linux", name);
+        if (sys::fs::exists(path))
+            return path.str().str();
+    }
+#endif
+    return "";
+}
+}
@@ -0,0 +1,63 @@
+/**
+ * @file optimizer.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#pragma once
+
+#include <string>
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include "specialize.h"
+#include "vectormath.h"
+
+
+namespace lisa
+{
+// link-time optimization the module is prepared for (-flto[=thin])
+enum LTOMode {
+    LTO_NONE,
+    LTO_FULL,   // the pre-link pipeline, the rest runs on the merged module
+    LTO_THIN,   // the ThinLTO pre-link pipeline, written with a summary
+};
+
+
+struct OptimizerOptions {
+    // -O<n>, at 0 only the per-function passes of CodeGenVisitor run
+    unsigned level = 0;
+    // -fprofile-generate[=dir], write raw profiles to dir at exit
+    bool profileGenerate = false;
+    std::string profileDir;
+    // -fprofile-use=file, an indexed profile from llvm-profdata merge
+    std::string profileUse;
+    // clone functions for constant arguments at -O2 and above
+    // (-fno-specialize, -fspecialize-budget, -fspecialize-max-clones)
+    bool specialize = true;
+    SpecializeOptions specializeOptions;
+    // let vectorized loops call the SIMD math of the runtime instead of
+    // libm per element (-fno-vector-math)
+    bool vectorMath = true;
+    // only run the pre-link part of the pipeline, for bitcode that is
+    // optimized again at link time
+    LTOMode lto = LTO_NONE;
+};
+
+
+// run the whole-module pipeline, including PGO instrumentation or
+// profile use, on a module that is about to be emitted
+void optimizeModule(llvm::Module &module, llvm::TargetMachine *targetMachine,
+                    const OptimizerOptions &opts);
+
+// archive of the LLVM profile runtime, empty if it is not installed
+std::string findProfileRuntime();
+}
+
+
+#endif
@@ -52,6 +52,14 @@ std::unique_ptr<ExprAST> NumberExpr(Lexer *lex) {
 }
 
 
+// string expression -> string
+std::unique_ptr<ExprAST> StringExpr(Lexer *lex) {
+    Token t;
+    GET_TOK
+    return std::make_unique<StringExprAST>(t.lx);
+}
+
+
 // paren expression -> "(" expression ")"
 std::unique_ptr<ExprAST> ParenExpr(Lexer *lex) {
     Token t;
@@ -68,7 +76,7 @@ std::unique_ptr<ExprAST> ParenExpr(Lexer *lex) {
 }
 
 
-// identifier expression -> ID | ID "(" expression* ")"
+// identifier expression -> (ID | ID "(" expression* ")") index*
 std::unique_ptr<ExprAST> IdentifierExpr(Lexer *lex) {
     Token t;
     GET_TOK // t is ID
@@ -77,7 +85,7 @@ std::unique_ptr<ExprAST> IdentifierExpr(Lexer *lex) {
         ERROR("Expected identifier")
     PEEK_TOK // t is "(" or something else
     if (!(MATCH_TOK(TOK_SYM, "(")))
-        return std::make_unique<VariableExprAST>(idName);
+        return IndexExpr(lex, std::make_unique<VariableExprAST>(idName));
     GET_TOK // t is "("
     PEEK_TOK // t is ")" or expression
     std::vector<std::unique_ptr<ExprAST>> args;
@@ -100,18 +108,147 @@ std::unique_ptr<ExprAST> IdentifierExpr(Lexer *lex) {
             GET_TOK // t is ","
         }
     }
-    return std::make_unique<CallExprAST>(idName, std::move(args));
+    return IndexExpr(lex, std::make_unique<CallExprAST>(idName, std::move(args)));
+}
+
+
+// index -> "[" expression ("," expression)* "]"
+// any number of indices may follow a variable or a call
+std::unique_ptr<ExprAST> IndexExpr(Lexer *lex, std::unique_ptr<ExprAST> tensor) {
+    Token t;
+    PEEK_TOK // t is "[" or something else
+    while (MATCH_TOK(TOK_SYM, "[")) {
+        GET_TOK // t is "["
+        std::vector<std::unique_ptr<ExprAST>> indices;
+        while (true) {
+            auto index = Expr(lex);
+            if (!index)
+                return nullptr;
+            indices.push_back(std::move(index));
+            GET_TOK // t is "]" or ","
+            if (MATCH_TOK(TOK_SYM, "]"))
+                break;
+            if (!(MATCH_TOK(TOK_SYM, ",")))
+                ERROR("Expected ']' or ',' in index")
+        }
+        tensor = std::make_unique<IndexExprAST>(std::move(tensor), std::move(indices));
+        PEEK_TOK // t is "[" or something else
+    }
+    return tensor;
+}
+
+
+// one bracketed list of a tensor literal at the given nesting depth
+// the first list at every depth fixes the length of that dimension,
+// later lists at the same depth have to match it, scalarDepth is the
+// depth of the first scalar, lists may only be nested above it
+static bool TensorList(Lexer *lex, size_t depth, std::vector<int64_t> &shape,
+                       std::vector<std::unique_ptr<ExprAST>> &elements,
+                       size_t &scalarDepth) {
+    Token t = GetTok(lex); // t is "["
+    if (!(MATCH_TOK(TOK_SYM, "["))) {
+        parseError("Expected '['", t);
+        return false;
+    }
+    if (depth == LISA_MAX_RANK) {
+        parseError("Tensor literal has too many dimensions", t);
+        return false;
+    }
+    if (depth == shape.size())
+        shape.push_back(-1);
+    int64_t count = 0;
+    t = PeekTok(lex); // t is "]" or an element
+    while (!(MATCH_TOK(TOK_SYM, "]"))) {
+        if (MATCH_TOK(TOK_SYM, "[")) {
+            if (depth >= scalarDepth) {
+                parseError("Ragged tensor literal", t);
+                return false;
+            }
+            if (!TensorList(lex, depth + 1, shape, elements, scalarDepth))
+                return false;
+        }
+        else {
+            // scalars only at the innermost depth
+            if (shape.size() != depth + 1 ||
+                (scalarDepth != LISA_MAX_RANK && scalarDepth != depth)) {
+                parseError("Ragged tensor literal", t);
+                return false;
+            }
+            scalarDepth = depth;
+            auto element = Expr(lex);
+            if (!element)
+                return false;
+            elements.push_back(std::move(element));
+        }
+        count++;
+        t = GetTok(lex); // t is "]" or ","
+        if (MATCH_TOK(TOK_SYM, "]"))
+            break;
+        if (!(MATCH_TOK(TOK_SYM, ","))) {
+            parseError("Expected ']' or ',' in tensor literal", t);
+            return false;
+        }
+        t = PeekTok(lex);
+    }
+    if (count == 0)
+        GetTok(lex); // t is "]"
+    if (shape[depth] == -1)
+        shape[depth] = count;
+    else if (shape[depth] != count) {
+        parseError("Ragged tensor literal", t);
+        return false;
+    }
+    return true;
+}
+
+
+// tensor expr -> "[" (expression | tensor expr) ("," ...)* "]"
+std::unique_ptr<ExprAST> TensorExpr(Lexer *lex) {
+    Token t;
+    PEEK_TOK // t is "["
+    std::vector<int64_t> shape;
+    std::vector<std::unique_ptr<ExprAST>> elements;
+    size_t scalarDepth = LISA_MAX_RANK;    // no scalar yet
+    if (!TensorList(lex, 0, shape, elements, scalarDepth))
+        return nullptr;
+    int64_t size = 1;
+    for (int64_t dim : shape)
+        size *= dim;
+    if (size != (int64_t)elements.size())
+        ERROR("Ragged tensor literal")
+    return std::make_unique<TensorExprAST>(std::move(shape), std::move(elements));
 }
 
 
-// primary -> number expr | paren expr | identifier expr | if expr | for expr
+// tensor declaration -> "tensor" ID
+// the variable has to be assigned a tensor
+std::unique_ptr<ExprAST> TensorDecl(Lexer *lex) {
+    Token t;
+    GET_TOK // t is "tensor"
+    GET_TOK // t is ID
+    if (t.tp != TOK_ID)
+        ERROR("Expected variable name after 'tensor'")
+    auto var = std::make_unique<VariableExprAST>(t.lx);
+    var->declaredTensor = true;
+    return var;
+}
+
+
+// primary -> number expr | string expr | paren expr | identifier expr
+//            | if expr | for expr | tensor expr | tensor declaration
 std::unique_ptr<ExprAST> Primary(Lexer *lex) {
     Token t;
     PEEK_TOK
     if (t.tp == TOK_NUM)
         return NumberExpr(lex);
+    if (t.tp == TOK_STR)
+        return StringExpr(lex);
     if (MATCH_TOK(TOK_SYM, "("))
         return ParenExpr(lex);
+    if (MATCH_TOK(TOK_SYM, "["))
+        return TensorExpr(lex);
+    if (t.tp == TOK_TENSOR)
+        return TensorDecl(lex);
     if (t.tp == TOK_ID)
         return IdentifierExpr(lex);
     if (t.tp == TOK_IF)
@@ -318,21 +455,32 @@ std::unique_ptr<ReturnExprAST> ReturnExpr(Lexer *lex) {
 }
 
 
-// prototype -> ID "(" ID* ")"
+// prototype -> "tensor"? ID "(" ("tensor"? ID)* ")"
 std::unique_ptr<PrototypeAST> Prototype(Lexer *lex) {
     Token t;
-    GET_TOK // t is ID
-    if (t.tp != TOK_ID)
+    GET_TOK // t is "tensor" or ID
+    ValueKind resultKind = VALUE_SCALAR;
+    if (t.tp == TOK_TENSOR) {
+        resultKind = VALUE_TENSOR;
+        GET_TOK // t is ID
+    }
+    // qualified names are reserved for built-ins
+    if (t.tp != TOK_ID || t.lx.find('.') != std::string::npos)
         ERROR("Expected function name in prototype")
     std::string fnName = t.lx;
     GET_TOK // t is "("
     if (!(MATCH_TOK(TOK_SYM, "(")))
         ERROR("Expected '(' in prototype")
     std::vector<std::string> argNames;
-    GET_TOK // t is ")" or ID
+    std::vector<ValueKind> argKinds;
+    GET_TOK // t is ")", "tensor" or ID
     if (!(MATCH_TOK(TOK_SYM, ")"))) {
         while (true) {
-            if (t.tp != TOK_ID)
+            argKinds.push_back(t.tp == TOK_TENSOR ? VALUE_TENSOR : VALUE_SCALAR);
+            if (t.tp == TOK_TENSOR) {
+                GET_TOK // t is ID
+            }
+            if (t.tp != TOK_ID || t.lx.find('.') != std::string::npos)
                 ERROR("Expected identifier in argument list")
             argNames.push_back(t.lx);
             GET_TOK
@@ -345,14 +493,25 @@ std::unique_ptr<PrototypeAST> Prototype(Lexer *lex) {
     }
     if (!(MATCH_TOK(TOK_SYM, ")")))
         ERROR("Expected ')' in prototype")
-    return std::make_unique<PrototypeAST>(fnName, std::move(argNames));
+    auto proto = std::make_unique<PrototypeAST>(fnName, std::move(argNames));
+    proto->argKinds = std::move(argKinds);
+    proto->resultKind = resultKind;
+    return proto;
 }
 
 
-// definition -> "fn" prototype "{" expression* "}"
+// definition -> ("@" ID)* "fn" prototype "{" expression* "}"
 std::unique_ptr<FunctionAST> Definition(Lexer *lex) {
     Token t;
-    GET_TOK // t is "fn"
+    std::vector<std::string> decorators;
+    GET_TOK // t is "@" or "fn"
+    while (MATCH_TOK(TOK_SYM, "@")) {
+        GET_TOK // t is ID
+        if (t.tp != TOK_ID)
+            ERROR("Expected decorator name after '@'")
+        decorators.push_back(t.lx);
+        GET_TOK // t is "@" or "fn"
+    }
     if (!(MATCH_TOK(TOK_FN, "fn")))
         ERROR("Expected 'fn' in definition")
     auto proto = Prototype(lex);
@@ -376,7 +535,9 @@ std::unique_ptr<FunctionAST> Definition(Lexer *lex) {
     GET_TOK // t is "}"
     if (!(MATCH_TOK(TOK_SYM, "}")))
         ERROR("Expected '}' in definition")
-    return std::make_unique<FunctionAST>(std::move(proto), std::move(exprs));
+    auto fn = std::make_unique<FunctionAST>(std::move(proto), std::move(exprs));
+    fn->decorators = std::move(decorators);
+    return fn;
 }
 
 
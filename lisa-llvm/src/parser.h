@@ -18,8 +18,12 @@
 
 // declare all the parsing functions
 std::unique_ptr<ExprAST> NumberExpr(Lexer *lex);
+std::unique_ptr<ExprAST> StringExpr(Lexer *lex);
 std::unique_ptr<ExprAST> ParenExpr(Lexer *lex);
 std::unique_ptr<ExprAST> IdentifierExpr(Lexer *lex);
+std::unique_ptr<ExprAST> IndexExpr(Lexer *lex, std::unique_ptr<ExprAST> tensor);
+std::unique_ptr<ExprAST> TensorExpr(Lexer *lex);
+std::unique_ptr<ExprAST> TensorDecl(Lexer *lex);
 std::unique_ptr<ExprAST> Primary(Lexer *lex);
 std::unique_ptr<ExprAST> Expr(Lexer *lex);
 std::unique_ptr<ExprAST> BinOpRHS(Lexer *lex, int exprPrec,
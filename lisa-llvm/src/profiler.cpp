@@ -0,0 +1,284 @@
+/**
+ * @file profiler.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "profiler.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "llvm/Support/Format.h"
+#include "llvm/Support/TimeProfiler.h"
+
+
+// allocation counter, global operator new is replaced below
+// so that every allocation in the compiler (LLVM included) is seen
+static thread_local uint64_t threadAllocs = 0;
+
+
+void *operator new(size_t size) {
+    threadAllocs++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+
+namespace lisa
+{
+typedef std::chrono::steady_clock Clock;
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "Lexing", "Parsing", "Constant eval", "Fusion", "Shape inference",
+    "Escape analysis", "Code generation", "Optimization", "Emission"
+};
+
+
+// time spent in one function, inclusive of nested phases
+struct FunctionRecord {
+    std::string name;
+    Phase phase;
+    double seconds;
+    uint64_t allocs;
+};
+
+
+// per-function totals in the report
+struct FunctionTotals {
+    double seconds[PHASE_COUNT] = {};
+    uint64_t allocs = 0;
+};
+
+
+// statistics collected by a single thread
+struct ThreadStats {
+    double seconds[PHASE_COUNT] = {};
+    uint64_t allocs[PHASE_COUNT] = {};
+    long peakRSS[PHASE_COUNT] = {};    // KB
+    uint64_t scopes[PHASE_COUNT] = {};
+    std::vector<FunctionRecord> functions;
+    // exclusive accounting state
+    std::vector<Phase> stack;
+    Clock::time_point mark;
+    uint64_t allocMark = 0;
+};
+
+
+static bool reportEnabled = false;
+static bool traceEnabled = false;
+static std::mutex statsMutex;
+static std::vector<std::unique_ptr<ThreadStats>> allStats;
+static thread_local ThreadStats *threadStats = nullptr;
+
+
+// stats of the calling thread, registered on first use
+static ThreadStats &getThreadStats() {
+    if (!threadStats) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        allStats.push_back(std::make_unique<ThreadStats>());
+        threadStats = allStats.back().get();
+    }
+    return *threadStats;
+}
+
+
+// peak resident set size of the process so far, in KB
+static long peakRSS() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+// charge the time and allocations since the last mark to the top phase
+static void charge(ThreadStats &stats, Clock::time_point now) {
+    if (!stats.stack.empty()) {
+        Phase top = stats.stack.back();
+        stats.seconds[top] +=
+            std::chrono::duration<double>(now - stats.mark).count();
+        stats.allocs[top] += threadAllocs - stats.allocMark;
+    }
+    stats.mark = now;
+    stats.allocMark = threadAllocs;
+}
+
+
+void enableProfiler(bool report, bool trace) {
+    reportEnabled = report;
+    traceEnabled = trace;
+    if (traceEnabled)
+        llvm::timeTraceProfilerInitialize(0, "lisa");
+}
+
+
+bool profilerEnabled() {
+    return reportEnabled || traceEnabled;
+}
+
+
+void profilerThreadBegin() {
+    if (traceEnabled && !llvm::getTimeTraceProfilerInstance())
+        llvm::timeTraceProfilerInitialize(0, "lisa");
+}
+
+
+void profilerThreadEnd() {
+    if (traceEnabled)
+        llvm::timeTraceProfilerFinishThread();
+}
+
+
+PhaseScope::PhaseScope(Phase phase, llvm::StringRef detail) :
+    active(profilerEnabled()), phase(phase), detail(detail) {
+    if (!active)
+        return;
+    ThreadStats &stats = getThreadStats();
+    start = Clock::now();
+    startAllocs = threadAllocs;
+    charge(stats, start);
+    stats.stack.push_back(phase);
+    stats.scopes[phase]++;
+    // single tokens are far too small to be useful trace events
+    if (traceEnabled && phase != PHASE_LEX)
+        llvm::timeTraceProfilerBegin(phaseNames[phase], detail);
+}
+
+
+PhaseScope::~PhaseScope() {
+    if (!active)
+        return;
+    ThreadStats &stats = getThreadStats();
+    Clock::time_point now = Clock::now();
+    charge(stats, now);
+    stats.stack.pop_back();
+    // getrusage is a syscall, only sample it every so often while lexing
+    if (phase != PHASE_LEX || stats.peakRSS[phase] == 0 ||
+        (stats.scopes[phase] & 4095) == 0)
+        stats.peakRSS[phase] = std::max(stats.peakRSS[phase], peakRSS());
+    if (phase == PHASE_CODEGEN || phase == PHASE_OPTIMIZE) {
+        double seconds = std::chrono::duration<double>(now - start).count();
+        stats.functions.push_back({detail.empty() ? "<toplevel>" : detail.str(),
+                                   phase, seconds, threadAllocs - startAllocs});
+    }
+    if (traceEnabled && phase != PHASE_LEX)
+        llvm::timeTraceProfilerEnd();
+}
+
+
+void printTimeReport(llvm::raw_ostream &os) {
+    if (!reportEnabled)
+        return;
+    // sum up every thread
+    ThreadStats total;
+    std::map<std::string, FunctionTotals> functions;
+    for (auto &stats : allStats) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            total.seconds[p] += stats->seconds[p];
+            total.allocs[p] += stats->allocs[p];
+            total.peakRSS[p] = std::max(total.peakRSS[p], stats->peakRSS[p]);
+        }
+        for (auto &fn : stats->functions) {
+            auto &entry = functions[fn.name];
+            entry.seconds[fn.phase] += fn.seconds;
+            if (fn.phase == PHASE_CODEGEN)
+                entry.allocs += fn.allocs;
+        }
+    }
+    double totalSeconds = 0;
+    uint64_t totalAllocs = 0;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        totalSeconds += total.seconds[p];
+        totalAllocs += total.allocs[p];
+    }
+
+    os << "===" << std::string(73, '-') << "===\n"
+       << "                        Lisa compile time report\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << "  Total time across all threads: "
+       << llvm::format("%.4f", totalSeconds) << " seconds\n\n"
+       << llvm::format("  %-18s %12s %8s %14s %14s\n", (const char *)"Phase",
+                       (const char *)"Wall (s)", (const char *)"%",
+                       (const char *)"Allocations", (const char *)"Peak RSS (MB)");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        double pct = totalSeconds > 0 ? 100.0 * total.seconds[p] / totalSeconds : 0;
+        os << llvm::format("  %-18s %12.4f %7.1f%% %14llu %14.1f\n",
+                           phaseNames[p], total.seconds[p], pct,
+                           (unsigned long long)total.allocs[p],
+                           total.peakRSS[p] / 1024.0);
+    }
+    os << llvm::format("  %-18s %12.4f %7.1f%% %14llu %14.1f\n", (const char *)"Total",
+                       totalSeconds, 100.0, (unsigned long long)totalAllocs,
+                       peakRSS() / 1024.0);
+
+    // slowest functions first
+    typedef std::pair<std::string, double> Entry;
+    std::vector<Entry> order;
+    for (auto &fn : functions)
+        order.push_back({fn.first, fn.second.seconds[PHASE_CODEGEN]});
+    std::sort(order.begin(), order.end(), [](const Entry &a, const Entry &b) {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    });
+    const size_t maxFunctions = 20;
+    os << "\n  Per-function breakdown ("
+       << std::min(order.size(), maxFunctions) << " of " << order.size()
+       << " functions, slowest first, codegen includes optimization)\n"
+       << llvm::format("  %-30s %14s %14s %14s\n", (const char *)"Function",
+                       (const char *)"Codegen (s)", (const char *)"Optimize (s)",
+                       (const char *)"Allocations");
+    for (size_t i = 0; i < order.size() && i < maxFunctions; i++) {
+        auto &entry = functions[order[i].first];
+        os << llvm::format("  %-30s %14.6f %14.6f %14llu\n",
+                           order[i].first.c_str(), entry.seconds[PHASE_CODEGEN],
+                           entry.seconds[PHASE_OPTIMIZE],
+                           (unsigned long long)entry.allocs);
+    }
+    os << "\n";
+}
+
+
+bool writeTimeTrace(const std::string &file) {
+    if (!traceEnabled)
+        return true;
+    if (auto err = llvm::timeTraceProfilerWrite(file, "lisa")) {
+        llvm::errs() << "Could not write time trace: "
+            << llvm::toString(std::move(err)) << "\n";
+        return false;
+    }
+    llvm::timeTraceProfilerCleanup();
+    return true;
+}
+}
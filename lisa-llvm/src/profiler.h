@@ -0,0 +1,73 @@
+/**
+ * @file profiler.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+
+namespace lisa
+{
+// compiler phases tracked by the profiler
+enum Phase {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CONST_EVAL,
+    PHASE_FUSION,
+    PHASE_SHAPES,
+    PHASE_ESCAPE,
+    PHASE_CODEGEN,
+    PHASE_OPTIMIZE,
+    PHASE_EMIT,
+    PHASE_COUNT
+};
+
+
+// turn on phase timing (-ftime-report) and/or trace events (-ftime-trace)
+void enableProfiler(bool report, bool trace);
+bool profilerEnabled();
+
+// worker threads must call these around each task when tracing
+void profilerThreadBegin();
+void profilerThreadEnd();
+
+// results, call once every worker has finished
+void printTimeReport(llvm::raw_ostream &os);
+bool writeTimeTrace(const std::string &file);
+
+
+// times a phase for as long as the scope is alive
+// nested scopes are subtracted from the enclosing one, so every phase
+// in the report only counts its own time and allocations
+// the detail names the function (or file) in the breakdown and the trace
+class PhaseScope
+{
+public:
+    explicit PhaseScope(Phase phase, llvm::StringRef detail = "");
+    ~PhaseScope();
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+private:
+    bool active;
+    Phase phase;
+    llvm::StringRef detail;
+    std::chrono::steady_clock::time_point start;
+    uint64_t startAllocs;
+};
+}
+
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * @file queue.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace lisa
+{
+// lock-free bounded queue for exactly one producer and one consumer thread
+// the producer only writes tail and the consumer only writes head, so a
+// pair of acquire/release atomics is all the synchronisation needed
+template <typename T>
+class SPSCQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SPSCQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // producer side, item is only moved from on success
+    bool tryPush(T &&item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool tryPop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+            return false;
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // blocking versions, give the core away while the other side catches up
+    void push(T item) {
+        while (!tryPush(std::move(item)))
+            std::this_thread::yield();
+    }
+
+    T pop() {
+        T item;
+        while (!tryPop(item))
+            std::this_thread::yield();
+        return item;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // keep the two indices on separate cache lines
+    std::atomic<size_t> head;
+    char headPad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char tailPad[64 - sizeof(std::atomic<size_t>)];
+};
+}
+
+
+#endif
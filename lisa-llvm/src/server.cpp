@@ -0,0 +1,470 @@
+/**
+ * @file server.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+
+namespace lisa
+{
+// a request is a header, then cwd and the arguments as NUL terminated
+// strings, the client's stdout and stderr travel with the header
+// the reply is the exit status as an int32
+enum RequestKind : uint32_t {
+    REQUEST_COMPILE,
+    REQUEST_STATS,
+};
+
+
+struct RequestHeader {
+    uint32_t kind;
+    uint32_t length;    // bytes of strings after the header
+};
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static int signalPipe[2] = {-1, -1};
+static volatile sig_atomic_t stopping = 0;
+
+
+static int serverError(const std::string &str) {
+    fprintf(stderr, "\033[1;31mServer Error:\033[0m %s\n", str.c_str());
+    return 1;
+}
+
+
+// wake up the poll loop, the handlers only write to the pipe
+static void onSignal(int sig) {
+    int saved = errno;
+    if (sig != SIGCHLD)
+        stopping = 1;
+    char c = 0;
+    (void)!write(signalPipe[1], &c, 1);
+    errno = saved;
+}
+
+
+static bool writeAll(int fd, const void *data, size_t size) {
+    const char *p = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static bool readAll(int fd, void *data, size_t size) {
+    char *p = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+
+static bool socketAddress(const std::string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+
+static int connectTo(const std::string &path) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// send a request header and its strings, out and err go along
+static bool sendMessage(int fd, const RequestHeader &header, const std::string &strings,
+                        int out, int err) {
+    RequestHeader copy = header;
+    iovec iov = {&copy, sizeof(copy)};
+    int fds[2] = {out, err};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(copy) &&
+        writeAll(fd, strings.data(), strings.size());
+}
+
+
+// send a request with the caller's stdout and stderr, then wait for the status
+static int sendRequest(int fd, RequestKind kind, const std::string &strings) {
+    RequestHeader header = {kind, static_cast<uint32_t>(strings.size())};
+    fflush(stdout);
+    fflush(stderr);
+    int32_t status;
+    if (!sendMessage(fd, header, strings, STDOUT_FILENO, STDERR_FILENO) ||
+        !readAll(fd, &status, sizeof(status)))
+        return serverError("lost the connection to the compile server");
+    return status;
+}
+
+
+// read a request, out and err are the client's descriptors
+static bool receiveRequest(int fd, RequestHeader &header, std::vector<std::string> &strings,
+                           int &out, int &err) {
+    iovec iov = {&header, sizeof(header)};
+    int fds[2];
+    char control[CMSG_SPACE(sizeof(fds))];
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(header))
+        return false;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return false;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    out = fds[0];
+    err = fds[1];
+    std::string data(header.length, '\0');
+    if (!readAll(fd, &data[0], data.size())) {
+        close(out);
+        close(err);
+        return false;
+    }
+    for (size_t start = 0; start < data.size();) {
+        size_t end = data.find('\0', start);
+        if (end == std::string::npos)
+            end = data.size();
+        strings.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+
+// latency summary in milliseconds
+static std::string formatStats(std::vector<double> latencies) {
+    char line[256];
+    if (latencies.empty())
+        return "no requests served\n";
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double l : latencies)
+        total += l;
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1,
+                                  static_cast<size_t>(p * latencies.size()))];
+    };
+    snprintf(line, sizeof(line),
+             "%zu requests, latency ms: mean %.2f, p50 %.2f, p95 %.2f, max %.2f\n",
+             latencies.size(), total / latencies.size(), percentile(0.5),
+             percentile(0.95), latencies.back());
+    return line;
+}
+
+
+std::string defaultSocketPath() {
+    if (const char *dir = getenv("XDG_RUNTIME_DIR"))
+        return std::string(dir) + "/lisa.sock";
+    return "/tmp/lisa-" + std::to_string(getuid()) + ".sock";
+}
+
+
+// wait for one request from the server and compile it, never returns
+static void serveRequest(int control, const CompileFunction &compile) {
+    RequestHeader header;
+    std::vector<std::string> strings;
+    int out, err;
+    if (!receiveRequest(control, header, strings, out, err))
+        _exit(0);   // the server has gone away
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    close(out);
+    close(err);
+    if (strings.size() < 2 || chdir(strings[0].c_str()) != 0)
+        _exit(serverError("bad request or working directory"));
+    std::vector<char *> argv;
+    for (size_t i = 1; i < strings.size(); i++)
+        argv.push_back(const_cast<char *>(strings[i].c_str()));
+    argv.push_back(nullptr);
+    optind = 1;     // getopt starts over for the request
+    int status = compile(static_cast<int>(argv.size() - 1), argv.data());
+    // the server only learns the status once the process is gone, so
+    // skip the static destructors
+    fflush(nullptr);
+    _exit(status);
+}
+
+
+// fork a worker that serves a single request, the server keeps the
+// control socket the request is passed on
+// after the fork the worker runs warmUp again, so the copy-on-write page
+// faults of the warm heap are taken while it is idle, not on the request
+static pid_t spawnWorker(const std::vector<int> &serverFds, const std::function<void()> &warmUp,
+                         const CompileFunction &compile, int &control) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        for (int fd : serverFds)
+            close(fd);
+        close(pair[0]);
+        warmUp();
+        serveRequest(pair[1], compile);
+    }
+    close(pair[1]);
+    if (pid < 0) {
+        close(pair[0]);
+        return -1;
+    }
+    control = pair[0];
+    return pid;
+}
+
+
+// a pre-forked process, busy once it has been given a request
+struct Worker {
+    int control;
+    int conn = -1;          // the client waiting for the status
+    Clock::time_point start;
+    std::string args;
+};
+
+
+int runServer(const std::string &socketPath, unsigned maxJobs,
+              const std::function<void()> &warmUp, const CompileFunction &compile) {
+    sockaddr_un addr;
+    if (!socketAddress(socketPath, addr))
+        return serverError("socket path is too long: " + socketPath);
+    int probe = connectTo(socketPath);
+    if (probe >= 0) {
+        close(probe);
+        return serverError("a server is already listening on " + socketPath);
+    }
+    unlink(socketPath.c_str());     // left over from a server that died
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 ||
+        bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        listen(listenFd, 64) < 0)
+        return serverError("could not listen on " + socketPath + ": " + strerror(errno));
+    if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        return serverError("could not create the signal pipe");
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    // warm the server itself so the workers inherit the shared state
+    warmUp();
+    std::map<pid_t, Worker> workers;
+    std::deque<pid_t> idle;
+    // descriptors a new worker must not keep open
+    auto serverFds = [&]() {
+        std::vector<int> fds = {listenFd, signalPipe[0], signalPipe[1]};
+        for (auto &w : workers) {
+            fds.push_back(w.second.control);
+            if (w.second.conn >= 0)
+                fds.push_back(w.second.conn);
+        }
+        return fds;
+    };
+    auto spawn = [&]() {
+        int control;
+        pid_t pid = spawnWorker(serverFds(), warmUp, compile, control);
+        if (pid < 0)
+            return false;
+        workers[pid].control = control;
+        idle.push_back(pid);
+        return true;
+    };
+    for (unsigned i = 0; i < maxJobs; i++) {
+        if (!spawn())
+            return serverError("could not start the workers");
+    }
+    fprintf(stderr, "lisa server listening on %s, %u jobs\n", socketPath.c_str(), maxJobs);
+
+    std::vector<double> latencies;
+    while (!stopping || workers.size() > idle.size()) {
+        // only accept while a worker is free
+        pollfd fds[2] = {{signalPipe[0], POLLIN, 0}, {listenFd, POLLIN, 0}};
+        nfds_t nfds = (!stopping && !idle.empty()) ? 2 : 1;
+        if (poll(fds, nfds, -1) < 0 && errno != EINTR)
+            break;
+        char drain[64];
+        while (read(signalPipe[0], drain, sizeof(drain)) > 0) {}
+
+        int wstatus;
+        pid_t pid;
+        while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+            auto it = workers.find(pid);
+            if (it == workers.end())
+                continue;
+            Worker &w = it->second;
+            if (w.conn >= 0) {
+                int32_t status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                    : 128 + WTERMSIG(wstatus);
+                double ms = std::chrono::duration<double, std::milli>(
+                    Clock::now() - w.start).count();
+                latencies.push_back(ms);
+                fprintf(stderr, "request %zu: %.2f ms, exit %d:%s\n", latencies.size(),
+                        ms, status, w.args.c_str());
+                writeAll(w.conn, &status, sizeof(status));
+                close(w.conn);
+            }
+            else {
+                idle.erase(std::find(idle.begin(), idle.end(), pid));
+            }
+            close(w.control);
+            workers.erase(it);
+            if (!stopping && !spawn())
+                serverError("could not replace a worker");
+        }
+
+        if (nfds < 2 || !(fds[1].revents & POLLIN) || idle.empty())
+            continue;
+        int conn = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0)
+            continue;
+        auto start = Clock::now();
+        RequestHeader header;
+        std::vector<std::string> strings;
+        int out, err;
+        if (!receiveRequest(conn, header, strings, out, err)) {
+            close(conn);
+            continue;
+        }
+        int32_t status = 0;
+        if (header.kind == REQUEST_STATS) {
+            std::string stats = formatStats(latencies);
+            writeAll(out, stats.data(), stats.size());
+        }
+        else {
+            pid = idle.front();
+            idle.pop_front();
+            Worker &w = workers[pid];
+            std::string data;
+            for (auto &str : strings)
+                data += str + '\0';
+            if (sendMessage(w.control, header, data, out, err)) {
+                w.conn = conn;
+                w.start = start;
+                for (size_t i = 2; i < strings.size(); i++)
+                    w.args += " " + strings[i];
+                conn = -1;
+            }
+            else {
+                status = serverError("could not pass the request to a worker");
+                kill(pid, SIGTERM);
+            }
+        }
+        close(out);
+        close(err);
+        if (conn >= 0) {
+            writeAll(conn, &status, sizeof(status));
+            close(conn);
+        }
+    }
+
+    // idle workers exit when their control socket closes
+    for (auto &w : workers)
+        close(w.second.control);
+    for (auto &w : workers)
+        waitpid(w.first, nullptr, 0);
+    close(listenFd);
+    unlink(socketPath.c_str());
+    fprintf(stderr, "lisa server stopped, %s", formatStats(latencies).c_str());
+    return 0;
+}
+
+
+int runClient(const std::string &socketPath, int argc, char **argv) {
+    int fd = connectTo(socketPath);
+    if (fd < 0)
+        return -1;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        close(fd);
+        return serverError("could not get the working directory");
+    }
+    std::string strings(cwd);
+    strings.push_back('\0');
+    for (int i = 0; i < argc; i++) {
+        strings += argv[i];
+        strings.push_back('\0');
+    }
+    int status = sendRequest(fd, REQUEST_COMPILE, strings);
+    close(fd);
+    return status;
+}
+
+
+int printServerStats(const std::string &socketPath) {
+    int fd = connectTo(socketPath);
+    if (fd < 0)
+        return serverError("no server is listening on " + socketPath);
+    int status = sendRequest(fd, REQUEST_STATS, "");
+    close(fd);
+    return status;
+}
+}
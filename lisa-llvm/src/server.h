@@ -0,0 +1,49 @@
+/**
+ * @file server.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+
+namespace lisa
+{
+// runs one compiler invocation and returns its exit status
+typedef std::function<int(int argc, char **argv)> CompileFunction;
+
+// $XDG_RUNTIME_DIR/lisa.sock, or /tmp/lisa-<uid>.sock
+std::string defaultSocketPath();
+
+// compile server (lisa --server), stays resident on a Unix socket
+// every request is compiled by a worker process forked ahead of time from
+// the warm server, so target initialization, whatever warmUp prepared and
+// LLVM's lazily built tables are paid for once, and up to maxJobs requests
+// run concurrently without seeing each other's options
+// a worker serves a single request, in the client's working directory and
+// writing straight to the client's stdout and stderr, which are passed
+// over the socket
+// each request is logged with its latency, the summary is printed on
+// --server-stats and when the server is stopped with SIGINT or SIGTERM
+int runServer(const std::string &socketPath, unsigned maxJobs,
+              const std::function<void()> &warmUp, const CompileFunction &compile);
+
+// forward a compiler invocation to the server (lisa --client)
+// returns the exit status of the request, -1 if no server is listening
+int runClient(const std::string &socketPath, int argc, char **argv);
+
+// print the latency statistics of a running server
+int printServerStats(const std::string &socketPath);
+}
+
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * @file shapes.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "shapes.h"
+#include <cmath>
+#include <cstdio>
+#include "profiler.h"
+
+
+namespace lisa
+{
+typedef ShapeInference::Shape Shape;
+
+
+static Shape scalar() {
+    Shape s;
+    s.kind = Shape::SCALAR;
+    return s;
+}
+
+
+static Shape tensor(std::vector<int64_t> dims) {
+    Shape s;
+    s.kind = Shape::TENSOR;
+    s.dims = std::move(dims);
+    return s;
+}
+
+
+static Shape argument(unsigned arg) {
+    Shape s;
+    s.kind = Shape::ARG;
+    s.arg = arg;
+    return s;
+}
+
+
+// the shape a variable has after either of two assignments
+static Shape join(const Shape &a, const Shape &b) {
+    return a == b ? a : Shape();
+}
+
+
+static std::string format(const Shape &s) {
+    std::string str = "[";
+    for (size_t k = 0; k < s.dims.size(); k++)
+        str += (k ? ", " : "") + std::to_string(s.dims[k]);
+    return str + "]";
+}
+
+
+// a non-negative integer constant, as tensor dimensions are
+static bool constantDim(ExprAST *expr, int64_t &dim) {
+    auto *num = dynamic_cast<NumberExprAST*>(expr);
+    if (!num || !(num->val >= 0) || num->val != std::floor(num->val))
+        return false;
+    dim = (int64_t)num->val;
+    return true;
+}
+
+
+// the shape of argument arg at a call site, for the callee's summary
+static Shape substitute(const Shape &s, const std::vector<Shape> &args) {
+    if (s.kind != Shape::ARG)
+        return s;
+    return s.arg < args.size() ? args[s.arg] : Shape();
+}
+
+
+bool ShapeInference::infer(FunctionAST &fn) {
+    PhaseScope scope(PHASE_SHAPES, fn.proto->name);
+    function = fn.proto->name;
+    vars.clear();
+    auto &kinds = fn.proto->argKinds;
+    for (size_t i = 0; i < fn.proto->args.size(); i++)
+        vars[fn.proto->args[i]] = i < kinds.size() && kinds[i] == VALUE_TENSOR ?
+            argument(i) : scalar();
+
+    // a variable only ever goes from unassigned to a shape to unknown, so
+    // this settles after a few rounds
+    final = false;
+    ok = true;
+    while (true) {
+        auto before = vars;
+        visitBlock(fn.body);
+        if (vars == before)
+            break;
+    }
+    final = true;
+    constraints.clear();
+    returns = false;
+    Shape last = visitBlock(fn.body);
+    result = returns ? join(result, last) : last;
+    if (ok && !function.empty())
+        summaries[function] = {result, constraints};
+    return ok;
+}
+
+
+void ShapeInference::error(const std::string &msg) {
+    if (!final)
+        return;
+    fprintf(stderr, "\033[1;31mShape Error:\033[0m %s (in %s)\n", msg.c_str(),
+            function.empty() ? "top-level expression" : function.c_str());
+    ok = false;
+}
+
+
+void ShapeInference::assign(const std::string &name, const Shape &shape) {
+    auto it = vars.find(name);
+    if (it == vars.end())
+        vars[name] = shape;
+    else
+        it->second = join(it->second, shape);
+}
+
+
+// the shape of an element-wise operation on a and b
+// an operand of known shape decides the result, whatever the other one is
+// a scalar is broadcast, an unknown tensor has to match at runtime
+Shape ShapeInference::combine(const Shape &a, const Shape &b) {
+    if (a.kind == Shape::SCALAR)
+        return b;
+    if (b.kind == Shape::SCALAR)
+        return a;
+    if (a.kind == Shape::TENSOR || b.kind == Shape::TENSOR) {
+        const Shape &known = a.kind == Shape::TENSOR ? a : b;
+        const Shape &other = a.kind == Shape::TENSOR ? b : a;
+        if (other.kind == Shape::TENSOR && other.dims != known.dims)
+            error("tensor shapes do not match: " + format(a) + " and " + format(b));
+        if (other.kind == Shape::ARG && final)
+            constraints.push_back({other.arg, known});
+        return known;
+    }
+    if (a.kind == Shape::ARG) {
+        if (b.kind == Shape::ARG && b.arg != a.arg && final)
+            constraints.push_back({b.arg, a});
+        return a;
+    }
+    return b;
+}
+
+
+ShapeInference::Shape ShapeInference::visitBlock(Block &block) {
+    Shape last = scalar();
+    for (auto &expr : block)
+        last = visit(expr.get());
+    return last;
+}
+
+
+ShapeInference::Shape ShapeInference::visit(ExprAST *expr) {
+    Shape s;
+    if (dynamic_cast<NumberExprAST*>(expr)) {
+        s = scalar();
+    }
+    else if (auto *var = dynamic_cast<VariableExprAST*>(expr)) {
+        size_t dot = var->name.rfind('.');
+        if (dot == std::string::npos) {
+            auto it = vars.find(var->name);
+            if (it != vars.end())
+                s = it->second;
+        }
+        else if (var->name.compare(dot, std::string::npos, ".shape") == 0) {
+            auto it = vars.find(var->name.substr(0, dot));
+            if (it != vars.end() && it->second.kind == Shape::TENSOR)
+                s = tensor({(int64_t)it->second.dims.size()});
+        }
+        else
+            s = scalar();   // math.pi, x.size, x.rank
+    }
+    else if (auto *bin = dynamic_cast<BinaryExprAST*>(expr)) {
+        if (bin->op == ':') {
+            s = visit(bin->rhs.get());
+            if (auto *target = dynamic_cast<VariableExprAST*>(bin->lhs.get()))
+                assign(target->name, s);
+            else
+                visit(bin->lhs.get());
+        }
+        else {
+            Shape lhs = visit(bin->lhs.get());
+            s = combine(lhs, visit(bin->rhs.get()));
+        }
+    }
+    else if (auto *ifExpr = dynamic_cast<IfExprAST*>(expr)) {
+        visit(ifExpr->cond.get());
+        Shape a = visitBlock(ifExpr->if_body);
+        s = join(a, visitBlock(ifExpr->els_body));
+    }
+    else if (auto *forExpr = dynamic_cast<ForExprAST*>(expr)) {
+        visit(forExpr->start.get());
+        visit(forExpr->end.get());
+        if (forExpr->step)
+            visit(forExpr->step.get());
+        assign(forExpr->var_name, scalar());
+        visitBlock(forExpr->body);
+        s = scalar();
+    }
+    else if (auto *whileExpr = dynamic_cast<WhileExprAST*>(expr)) {
+        visitBlock(whileExpr->body);
+        visit(whileExpr->cond.get());
+        s = scalar();
+    }
+    else if (auto *ret = dynamic_cast<ReturnExprAST*>(expr)) {
+        s = visit(ret->expr.get());
+        result = returns ? join(result, s) : s;
+        returns = true;
+    }
+    else if (auto *call = dynamic_cast<CallExprAST*>(expr)) {
+        std::vector<Shape> args;
+        for (auto &arg : call->args)
+            args.push_back(visit(arg.get()));
+        s = visitCall(call, args);
+    }
+    else if (auto *literal = dynamic_cast<TensorExprAST*>(expr)) {
+        for (auto &element : literal->elements)
+            visit(element.get());
+        s = tensor(literal->shape);
+    }
+    else if (auto *index = dynamic_cast<IndexExprAST*>(expr)) {
+        Shape base = visit(index->tensor.get());
+        for (auto &i : index->indices)
+            visit(i.get());
+        if (base.kind == Shape::TENSOR) {
+            if (index->indices.size() != base.dims.size())
+                error(std::to_string(index->indices.size()) + " indices for a tensor of rank " +
+                      std::to_string(base.dims.size()));
+            for (size_t k = 0; k < index->indices.size() && k < base.dims.size(); k++) {
+                auto *num = dynamic_cast<NumberExprAST*>(index->indices[k].get());
+                if (num && !std::isnan(num->val) &&
+                    !(num->val > -1 && (int64_t)num->val < base.dims[k]))
+                    error("index " + std::to_string((int64_t)num->val) +
+                          " out of range for dimension " + std::to_string(k) +
+                          " of size " + std::to_string(base.dims[k]));
+            }
+        }
+        s = scalar();
+    }
+    else if (auto *fused = dynamic_cast<FusedExprAST*>(expr)) {
+        s = visit(fused->root.get());
+        for (auto &reduction : fused->reductions)
+            if (!reduction.var.empty())
+                assign(reduction.var, scalar());
+        if (fused->reduced)
+            s = scalar();
+    }
+
+    if (final && s.kind == Shape::TENSOR) {
+        expr->staticShape.known = true;
+        expr->staticShape.dims = s.dims;
+    }
+    return s;
+}
+
+
+// builtins by their definition, Lisa functions by their summary
+ShapeInference::Shape ShapeInference::visitCall(CallExprAST *call,
+                                                 const std::vector<Shape> &args) {
+    const std::string &callee = call->callee;
+    ReduceKind kind;
+    if (isElementwiseBuiltin(callee)) {
+        Shape s = scalar();
+        for (auto &arg : args)
+            s = combine(s, arg);
+        return s;
+    }
+    if (isReductionBuiltin(callee, kind))
+        return scalar();
+    if (callee == "tensor.zeros" || callee == "tensor.fill") {
+        std::vector<int64_t> dims;
+        for (size_t i = callee == "tensor.fill"; i < call->args.size(); i++) {
+            int64_t dim;
+            if (!constantDim(call->args[i].get(), dim))
+                return Shape();
+            dims.push_back(dim);
+        }
+        if (dims.empty() || dims.size() > LISA_MAX_RANK)
+            return Shape();
+        return tensor(dims);
+    }
+    if (callee == "math.matmul" && args.size() == 2) {
+        const Shape &a = args[0], &b = args[1];
+        for (const Shape *m : {&a, &b})
+            if (m->kind == Shape::TENSOR && m->dims.size() != 2)
+                error("math.matmul of a tensor of shape " + format(*m));
+        if (a.kind != Shape::TENSOR || b.kind != Shape::TENSOR ||
+            a.dims.size() != 2 || b.dims.size() != 2)
+            return Shape();
+        if (a.dims[1] != b.dims[0])
+            error("cannot multiply matrices of shape " + format(a) + " and " + format(b));
+        return tensor({a.dims[0], b.dims[1]});
+    }
+    auto it = summaries.find(callee);
+    if (it == summaries.end())
+        return Shape();
+    // the callee's requirements on its arguments, in terms of ours
+    for (auto &constraint : it->second.constraints) {
+        if (constraint.first >= args.size())
+            continue;
+        Shape required = substitute(constraint.second, args);
+        if (required.kind == Shape::TENSOR && args[constraint.first].kind == Shape::TENSOR &&
+            required.dims != args[constraint.first].dims)
+            error("argument " + std::to_string(constraint.first + 1) + " of " + callee +
+                  " has shape " + format(args[constraint.first]) + " but needs " +
+                  format(required));
+        else
+            combine(args[constraint.first], required);
+    }
+    return substitute(it->second.result, args);
+}
+}
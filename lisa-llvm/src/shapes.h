@@ -0,0 +1,80 @@
+/**
+ * @file shapes.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.h"
+
+
+namespace lisa
+{
+// compile-time tensor shapes, run on the AST right before code generation
+// shapes start at literals, tensor.zeros/fill with constant dimensions and
+// math.matmul, and flow through element-wise operations, variables (if
+// every assignment agrees) and calls to functions defined earlier
+// operands whose shapes are both known and differ, constant indices out
+// of range and matrix products of the wrong shapes are compile errors
+// known shapes are stored in ExprAST::staticShape, codegen then drops the
+// runtime checks and the stride loads, and unrolls small loops
+class ShapeInference
+{
+public:
+    // a shape, or the shape of the argument arg, which is only known at
+    // the call site
+    struct Shape {
+        enum Kind {UNKNOWN, SCALAR, TENSOR, ARG} kind = UNKNOWN;
+        std::vector<int64_t> dims;
+        unsigned arg = 0;
+
+        bool operator==(const Shape &o) const {
+            return kind == o.kind && dims == o.dims && arg == o.arg;
+        }
+        bool operator!=(const Shape &o) const {return !(*this == o);}
+    };
+
+    // annotate the body of a function, false after a shape error
+    bool infer(FunctionAST &fn);
+
+private:
+    // what a call needs to know about a function defined earlier, its
+    // result, and the shapes its arguments have to match
+    struct Summary {
+        Shape result;
+        std::vector<std::pair<unsigned, Shape>> constraints;
+    };
+    typedef std::vector<std::unique_ptr<ExprAST>> Block;
+
+    Shape visit(ExprAST *expr);
+    Shape visitBlock(Block &block);
+    Shape visitCall(CallExprAST *call, const std::vector<Shape> &args);
+    Shape combine(const Shape &a, const Shape &b);
+    void assign(const std::string &name, const Shape &shape);
+    void error(const std::string &msg);
+
+    std::map<std::string, Summary> summaries;
+    // state of the function being inferred
+    std::string function;
+    std::map<std::string, Shape> vars;
+    std::vector<std::pair<unsigned, Shape>> constraints;
+    Shape result;
+    bool returns = false;
+    bool final = false;     // the variables are settled, annotate and report
+    bool ok = true;
+};
+}
+
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * @file specialize.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "specialize.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+using namespace llvm;
+
+
+namespace lisa
+{
+// constant arguments of a call site, by argument number
+typedef std::vector<std::pair<unsigned, Constant*>> ConstArgs;
+
+
+// call sites of one function that agree on their constant arguments
+struct Candidate {
+    Function *fn;
+    ConstArgs args;
+    std::vector<CallInst*> sites;
+    uint64_t weight = 0;
+};
+
+
+static bool canSpecialize(const Function &fn) {
+    return !fn.isDeclaration() && !fn.isVarArg() && !fn.isInterposable() &&
+        !fn.hasFnAttribute(Attribute::NoInline) && fn.getName() != "main";
+}
+
+
+// calls in loops count more, as a rough stand-in for their frequency
+static uint64_t siteWeight(unsigned loopDepth) {
+    return 1ull << (3 * std::min(loopDepth, 4u));
+}
+
+
+static Function *specialize(Candidate &c) {
+    // arguments mapped to constants are dropped from the clone's signature
+    ValueToValueMapTy vmap;
+    for (auto &arg : c.args)
+        vmap[c.fn->getArg(arg.first)] = arg.second;
+    Function *clone = CloneFunction(c.fn, vmap);
+    clone->setName(c.fn->getName() + ".spec");
+    clone->setLinkage(GlobalValue::InternalLinkage);
+    clone->setVisibility(GlobalValue::DefaultVisibility);
+
+    for (CallInst *call : c.sites) {
+        std::vector<Value*> args;
+        auto constArg = c.args.begin();
+        for (unsigned i = 0; i < call->arg_size(); i++) {
+            if (constArg != c.args.end() && constArg->first == i)
+                constArg++;
+            else
+                args.push_back(call->getArgOperand(i));
+        }
+        CallInst *newCall = CallInst::Create(clone, args, "", call);
+        newCall->takeName(call);
+        newCall->setCallingConv(call->getCallingConv());
+        newCall->setTailCallKind(call->getTailCallKind());
+        newCall->setDebugLoc(call->getDebugLoc());
+        call->replaceAllUsesWith(newCall);
+        call->eraseFromParent();
+    }
+    return clone;
+}
+
+
+PreservedAnalyses SpecializePass::run(Module &module, ModuleAnalysisManager &mam) {
+    auto &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+
+    // group the call sites with constant arguments
+    std::map<std::pair<Function*, ConstArgs>, size_t> index;
+    std::vector<Candidate> candidates;
+    for (Function &caller : module) {
+        if (caller.isDeclaration())
+            continue;
+        LoopInfo &loops = fam.getResult<LoopAnalysis>(caller);
+        for (BasicBlock &bb : caller) {
+            for (Instruction &inst : bb) {
+                auto *call = dyn_cast<CallInst>(&inst);
+                Function *callee = call ? call->getCalledFunction() : nullptr;
+                // recursive calls would only clone the outermost level
+                if (!callee || callee == &caller || !canSpecialize(*callee) ||
+                    call->getFunctionType() != callee->getFunctionType())
+                    continue;
+                ConstArgs args;
+                for (unsigned i = 0; i < call->arg_size(); i++) {
+                    auto *c = dyn_cast<Constant>(call->getArgOperand(i));
+                    if (c && !isa<GlobalValue>(c) && !isa<UndefValue>(c))
+                        args.push_back({i, c});
+                }
+                if (args.empty())
+                    continue;
+                auto key = std::make_pair(callee, args);
+                auto it = index.find(key);
+                if (it == index.end()) {
+                    it = index.insert({key, candidates.size()}).first;
+                    candidates.push_back(Candidate());
+                    candidates.back().fn = callee;
+                    candidates.back().args = args;
+                }
+                Candidate &c = candidates[it->second];
+                c.sites.push_back(call);
+                c.weight += siteWeight(loops.getLoopDepth(&bb));
+            }
+        }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const Candidate &a, const Candidate &b) { return a.weight > b.weight; });
+    unsigned clones = 0, cloned = 0;
+    std::map<Function*, unsigned> perFunction;
+    for (Candidate &c : candidates) {
+        if (clones >= opts.maxClones)
+            break;
+        unsigned size = c.fn->getInstructionCount();
+        if (size > opts.maxFunctionSize || cloned + size > opts.budget ||
+            perFunction[c.fn] >= opts.maxClonesPerFunction)
+            continue;
+        specialize(c);
+        clones++;
+        cloned += size;
+        perFunction[c.fn]++;
+    }
+    return clones ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+}
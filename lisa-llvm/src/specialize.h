@@ -0,0 +1,52 @@
+/**
+ * @file specialize.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+
+namespace lisa
+{
+struct SpecializeOptions {
+    // clones made in the whole module, and of any single function
+    unsigned maxClones = 16;
+    unsigned maxClonesPerFunction = 4;
+    // functions with more instructions than this are never cloned
+    unsigned maxFunctionSize = 1000;
+    // instructions all clones together may add to the module
+    unsigned budget = 4000;
+};
+
+
+// interprocedural function specialization
+// call sites that pass the same constant arguments to a function share an
+// internal clone in which those arguments are replaced by the constants,
+// so loop bounds and tolerances become static in the clone and the rest
+// of the pipeline can fold, fully unroll or vectorize its loops
+// the hottest candidates (call sites weighted by loop depth) are cloned
+// first until the clone cap or the size budget runs out
+class SpecializePass : public llvm::PassInfoMixin<SpecializePass>
+{
+public:
+    explicit SpecializePass(SpecializeOptions opts = SpecializeOptions()) :
+        opts(opts) {}
+    llvm::PreservedAnalyses run(llvm::Module &module,
+                                llvm::ModuleAnalysisManager &mam);
+private:
+    SpecializeOptions opts;
+};
+}
+
+
+#endif
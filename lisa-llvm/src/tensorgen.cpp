@@ -0,0 +1,979 @@
+/**
+ * @file tensorgen.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+// code generation for tensors and the built-in functions
+// a tensor value is a pointer to a lisa_tensor descriptor, element-wise
+// operations become a loop over the contiguous buffers, everything else
+// (allocation, shape checks, strided inputs) calls into the runtime
+
+#include "ast.h"
+#include <cmath>
+#include "llvm/IR/MDBuilder.h"
+using namespace llvm;
+
+
+Value *codeGenError(const char *str);
+
+
+// fields of lisa_tensor, in declaration order
+enum TensorField {
+    FIELD_DATA,
+    FIELD_RANK,
+    FIELD_SIZE,
+    FIELD_SHAPE,
+    FIELD_STRIDES,
+    FIELD_FLAGS,
+    FIELD_REFS,
+};
+
+
+// element-wise math.* functions of one argument, and the LLVM intrinsic
+// computing them (not_intrinsic for a libm call)
+static const std::map<std::string, Intrinsic::ID> mathFunctions = {
+    {"math.exp", Intrinsic::exp},
+    {"math.log", Intrinsic::log},
+    {"math.sqrt", Intrinsic::sqrt},
+    {"math.sin", Intrinsic::sin},
+    {"math.cos", Intrinsic::cos},
+    {"math.abs", Intrinsic::fabs},
+    {"math.floor", Intrinsic::floor},
+    {"math.ceil", Intrinsic::ceil},
+    {"math.tanh", Intrinsic::not_intrinsic},
+    {"math.erf", Intrinsic::not_intrinsic},
+    {"math.sigmoid", Intrinsic::not_intrinsic},
+};
+
+
+static const std::map<std::string, ReduceKind> reductionFunctions = {
+    {"math.sum", REDUCE_SUM},
+    {"math.max", REDUCE_MAX},
+    {"math.min", REDUCE_MIN},
+    {"math.mean", REDUCE_MEAN},
+};
+
+
+bool isElementwiseBuiltin(const std::string &name) {
+    return mathFunctions.count(name) || name == "math.pow";
+}
+
+
+bool isReductionBuiltin(const std::string &name, ReduceKind &kind) {
+    auto it = reductionFunctions.find(name);
+    if (it == reductionFunctions.end())
+        return false;
+    kind = it->second;
+    return true;
+}
+
+
+static_assert(sizeof(lisa_tensor) == sizeof(int64_t) * (5 + 2 * LISA_MAX_RANK),
+              "tensorType() does not match lisa_tensor");
+
+
+StructType *CodeGenVisitor::tensorType() {
+    if (StructType *type = StructType::getTypeByName(*context, "lisa.tensor"))
+        return type;
+    Type *i64 = Type::getInt64Ty(*context);
+    ArrayType *dims = ArrayType::get(i64, LISA_MAX_RANK);
+    return StructType::create(
+        *context, {Type::getDoublePtrTy(*context), i64, i64, dims, dims, i64, i64},
+        "lisa.tensor");
+}
+
+
+Type *CodeGenVisitor::valueType(ValueKind kind) {
+    if (kind == VALUE_TENSOR)
+        return tensorType()->getPointerTo();
+    return Type::getDoubleTy(*context);
+}
+
+
+// declare a runtime function of lisa_runtime.h
+FunctionCallee CodeGenVisitor::runtimeFunction(const std::string &name) {
+    Type *tensorPtr = valueType(VALUE_TENSOR);
+    Type *doubleTy = Type::getDoubleTy(*context);
+    Type *i64 = Type::getInt64Ty(*context);
+    Type *voidTy = Type::getVoidTy(*context);
+    Type *charPtr = Type::getInt8PtrTy(*context);
+    FunctionType *ft = nullptr;
+    bool allocates = false, fails = false;
+    if (name == "lisa_tensor_new") {
+        ft = FunctionType::get(tensorPtr, {i64, i64->getPointerTo()}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_full") {
+        ft = FunctionType::get(tensorPtr, {i64, i64->getPointerTo(), doubleTy}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_new_like" || name == "lisa_tensor_shape") {
+        ft = FunctionType::get(tensorPtr, {tensorPtr}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_matmul") {
+        ft = FunctionType::get(tensorPtr, {tensorPtr, tensorPtr}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_load_npy") {
+        ft = FunctionType::get(tensorPtr, {charPtr}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_load_raw") {
+        ft = FunctionType::get(tensorPtr, {charPtr, i64, i64->getPointerTo()}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_load_csv") {
+        ft = FunctionType::get(tensorPtr, {charPtr}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_read_csv") {
+        ft = FunctionType::get(tensorPtr, {charPtr, i64}, false);
+        allocates = true;
+    }
+    else if (name == "lisa_tensor_save_npy" || name == "lisa_tensor_append_npy")
+        ft = FunctionType::get(i64, {tensorPtr, charPtr}, false);
+    else if (name == "lisa_tensor_contiguous")
+        ft = FunctionType::get(tensorPtr, {tensorPtr}, false);
+    else if (name == "lisa_tensor_unique")
+        ft = FunctionType::get(tensorPtr, {tensorPtr}, false);
+    else if (name == "lisa_tensor_retain" || name == "lisa_tensor_adopt" ||
+             name == "lisa_tensor_free")
+        ft = FunctionType::get(voidTy, {tensorPtr}, false);
+    else if (name == "lisa_arena_enter")
+        ft = FunctionType::get(i64, {}, false);
+    else if (name == "lisa_arena_exit")
+        ft = FunctionType::get(voidTy, {i64, tensorPtr}, false);
+    else if (name == "lisa_tensor_check_shapes")
+        ft = FunctionType::get(voidTy, {tensorPtr, tensorPtr}, false);
+    else if (name == "lisa_tensor_index_error") {
+        ft = FunctionType::get(voidTy, {tensorPtr, i64, i64}, false);
+        fails = true;
+    }
+    else if (name == "lisa_tensor_rank_error") {
+        ft = FunctionType::get(voidTy, {tensorPtr, i64}, false);
+        fails = true;
+    }
+    assert(ft && "unknown runtime function");
+    FunctionCallee callee = module->getOrInsertFunction(name, ft);
+    if (auto *fn = dyn_cast<Function>(callee.getCallee())) {
+        fn->addFnAttr(Attribute::NoUnwind);
+        if (allocates)
+            fn->addRetAttr(Attribute::NoAlias);
+        if (fails) {
+            fn->addFnAttr(Attribute::NoReturn);
+            fn->addFnAttr(Attribute::Cold);
+        }
+    }
+    return callee;
+}
+
+
+// make the function a scope of the tensor arena if it handles tensors
+// tensor arguments and variables hold a reference to their value, which
+// they drop on every return, after the scope has freed the tensors made
+// during the call and given the result a reference of its own
+void CodeGenVisitor::addArenaScope(Function *theFunction) {
+    Type *tensorPtr = valueType(VALUE_TENSOR);
+    bool usesTensors = theFunction->getReturnType() == tensorPtr;
+    std::vector<Argument *> args;
+    std::vector<AllocaInst *> vars;
+    std::vector<ReturnInst *> returns;
+    for (auto &arg : theFunction->args())
+        if (arg.getType() == tensorPtr)
+            args.push_back(&arg);
+    for (auto &bb : *theFunction) {
+        for (auto &inst : bb) {
+            if (auto *call = dyn_cast<CallInst>(&inst))
+                usesTensors |= call->getType() == tensorPtr;
+            else if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
+                if (alloca->getAllocatedType() == tensorPtr)
+                    vars.push_back(alloca);
+            }
+            else if (auto *ret = dyn_cast<ReturnInst>(&inst))
+                returns.push_back(ret);
+        }
+    }
+    if (!usesTensors && vars.empty())
+        return;
+    auto *null = ConstantPointerNull::get(cast<PointerType>(tensorPtr));
+    // variables start out empty, arguments are stored into theirs later
+    IRBuilder<> b(*context);
+    for (AllocaInst *var : vars) {
+        b.SetInsertPoint(var->getNextNode());
+        b.CreateStore(null, var);
+    }
+    b.SetInsertPoint(&theFunction->getEntryBlock(),
+                     theFunction->getEntryBlock().getFirstInsertionPt());
+    Value *mark = b.CreateCall(runtimeFunction("lisa_arena_enter"), {}, "arena");
+    for (Argument *arg : args)
+        b.CreateCall(runtimeFunction("lisa_tensor_retain"), {arg});
+    for (ReturnInst *ret : returns) {
+        b.SetInsertPoint(ret);
+        Value *keep = ret->getReturnValue();
+        if (!keep || keep->getType() != tensorPtr)
+            keep = null;
+        b.CreateCall(runtimeFunction("lisa_arena_exit"), {mark, keep});
+        for (AllocaInst *var : vars)
+            b.CreateCall(runtimeFunction("lisa_tensor_free"), {b.CreateLoad(tensorPtr, var)});
+    }
+}
+
+
+// load a field of the descriptor, dim selects an element of shape/strides
+Value *CodeGenVisitor::tensorField(Value *tensor, unsigned field,
+                                   const Twine &name, int dim) {
+    Type *i32 = Type::getInt32Ty(*context);
+    std::vector<Value *> idx = {ConstantInt::get(i32, 0), ConstantInt::get(i32, field)};
+    if (dim >= 0)
+        idx.push_back(ConstantInt::get(i32, dim));
+    Value *ptr = builder.CreateInBoundsGEP(tensorType(), tensor, idx, name + ".ptr");
+    Type *type = Type::getInt64Ty(*context);
+    if (field == FIELD_DATA)
+        type = Type::getDoublePtrTy(*context);
+    return builder.CreateLoad(type, ptr, name);
+}
+
+
+// the shape argument of lisa_tensor_new, an array in the entry block
+static Value *shapeArray(IRBuilder<> &builder, Function *fn,
+                         const std::vector<Value *> &dims) {
+    IRBuilder<> tmpB(&fn->getEntryBlock(), fn->getEntryBlock().begin());
+    Type *i64 = builder.getInt64Ty();
+    AllocaInst *shape = tmpB.CreateAlloca(
+        i64, builder.getInt32(std::max<size_t>(dims.size(), 1)), "shape");
+    for (size_t k = 0; k < dims.size(); k++)
+        builder.CreateStore(dims[k], builder.CreateConstInBoundsGEP1_64(i64, shape, k));
+    return shape;
+}
+
+
+// element-wise operations on fewer elements than this, of a shape known
+// at compile time, are emitted as straight-line code
+static const int64_t unrollLimit = 16;
+
+
+// a tensor of a known shape that does not escape, its descriptor and
+// buffer are allocas in the entry block, not owned so the runtime never
+// frees them, with fill every element is set to it
+Value *CodeGenVisitor::createStackTensor(const StaticShape &shape, Value *fill) {
+    Function *theFunction = builder.GetInsertBlock()->getParent();
+    Type *doubleTy = Type::getDoubleTy(*context);
+    Type *i32 = Type::getInt32Ty(*context);
+    int64_t size = shape.size();
+    AllocaInst *tensor = createEntryBlockAlloca(theFunction, "stack.tensor", tensorType());
+    AllocaInst *buffer = createEntryBlockAlloca(
+        theFunction, "stack.data", ArrayType::get(doubleTy, std::max<int64_t>(size, 1)));
+    buffer->setAlignment(Align(LISA_ALIGNMENT));
+    Value *data = builder.CreateConstInBoundsGEP2_64(buffer->getAllocatedType(), buffer, 0, 0);
+
+    auto field = [&](unsigned f, int dim) {
+        std::vector<Value *> idx = {ConstantInt::get(i32, 0), ConstantInt::get(i32, f)};
+        if (dim >= 0)
+            idx.push_back(ConstantInt::get(i32, dim));
+        return builder.CreateInBoundsGEP(tensorType(), tensor, idx);
+    };
+    builder.CreateStore(data, field(FIELD_DATA, -1));
+    builder.CreateStore(builder.getInt64(shape.dims.size()), field(FIELD_RANK, -1));
+    builder.CreateStore(builder.getInt64(size), field(FIELD_SIZE, -1));
+    int64_t stride = 1;
+    for (int k = LISA_MAX_RANK - 1; k >= 0; k--) {
+        bool used = k < (int)shape.dims.size();
+        builder.CreateStore(builder.getInt64(used ? shape.dims[k] : 1), field(FIELD_SHAPE, k));
+        builder.CreateStore(builder.getInt64(used ? stride : 0), field(FIELD_STRIDES, k));
+        if (used)
+            stride *= shape.dims[k];
+    }
+    builder.CreateStore(builder.getInt64(0), field(FIELD_FLAGS, -1));
+    builder.CreateStore(builder.getInt64(0), field(FIELD_REFS, -1));
+
+    if (fill && size <= unrollLimit) {
+        for (int64_t i = 0; i < size; i++)
+            builder.CreateStore(fill, builder.CreateConstInBoundsGEP1_64(doubleTy, data, i));
+    }
+    else if (fill) {
+        Type *i64 = Type::getInt64Ty(*context);
+        BasicBlock *entryBB = builder.GetInsertBlock();
+        BasicBlock *loopBB = BasicBlock::Create(*context, "fill", theFunction);
+        BasicBlock *exitBB = BasicBlock::Create(*context, "fill.end", theFunction);
+        builder.CreateBr(loopBB);
+        builder.SetInsertPoint(loopBB);
+        PHINode *i = builder.CreatePHI(i64, 2, "i");
+        i->addIncoming(builder.getInt64(0), entryBB);
+        builder.CreateStore(fill, builder.CreateInBoundsGEP(doubleTy, data, i));
+        Value *next = builder.CreateAdd(i, builder.getInt64(1), "i.next");
+        i->addIncoming(next, loopBB);
+        builder.CreateCondBr(builder.CreateICmpEQ(next, builder.getInt64(size)), exitBB, loopBB);
+        builder.SetInsertPoint(exitBB);
+    }
+    return tensor;
+}
+
+
+// for TensorExprAST
+Value *CodeGenVisitor::visit(TensorExprAST *node) {
+    Function *theFunction = builder.GetInsertBlock()->getParent();
+    std::vector<Value *> dims;
+    for (int64_t dim : node->shape)
+        dims.push_back(builder.getInt64(dim));
+    Value *tensor;
+    if (node->stackTensor)
+        tensor = createStackTensor(node->staticShape);
+    else
+        tensor = builder.CreateCall(
+            runtimeFunction("lisa_tensor_new"),
+            {builder.getInt64(dims.size()), shapeArray(builder, theFunction, dims)},
+            "tensor");
+    Value *data = tensorField(tensor, FIELD_DATA, "data");
+    Type *doubleTy = Type::getDoubleTy(*context);
+
+    // constant literals are copied from a global
+    std::vector<Constant *> constants;
+    for (auto &element : node->elements) {
+        if (auto *num = dynamic_cast<NumberExprAST *>(element.get()))
+            constants.push_back(ConstantFP::get(doubleTy, num->val));
+    }
+    if (!constants.empty() && constants.size() == node->elements.size()) {
+        ArrayType *arrayTy = ArrayType::get(doubleTy, constants.size());
+        auto *init = new GlobalVariable(
+            *module, arrayTy, true, GlobalValue::PrivateLinkage,
+            ConstantArray::get(arrayTy, constants), "tensor.init");
+        init->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+        init->setAlignment(Align(LISA_ALIGNMENT));
+        builder.CreateMemCpy(data, Align(LISA_ALIGNMENT), init, Align(LISA_ALIGNMENT),
+                             constants.size() * sizeof(double));
+        return tensor;
+    }
+    for (size_t i = 0; i < node->elements.size(); i++) {
+        Value *val = node->elements[i]->accept(*this);
+        if (!val)
+            return nullptr;
+        if (!val->getType()->isDoubleTy())
+            return codeGenError("tensor elements have to be scalars");
+        builder.CreateStore(val, builder.CreateConstInBoundsGEP1_64(doubleTy, data, i));
+    }
+    return tensor;
+}
+
+
+// address of an element, the indices are checked against the shape
+Value *CodeGenVisitor::tensorElementPtr(IndexExprAST *node) {
+    if (node->indices.size() > LISA_MAX_RANK)
+        return codeGenError("too many indices");
+    Value *tensor = node->tensor->accept(*this);
+    if (!tensor)
+        return nullptr;
+    if (!tensor->getType()->isPointerTy())
+        return codeGenError("only tensors can be indexed");
+    std::vector<Value *> indices;
+    for (auto &index : node->indices) {
+        Value *val = index->accept(*this);
+        if (!val)
+            return nullptr;
+        if (!val->getType()->isDoubleTy())
+            return codeGenError("tensor indices have to be scalars");
+        indices.push_back(builder.CreateFPToSI(val, builder.getInt64Ty(), "idx"));
+    }
+
+    Function *theFunction = builder.GetInsertBlock()->getParent();
+    auto check = [&](Value *ok, const char *fn, ArrayRef<Value *> args) {
+        BasicBlock *failBB = BasicBlock::Create(*context, "index.fail", theFunction);
+        BasicBlock *okBB = BasicBlock::Create(*context, "index.ok", theFunction);
+        builder.CreateCondBr(ok, okBB, failBB);
+        builder.SetInsertPoint(failBB);
+        builder.CreateCall(runtimeFunction(fn), args);
+        builder.CreateUnreachable();
+        builder.SetInsertPoint(okBB);
+    };
+    // with a known shape the rank and constant indices were checked by
+    // shape inference, and the tensor is contiguous so the strides are
+    // constants too
+    const StaticShape &shape = node->tensor->staticShape;
+    bool known = shape.known && shape.dims.size() == indices.size();
+    Value *count = builder.getInt64(indices.size());
+    if (!known) {
+        Value *rank = tensorField(tensor, FIELD_RANK, "rank");
+        check(builder.CreateICmpEQ(rank, count), "lisa_tensor_rank_error", {tensor, count});
+    }
+    Value *offset = builder.getInt64(0);
+    int64_t stride = 1;
+    for (size_t k = indices.size(); k-- > 0;) {
+        Value *dim = known ? builder.getInt64(shape.dims[k]) :
+            tensorField(tensor, FIELD_SHAPE, "dim", k);
+        // negative indices wrap around to large unsigned values
+        if (!known || !isa<ConstantInt>(indices[k]))
+            check(builder.CreateICmpULT(indices[k], dim), "lisa_tensor_index_error",
+                  {tensor, builder.getInt64(k), indices[k]});
+        Value *step = known ? builder.getInt64(stride) :
+            tensorField(tensor, FIELD_STRIDES, "stride", k);
+        offset = builder.CreateAdd(offset, builder.CreateMul(indices[k], step), "offset");
+        if (known)
+            stride *= shape.dims[k];
+    }
+    Value *data = tensorField(tensor, FIELD_DATA, "data");
+    return builder.CreateInBoundsGEP(Type::getDoubleTy(*context), data, offset, "elem");
+}
+
+
+// for IndexExprAST
+Value *CodeGenVisitor::visit(IndexExprAST *node) {
+    Value *ptr = tensorElementPtr(node);
+    if (!ptr)
+        return nullptr;
+    return builder.CreateLoad(Type::getDoubleTy(*context), ptr, "elem");
+}
+
+
+// a tensor operand that was just made for this operation and is used
+// nowhere else, not on the stack as the result may escape
+static bool isTemporary(ExprAST *expr) {
+    if (expr->stackTensor)
+        return false;
+    if (auto *bin = dynamic_cast<BinaryExprAST *>(expr))
+        return bin->op != ':';
+    if (auto *call = dynamic_cast<CallExprAST *>(expr))
+        return isElementwiseBuiltin(call->callee) || call->callee == "math.matmul" ||
+            call->callee == "tensor.zeros" || call->callee == "tensor.fill";
+    if (auto *fused = dynamic_cast<FusedExprAST *>(expr))
+        return !fused->reduced;
+    return dynamic_cast<TensorExprAST *>(expr) != nullptr;
+}
+
+
+// the operand the element-wise operation node can write its result into,
+// rather than a new tensor, null if there is none
+// a temporary operand is overwritten directly, so "a * b + c" without
+// fusion makes one tensor, and if node is the right-hand side of "x: ..."
+// reading x, the value of x is used if nothing else refers to it, so loops
+// like "x: x * 2" allocate nothing, or else a copy (copy on write), the
+// operands reading x are replaced by it
+// leaves are the operand expressions, an if or an assignment among them
+// may hand over x without taking a reference, so then x is not reused
+Value *CodeGenVisitor::inPlaceOutput(ExprAST *node, ArrayRef<ExprAST *> leaves,
+                                     std::vector<Value *> &operands) {
+    if (node->stackTensor)
+        return nullptr;
+    for (size_t k = 0; k < leaves.size(); k++)
+        if (operands[k]->getType()->isPointerTy() && isTemporary(leaves[k]))
+            return operands[k];
+    if (node != inPlaceSite)
+        return nullptr;
+    std::vector<size_t> reads;
+    for (size_t k = 0; k < leaves.size(); k++) {
+        auto *bin = dynamic_cast<BinaryExprAST *>(leaves[k]);
+        if (dynamic_cast<IfExprAST *>(leaves[k]) || (bin && bin->op == ':'))
+            return nullptr;
+        auto *var = dynamic_cast<VariableExprAST *>(leaves[k]);
+        if (var && var->name == inPlaceVar && operands[k]->getType()->isPointerTy())
+            reads.push_back(k);
+    }
+    if (reads.empty())
+        return nullptr;
+    Value *dest = builder.CreateCall(runtimeFunction("lisa_tensor_unique"),
+                                     {operands[reads.front()]}, inPlaceVar + ".unique");
+    for (size_t k : reads)
+        operands[k] = dest;
+    return dest;
+}
+
+
+// a loop over the elements of the tensor operands, scalar operands are
+// broadcast and tensor operands must have the same shape
+// body computes one element from the operand values, its results are
+// stored into a new tensor for the expression output (if not null) and
+// combined by the reductions,
+// whose scalar results are returned in reduced
+// operands whose shape is known (shapes) are contiguous and checked
+// already, if any is known the trip count is a constant and small
+// shapes are fully unrolled
+// with dest the result is written into it, it is one of the operands
+// (see inPlaceOutput)
+// at least one operand is a tensor, false if the body failed
+bool CodeGenVisitor::createElementwise(ArrayRef<Value *> operands,
+                                       ArrayRef<const StaticShape *> shapes,
+                                       function_ref<Value *(ArrayRef<Value *>)> body,
+                                       ExprAST *output, ArrayRef<ReduceKind> reductions,
+                                       Value *&result, std::vector<Value *> &reduced,
+                                       Value *dest) {
+    Type *doubleTy = Type::getDoubleTy(*context);
+    Type *i64 = Type::getInt64Ty(*context);
+    std::vector<Value *> inputs(operands.begin(), operands.end());
+    std::vector<Value *> data(inputs.size(), nullptr);
+    Value *shaped = nullptr;
+    const StaticShape *shape = nullptr;
+    bool shapedKnown = false;
+    Value *out = nullptr;
+    if (dest) {
+        // buffers of the runtime are aligned
+        auto *load = cast<LoadInst>(tensorField(dest, FIELD_DATA, "out"));
+        load->setMetadata(LLVMContext::MD_align, MDNode::get(*context,
+            ConstantAsMetadata::get(builder.getInt64(LISA_ALIGNMENT))));
+        out = load;
+    }
+    for (size_t k = 0; k < inputs.size(); k++) {
+        if (!inputs[k]->getType()->isPointerTy())
+            continue;
+        bool known = shapes[k] && shapes[k]->known;
+        // the destination is contiguous
+        if (!known && inputs[k] != dest)
+            inputs[k] = builder.CreateCall(runtimeFunction("lisa_tensor_contiguous"),
+                                           {inputs[k]}, "packed");
+        if (known && !shape)
+            shape = shapes[k];
+        if (!shaped) {
+            shaped = inputs[k];
+            shapedKnown = known;
+        }
+        else if (!known || !shapedKnown)
+            builder.CreateCall(runtimeFunction("lisa_tensor_check_shapes"),
+                               {shaped, inputs[k]});
+        data[k] = inputs[k] == dest ? out : tensorField(inputs[k], FIELD_DATA, "in");
+    }
+    assert(shaped && "element-wise loop without a tensor operand");
+    Value *n = shape ? builder.getInt64(shape->size()) : tensorField(shaped, FIELD_SIZE, "n");
+    result = nullptr;
+    if (output && dest)
+        result = dest;
+    else if (output && output->stackTensor) {
+        result = createStackTensor(output->staticShape);
+        out = tensorField(result, FIELD_DATA, "out");
+    }
+    else if (output) {
+        result = builder.CreateCall(runtimeFunction("lisa_tensor_new_like"),
+                                    {shaped}, "result");
+        // fresh buffers are aligned
+        auto *load = cast<LoadInst>(tensorField(result, FIELD_DATA, "out"));
+        load->setMetadata(LLVMContext::MD_align, MDNode::get(*context,
+            ConstantAsMetadata::get(builder.getInt64(LISA_ALIGNMENT))));
+        out = load;
+    }
+    // and never overlap the inputs, except the one updated in place, whose
+    // loads are left untagged
+    MDBuilder mdb(*context);
+    MDNode *domain = mdb.createAnonymousAliasScopeDomain("tensor.op");
+    MDNode *scope = MDNode::get(*context, mdb.createAnonymousAliasScope(domain, "out"));
+
+    std::vector<Value *> inits;
+    for (ReduceKind kind : reductions) {
+        double init = kind == REDUCE_MAX ? -INFINITY : kind == REDUCE_MIN ? INFINITY : 0.0;
+        inits.push_back(ConstantFP::get(doubleTy, init));
+    }
+    // element i, the accumulators are updated in place
+    auto element = [&](Value *i, std::vector<Value *> &accs) {
+        std::vector<Value *> vals(inputs.begin(), inputs.end());
+        for (size_t k = 0; k < inputs.size(); k++) {
+            if (!data[k])
+                continue;
+            auto *load = builder.CreateLoad(doubleTy,
+                builder.CreateInBoundsGEP(doubleTy, data[k], i), "x");
+            if (data[k] != out)
+                load->setMetadata(LLVMContext::MD_noalias, scope);
+            vals[k] = load;
+        }
+        Value *val = body(vals);
+        if (!val)
+            return false;
+        if (out) {
+            auto *store = builder.CreateStore(val, builder.CreateInBoundsGEP(doubleTy, out, i));
+            store->setMetadata(LLVMContext::MD_alias_scope, scope);
+        }
+        // sums may be reassociated so the loop still vectorizes
+        for (size_t r = 0; r < reductions.size(); r++) {
+            switch (reductions[r]) {
+                case REDUCE_MAX:
+                    accs[r] = builder.CreateBinaryIntrinsic(Intrinsic::maxnum, accs[r], val);
+                    break;
+                case REDUCE_MIN:
+                    accs[r] = builder.CreateBinaryIntrinsic(Intrinsic::minnum, accs[r], val);
+                    break;
+                default: {
+                    FastMathFlags fmf;
+                    fmf.setAllowReassoc();
+                    fmf.setNoSignedZeros();
+                    accs[r] = builder.CreateFAdd(accs[r], val, "sum");
+                    cast<Instruction>(accs[r])->setFastMathFlags(fmf);
+                    break;
+                }
+            }
+        }
+        return true;
+    };
+    auto finish = [&](ArrayRef<Value *> accs) {
+        reduced.clear();
+        for (size_t r = 0; r < reductions.size(); r++) {
+            Value *res = accs[r];
+            if (reductions[r] == REDUCE_MEAN)
+                res = builder.CreateFDiv(res, builder.CreateSIToFP(n, doubleTy), "mean");
+            reduced.push_back(res);
+        }
+    };
+
+    if (shape && shape->size() <= unrollLimit) {
+        std::vector<Value *> accs = inits;
+        for (int64_t i = 0; i < shape->size(); i++)
+            if (!element(builder.getInt64(i), accs))
+                return false;
+        finish(accs);
+        return true;
+    }
+
+    Function *theFunction = builder.GetInsertBlock()->getParent();
+    BasicBlock *entryBB = builder.GetInsertBlock();
+    BasicBlock *loopBB = BasicBlock::Create(*context, "elementwise", theFunction);
+    BasicBlock *exitBB = BasicBlock::Create(*context, "elementwise.end", theFunction);
+    Value *zero = ConstantInt::get(i64, 0);
+    if (shape)
+        builder.CreateBr(loopBB);
+    else
+        builder.CreateCondBr(builder.CreateICmpEQ(n, zero, "empty"), exitBB, loopBB);
+    builder.SetInsertPoint(loopBB);
+    PHINode *i = builder.CreatePHI(i64, 2, "i");
+    i->addIncoming(zero, entryBB);
+    std::vector<PHINode *> phis;
+    std::vector<Value *> accs;
+    for (Value *init : inits) {
+        phis.push_back(builder.CreatePHI(doubleTy, 2, "acc"));
+        phis.back()->addIncoming(init, entryBB);
+        accs.push_back(phis.back());
+    }
+    if (!element(i, accs))
+        return false;
+    Value *next = builder.CreateNUWAdd(i, ConstantInt::get(i64, 1), "next");
+    BasicBlock *latchBB = builder.GetInsertBlock();
+    i->addIncoming(next, latchBB);
+    for (size_t r = 0; r < reductions.size(); r++)
+        phis[r]->addIncoming(accs[r], latchBB);
+    builder.CreateCondBr(builder.CreateICmpEQ(next, n, "done"), exitBB, loopBB);
+    builder.SetInsertPoint(exitBB);
+    std::vector<Value *> results;
+    for (size_t r = 0; r < reductions.size(); r++) {
+        PHINode *phi = builder.CreatePHI(doubleTy, 2, "reduced");
+        if (!shape)
+            phi->addIncoming(inits[r], entryBB);
+        phi->addIncoming(accs[r], latchBB);
+        results.push_back(phi);
+    }
+    finish(results);
+    return true;
+}
+
+
+// math.pi and math.e, or x.size, x.rank and x.shape of a tensor variable
+Value *CodeGenVisitor::createQualifiedVariable(VariableExprAST *node) {
+    if (node->name == "math.pi")
+        return ConstantFP::get(*context, APFloat(M_PI));
+    if (node->name == "math.e")
+        return ConstantFP::get(*context, APFloat(M_E));
+    size_t dot = node->name.rfind('.');
+    std::string base = node->name.substr(0, dot);
+    std::string attr = node->name.substr(dot + 1);
+    AllocaInst *v = namedValues[base];
+    if (!v || !v->getAllocatedType()->isPointerTy()) {
+        std::string err = "Undefined identifier: " + node->name;
+        return codeGenError(err.c_str());
+    }
+    Value *tensor = builder.CreateLoad(v->getAllocatedType(), v, base);
+    Type *doubleTy = Type::getDoubleTy(*context);
+    if (attr == "size")
+        return builder.CreateSIToFP(tensorField(tensor, FIELD_SIZE, "size"), doubleTy);
+    if (attr == "rank")
+        return builder.CreateSIToFP(tensorField(tensor, FIELD_RANK, "rank"), doubleTy);
+    if (attr == "shape")
+        return builder.CreateCall(runtimeFunction("lisa_tensor_shape"), {tensor}, "shape");
+    std::string err = "Unknown tensor attribute: " + attr;
+    return codeGenError(err.c_str());
+}
+
+
+// a math.* function of scalars
+Value *CodeGenVisitor::createMathCall(const std::string &name, ArrayRef<Value *> args) {
+    unsigned arity = name == "math.pow" ? 2 : 1;
+    if (args.size() != arity) {
+        std::string err = name + " takes " + std::to_string(arity) + " argument" +
+            (arity > 1 ? "s" : "");
+        return codeGenError(err.c_str());
+    }
+    if (name == "math.pow")
+        return builder.CreateBinaryIntrinsic(Intrinsic::pow, args[0], args[1]);
+    Intrinsic::ID id = mathFunctions.at(name);
+    if (id != Intrinsic::not_intrinsic)
+        return builder.CreateUnaryIntrinsic(id, args[0]);
+    // 1 / (1 + e^-x), the exp is vectorized like math.exp
+    if (name == "math.sigmoid") {
+        Value *e = builder.CreateUnaryIntrinsic(Intrinsic::exp, builder.CreateFNeg(args[0]));
+        Value *one = ConstantFP::get(args[0]->getType(), 1.0);
+        return builder.CreateFDiv(one, builder.CreateFAdd(one, e));
+    }
+    // no intrinsic, call libm
+    Type *doubleTy = Type::getDoubleTy(*context);
+    FunctionCallee fn = module->getOrInsertFunction(
+        name.substr(5), FunctionType::get(doubleTy, {doubleTy}, false));
+    if (auto *f = dyn_cast<Function>(fn.getCallee())) {
+        f->setDoesNotAccessMemory();
+        f->setDoesNotThrow();
+        f->setWillReturn();
+    }
+    return builder.CreateCall(fn, args);
+}
+
+
+// the loop body of a fused group, leaves are consumed in the order
+// visit(FusedExprAST) evaluated them
+Value *CodeGenVisitor::emitFusedTree(ExprAST *node, ArrayRef<Value *> leaves,
+                                     size_t &next) {
+    if (auto *bin = dynamic_cast<BinaryExprAST *>(node)) {
+        if (bin->op != ':') {
+            Value *lhs = emitFusedTree(bin->lhs.get(), leaves, next);
+            Value *rhs = lhs ? emitFusedTree(bin->rhs.get(), leaves, next) : nullptr;
+            if (!rhs)
+                return nullptr;
+            return createScalarBinary(bin->op, lhs, rhs);
+        }
+    }
+    if (auto *call = dynamic_cast<CallExprAST *>(node)) {
+        if (isElementwiseBuiltin(call->callee)) {
+            std::vector<Value *> args;
+            for (auto &arg : call->args) {
+                args.push_back(emitFusedTree(arg.get(), leaves, next));
+                if (!args.back())
+                    return nullptr;
+            }
+            return createMathCall(call->callee, args);
+        }
+    }
+    return leaves[next++];
+}
+
+
+// every subexpression that is not part of the loop body, in source order
+static void collectLeaves(ExprAST *node, std::vector<ExprAST *> &leaves) {
+    if (auto *bin = dynamic_cast<BinaryExprAST *>(node)) {
+        if (bin->op != ':') {
+            collectLeaves(bin->lhs.get(), leaves);
+            collectLeaves(bin->rhs.get(), leaves);
+            return;
+        }
+    }
+    if (auto *call = dynamic_cast<CallExprAST *>(node)) {
+        if (isElementwiseBuiltin(call->callee)) {
+            for (auto &arg : call->args)
+                collectLeaves(arg.get(), leaves);
+            return;
+        }
+    }
+    leaves.push_back(node);
+}
+
+
+// for FusedExprAST
+Value *CodeGenVisitor::visit(FusedExprAST *node) {
+    std::vector<ExprAST *> leafNodes;
+    collectLeaves(node->root.get(), leafNodes);
+    std::vector<Value *> leaves;
+    std::vector<const StaticShape *> shapes;
+    bool tensors = false;
+    for (ExprAST *leaf : leafNodes) {
+        leaves.push_back(leaf->accept(*this));
+        if (!leaves.back())
+            return nullptr;
+        shapes.push_back(&leaf->staticShape);
+        tensors |= leaves.back()->getType()->isPointerTy();
+    }
+    std::vector<Value *> reduced;
+    Value *result;
+    if (tensors) {
+        std::vector<ReduceKind> kinds;
+        for (auto &reduction : node->reductions)
+            kinds.push_back(reduction.kind);
+        Value *dest = node->reduced ? nullptr : inPlaceOutput(node, leafNodes, leaves);
+        if (!createElementwise(leaves, shapes, [&](ArrayRef<Value *> x) {
+                size_t next = 0;
+                return emitFusedTree(node->root.get(), x, next);
+            }, node->reduced ? nullptr : node, kinds, result, reduced, dest))
+            return nullptr;
+    }
+    else {
+        // every reduction of a single scalar is the scalar itself
+        size_t next = 0;
+        result = emitFusedTree(node->root.get(), leaves, next);
+        if (!result)
+            return nullptr;
+        reduced.assign(node->reductions.size(), result);
+    }
+    for (size_t r = 0; r < node->reductions.size(); r++) {
+        if (node->reductions[r].var.empty())
+            continue;
+        if (!assignVariable(node->reductions[r].var, false, reduced[r]))
+            return nullptr;
+    }
+    return node->reduced ? reduced[0] : result;
+}
+
+
+// built-in functions, their names are qualified by a namespace
+//   tensor.zeros(d0, ...)          a tensor of the given shape, all zero
+//   tensor.fill(value, d0, ...)    a tensor of the given shape, all value
+//   math.exp(x), math.log(x), ...  element-wise on tensors
+//   math.pow(x, y)                 element-wise, either may be a tensor
+//   math.sum(x), math.max(x), ...  reduce a tensor to a scalar
+//   math.matmul(a, b)              matrix product of rank 2 tensors
+//   tensor.load(path), ...         files, see createFileCall
+Value *CodeGenVisitor::createBuiltinCall(CallExprAST *node) {
+    const std::string &name = node->callee;
+    if (name == "tensor.load" || name == "tensor.load_raw" || name == "tensor.save" ||
+        name == "tensor.append" || name == "tensor.load_csv" || name == "tensor.read_csv")
+        return createFileCall(node);
+    std::vector<Value *> args;
+    std::vector<const StaticShape *> shapes;
+    bool tensors = false;
+    for (auto &arg : node->args) {
+        args.push_back(arg->accept(*this));
+        if (!args.back())
+            return nullptr;
+        shapes.push_back(&arg->staticShape);
+        tensors |= args.back()->getType()->isPointerTy();
+    }
+    if (isElementwiseBuiltin(name)) {
+        if (!tensors)
+            return createMathCall(name, args);
+        Value *result;
+        std::vector<Value *> reduced;
+        std::vector<ExprAST *> leaves;
+        for (auto &arg : node->args)
+            leaves.push_back(arg.get());
+        Value *dest = inPlaceOutput(node, leaves, args);
+        if (!createElementwise(args, shapes, [&](ArrayRef<Value *> x) {
+                return createMathCall(name, x);
+            }, node, {}, result, reduced, dest))
+            return nullptr;
+        return result;
+    }
+    ReduceKind kind;
+    if (isReductionBuiltin(name, kind)) {
+        if (args.size() != 1) {
+            std::string err = name + " takes 1 argument";
+            return codeGenError(err.c_str());
+        }
+        if (!tensors)
+            return args[0];
+        Value *result;
+        std::vector<Value *> reduced;
+        createElementwise(args, shapes, [](ArrayRef<Value *> x) { return x[0]; },
+                          nullptr, {kind}, result, reduced);
+        return reduced[0];
+    }
+    if (name == "math.matmul") {
+        if (args.size() != 2 || !args[0]->getType()->isPointerTy() ||
+            !args[1]->getType()->isPointerTy())
+            return codeGenError("math.matmul takes 2 tensors");
+        return builder.CreateCall(runtimeFunction("lisa_tensor_matmul"), args, "matmul");
+    }
+    if (name == "tensor.zeros" || name == "tensor.fill") {
+        Value *fill = ConstantFP::get(*context, APFloat(0.0));
+        if (name == "tensor.fill") {
+            if (args.empty())
+                return codeGenError("tensor.fill needs a value");
+            fill = args.front();
+            args.erase(args.begin());
+        }
+        if (args.empty() || args.size() > LISA_MAX_RANK)
+            return codeGenError("a tensor needs 1 to 4 dimensions");
+        std::vector<Value *> dims;
+        for (Value *arg : args) {
+            if (!arg->getType()->isDoubleTy())
+                return codeGenError("tensor dimensions have to be scalars");
+            dims.push_back(builder.CreateFPToSI(arg, builder.getInt64Ty(), "dim"));
+        }
+        if (!fill->getType()->isDoubleTy())
+            return codeGenError("tensor.fill needs a scalar value");
+        if (node->stackTensor)
+            return createStackTensor(node->staticShape, fill);
+        Function *theFunction = builder.GetInsertBlock()->getParent();
+        return builder.CreateCall(
+            runtimeFunction("lisa_tensor_full"),
+            {builder.getInt64(dims.size()), shapeArray(builder, theFunction, dims), fill},
+            "tensor");
+    }
+    std::string err = "Unknown built-in function: " + name;
+    return codeGenError(err.c_str());
+}
+
+
+// tensor I/O built-ins, the file name is a string literal
+//   tensor.load(path)              map a .npy file
+//   tensor.load_raw(path, d0, ...) map a file of doubles, one dimension
+//                                  may be -1 and is taken from its size
+//   tensor.save(x, path)           write x as a .npy file, the number of
+//                                  elements is the value
+//   tensor.append(x, path)         append the rows of x to a .npy file,
+//                                  the rows in the file are the value
+//   tensor.load_csv(path)          a CSV file of numbers, one row of the
+//                                  tensor per column of the file
+//   tensor.read_csv(path, rows)    the next batch of rows of a CSV file in
+//                                  the same layout, empty after the last
+Value *CodeGenVisitor::createFileCall(CallExprAST *node) {
+    const std::string &name = node->callee;
+    bool load = name == "tensor.load" || name == "tensor.load_raw" ||
+        name == "tensor.load_csv" || name == "tensor.read_csv";
+    size_t pathArg = load ? 0 : 1;
+    auto *path = node->args.size() > pathArg ?
+        dynamic_cast<StringExprAST *>(node->args[pathArg].get()) : nullptr;
+    if (!path) {
+        std::string err = name + " needs a file name in quotes as argument " +
+            std::to_string(pathArg + 1);
+        return codeGenError(err.c_str());
+    }
+    std::vector<Value *> args;
+    for (size_t k = 0; k < node->args.size(); k++) {
+        if (k == pathArg)
+            continue;
+        args.push_back(node->args[k]->accept(*this));
+        if (!args.back())
+            return nullptr;
+    }
+    Value *file = builder.CreateGlobalStringPtr(path->val, "path");
+
+    if (name == "tensor.load") {
+        if (!args.empty())
+            return codeGenError("tensor.load takes 1 argument");
+        return builder.CreateCall(runtimeFunction("lisa_tensor_load_npy"), {file}, "loaded");
+    }
+    if (name == "tensor.load_csv") {
+        if (!args.empty())
+            return codeGenError("tensor.load_csv takes 1 argument");
+        return builder.CreateCall(runtimeFunction("lisa_tensor_load_csv"), {file}, "loaded");
+    }
+    if (name == "tensor.read_csv") {
+        if (args.size() != 1 || !args[0]->getType()->isDoubleTy())
+            return codeGenError("tensor.read_csv takes a file name and a number of rows");
+        Value *rows = builder.CreateFPToSI(args[0], builder.getInt64Ty(), "rows");
+        return builder.CreateCall(runtimeFunction("lisa_tensor_read_csv"), {file, rows}, "batch");
+    }
+    if (name == "tensor.load_raw") {
+        if (args.empty() || args.size() > LISA_MAX_RANK)
+            return codeGenError("a tensor needs 1 to 4 dimensions");
+        std::vector<Value *> dims;
+        for (Value *arg : args) {
+            if (!arg->getType()->isDoubleTy())
+                return codeGenError("tensor dimensions have to be scalars");
+            dims.push_back(builder.CreateFPToSI(arg, builder.getInt64Ty(), "dim"));
+        }
+        Function *theFunction = builder.GetInsertBlock()->getParent();
+        return builder.CreateCall(
+            runtimeFunction("lisa_tensor_load_raw"),
+            {file, builder.getInt64(dims.size()), shapeArray(builder, theFunction, dims)},
+            "loaded");
+    }
+    if (args.size() != 1 || !args[0]->getType()->isPointerTy()) {
+        std::string err = name + " takes a tensor and a file name";
+        return codeGenError(err.c_str());
+    }
+    Value *count = builder.CreateCall(
+        runtimeFunction(name == "tensor.save" ? "lisa_tensor_save_npy" : "lisa_tensor_append_npy"),
+        {args[0], file}, "written");
+    return builder.CreateSIToFP(count, Type::getDoubleTy(*context));
+}
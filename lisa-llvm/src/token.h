@@ -37,6 +37,7 @@ enum TokenType {
     TOK_IN,
     TOK_WHILE,
     TOK_RETURN,
+    TOK_TENSOR,
 };
 
 
@@ -72,6 +73,7 @@ static bool isSingleSymbol(char c) {
         case '&': // logical and
         case '|': // logical or
         case '~': // range separator
+        case '@': // decorator
         case ';':
             return true;
         default:
@@ -184,6 +186,7 @@ static string getTokenTypeString(TokenType tp) {
         case TOK_IN: return "TOK_IN";
         case TOK_WHILE: return "TOK_WHILE";
         case TOK_RETURN: return "TOK_RETURN";
+        case TOK_TENSOR: return "TOK_TENSOR";
         default: return "TOK_UNKNOWN";
     }
 }
@@ -0,0 +1,121 @@
+/**
+ * @file vectormath.cpp
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#include "vectormath.h"
+#include <map>
+#include <vector>
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/CodeGen/TargetSubtargetInfo.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+using namespace llvm;
+
+
+namespace lisa
+{
+// scalar functions codegen calls for the math.* builtins, the prefix of
+// their vector variants in the runtime, and the fewest lanes at which the
+// variant beats libm (log and erf lose to it on SSE2, see
+// benchmarks/vmath_bench.cpp)
+struct VectorFunction {
+    StringRef prefix;
+    unsigned minWidth;
+};
+
+static const std::map<StringRef, VectorFunction> vectorFunctions = {
+    {"llvm.exp.f64", {"lisa_vexp", 2}},
+    {"llvm.log.f64", {"lisa_vlog", 4}},
+    {"llvm.sin.f64", {"lisa_vsin", 2}},
+    {"llvm.cos.f64", {"lisa_vcos", 2}},
+    {"tanh", {"lisa_vtanh", 2}},
+    {"erf", {"lisa_verf", 4}},
+};
+
+
+// lanes of the vector variants fn can call, the kernels pass vectors in
+// registers as the SysV and AAPCS64 ABIs do, Windows passes them in memory
+static std::vector<unsigned> vectorWidths(Function &fn, TargetMachine *tm,
+                                          const TargetTransformInfo &tti) {
+    std::vector<unsigned> widths;
+    Triple triple(fn.getParent()->getTargetTriple());
+    if (triple.isOSWindows() || !(triple.getArch() == Triple::x86_64 || triple.isAArch64()))
+        return widths;
+    unsigned bits = tti.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector)
+        .getFixedSize();
+    if (bits >= 128)
+        widths.push_back(2);
+    if (triple.getArch() != Triple::x86_64)
+        return widths;
+    const TargetSubtargetInfo *sti = tm->getSubtargetImpl(fn);
+    if (bits >= 256 && sti->checkFeatures("+avx2,+fma"))
+        widths.push_back(4);
+    if (bits >= 512 && sti->checkFeatures("+avx512f"))
+        widths.push_back(8);
+    return widths;
+}
+
+
+// declared once per module, and kept until the vectorizer has run
+static Function *declareVariant(Module &module, StringRef prefix, unsigned width) {
+    std::string name = (prefix + "_d" + Twine(width)).str();
+    if (Function *fn = module.getFunction(name))
+        return fn;
+    Type *vecTy = FixedVectorType::get(Type::getDoubleTy(module.getContext()), width);
+    auto *fn = Function::Create(FunctionType::get(vecTy, {vecTy}, false),
+                                GlobalValue::ExternalLinkage, name, module);
+    fn->setDoesNotAccessMemory();
+    fn->setDoesNotThrow();
+    fn->setWillReturn();
+    appendToCompilerUsed(module, {fn});
+    return fn;
+}
+
+
+PreservedAnalyses VectorMathPass::run(Module &module, ModuleAnalysisManager &mam) {
+    if (!targetMachine)
+        return PreservedAnalyses::all();
+    auto &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(module).getManager();
+    bool changed = false;
+    for (Function &fn : module) {
+        if (fn.isDeclaration())
+            continue;
+        std::vector<unsigned> widths;
+        bool known = false;
+        for (Instruction &inst : instructions(fn)) {
+            auto *call = dyn_cast<CallInst>(&inst);
+            Function *callee = call ? call->getCalledFunction() : nullptr;
+            if (!callee || call->hasFnAttr(VFABI::MappingsAttrName))
+                continue;
+            auto it = vectorFunctions.find(callee->getName());
+            if (it == vectorFunctions.end())
+                continue;
+            if (!known) {
+                widths = vectorWidths(fn, targetMachine, fam.getResult<TargetIRAnalysis>(fn));
+                known = true;
+            }
+            SmallVector<std::string, 8> variants;
+            for (unsigned width : widths) {
+                if (width < it->second.minWidth)
+                    continue;
+                Function *variant = declareVariant(module, it->second.prefix, width);
+                variants.push_back(VFABI::mangleTLIVectorName(
+                    variant->getName(), it->first, 1, ElementCount::getFixed(width)));
+            }
+            if (variants.empty())
+                continue;
+            VFABI::setVectorVariantNames(call, variants);
+            changed = true;
+        }
+    }
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+}
@@ -0,0 +1,45 @@
+/**
+ * @file vectormath.h
+ * @version 0.1.2
+ * @date 2026-10-18
+ *
+ * @copyright Copyright Yuelin Xin (c) 2024
+ *
+ */
+
+#ifndef VECTORMATH_H
+#define VECTORMATH_H
+
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Target/TargetMachine.h"
+
+
+namespace lisa
+{
+// vector variants of math.exp, math.log, math.sin, math.cos, math.tanh
+// and math.erf for the loop vectorizer
+// every call of the scalar function gets a vector-function-abi-variant
+// attribute naming the SIMD kernels of the runtime (lisa_vexp_d4 for 4
+// lanes and so on, runtime/vmath_kernels.h), so a vectorized loop calls
+// one kernel per vector instead of libm per element
+// a function is only given the widths its own target can call with the
+// standard vector ABI: 2 lanes on every target, 4 with AVX2 and FMA, 8
+// with 512-bit AVX-512 registers, so -fmultiversion clones each get theirs
+// log and erf start at 4 lanes, on SSE2 libm is faster
+class VectorMathPass : public llvm::PassInfoMixin<VectorMathPass>
+{
+public:
+    explicit VectorMathPass(llvm::TargetMachine *targetMachine) :
+        targetMachine(targetMachine) {}
+    llvm::PreservedAnalyses run(llvm::Module &module,
+                                llvm::ModuleAnalysisManager &mam);
+private:
+    llvm::TargetMachine *targetMachine;
+};
+}
+
+
+#endif
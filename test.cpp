@@ -29,7 +29,7 @@ int main() {
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 
     std::cout << "fib_lisa() returned " << res << std::endl;
-    std::cout << "Time taken by fib_lisa(): " << duration.count() << " ms" << std::endl;
+    std::cout << "Time taken by fib_lisa(): " << duration.count() << " us" << std::endl;
 
     return 0;
 }